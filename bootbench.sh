@@ -0,0 +1,69 @@
+#!/bin/sh
+#
+# bootbench.sh - boot each system in bootbench.conf to its prompt and print how
+# long it took, in emulated cycles and seconds and in host seconds.
+#
+# usage: bootbench.sh [-c conf] [-d dir] [-t secs] [-o results.csv] [name...]
+#
+#   -c conf    systems to boot (bootbench.conf next to this script)
+#   -d dir     where their directories are (.)
+#   -t secs    host seconds before a boot counts as hung (120)
+#   -o file    also append the results as CSV: date,version,name,cycles,instrs,host
+#
+# Set Z280RC to use another z280rc binary. Exits 1 when any system misses its prompt.
+
+here=$(cd "$(dirname "$0")" && pwd)
+conf=$here/bootbench.conf
+dir=.
+secs=120
+csv=
+Z280RC=${Z280RC:-$here/z280rc}
+
+while getopts c:d:t:o: opt; do
+	case $opt in
+	c) conf=$OPTARG ;;
+	d) dir=$OPTARG ;;
+	t) secs=$OPTARG ;;
+	o) csv=$OPTARG ;;
+	*) sed -n 's/^# usage: //p' "$0"; exit 1 ;;
+	esac
+done
+shift $((OPTIND - 1))
+dir=$(cd "$dir" && pwd) || exit 1
+
+version=$(cd "$here" && git describe --always --dirty 2>/dev/null || echo unknown)
+date=$(date +%Y-%m-%d)
+failures=0
+
+printf '%-8s %12s %8s %12s %8s %8s  %s\n' system cycles "emu s" instrs "host s" speed result
+while read -r name sysdir image opts; do
+	case $name in ''|\#*) continue ;; esac
+	if [ $# -gt 0 ]; then
+		case " $* " in *" $name "*) ;; *) continue ;; esac
+	fi
+	case $sysdir in /*) ;; *) sysdir=$dir/$sysdir ;; esac
+	if [ ! -f "$sysdir/$image" ] || [ ! -f "$sysdir/cfmonldr.bin" ]; then
+		printf '%-8s %12s %8s %12s %8s %8s  %s\n' "$name" - - - - - "skipped: no $sysdir/$image or cfmonldr.bin"
+		continue
+	fi
+	out=$(cd "$sysdir" && eval "IDE00=\"\$image\" timeout $secs \"\$Z280RC\" -detach $opts" 2>&1 </dev/null)
+	# the last step matched ends the run, so the last Script: line is the prompt
+	last=$(printf '%s\n' "$out" | grep '^Script: ' | tail -n 1)
+	steps=$(printf '%s\n' "$out" | grep -c '^Script: ')
+	want=$(eval "set -- $opts; for o; do echo \"\$o\"; done" | grep -c '^-expect=')
+	if [ "$steps" -ne "$want" ]; then
+		printf '%-8s %12s %8s %12s %8s %8s  %s\n' "$name" - - - - - "FAILED: $steps of $want prompts within $secs s"
+		failures=$((failures + 1))
+		continue
+	fi
+	# Script: "text" after C cycles (E s), I instrs, H s host
+	echo "$last" | awk -v name="$name" '{
+		printf "%-8s %12s %8s %12s %8s %7.2fx  ok\n", name, $(NF-8), substr($(NF-6), 2), $(NF-4), $(NF-2),
+			($(NF-2) > 0 ? substr($(NF-6), 2) / $(NF-2) : 0)
+	}'
+	if [ -n "$csv" ]; then
+		echo "$last" | awk -v d="$date" -v v="$version" -v name="$name" \
+			'{ print d "," v "," name "," $(NF-8) "," $(NF-4) "," $(NF-2) }' >>"$csv"
+	fi
+done <"$conf"
+[ $failures -eq 0 ]
@@ -33,7 +33,7 @@
 //#include "lib.h"
 //#include "monitor.h"
 #include "rtc.h"
-//#include "snapshot.h"
+#include "../snapshot/snapshot.h"
 
 #include <time.h>
 #include <stdlib.h>
@@ -737,11 +737,11 @@ int ds1202_1302_dump(rtc_ds1202_1302_t *context)
    STRING | device              | device name STRING
  */
 
-//static char snap_module_name[] = "RTC_DS1202_1302";
+static char snap_module_name[] = "RTC_DS1202_1302";
 #define SNAP_MAJOR 0
 #define SNAP_MINOR 0
 
-/*int ds1202_1302_write_snapshot(rtc_ds1202_1302_t *context, snapshot_t *s)
+int ds1202_1302_write_snapshot(rtc_ds1202_1302_t *context, snapshot_t *s)
 {
     uint32_t clock_halt_latch_hi = 0;
     uint32_t clock_halt_latch_lo = 0;
@@ -753,22 +753,15 @@ int ds1202_1302_dump(rtc_ds1202_1302_t *context)
     uint32_t old_offset_hi = 0;
     snapshot_module_t *m;
 
-    / time_t can be either 32bit or 64bit, so we save as 64bit /
-#if (SIZE_OF_TIME_T == 8)
-    clock_halt_latch_hi = (uint32_t)(context->clock_halt_latch >> 32);
-    clock_halt_latch_lo = (uint32_t)(context->clock_halt_latch & 0xffffffff);
-    latch_hi = (uint32_t)(context->latch >> 32);
-    latch_lo = (uint32_t)(context->latch & 0xffffffff);
-    offset_hi = (uint32_t)(context->offset >> 32);
-    offset_lo = (uint32_t)(context->offset & 0xffffffff);
-    old_offset_hi = (uint32_t)(context->old_offset >> 32);
-    old_offset_lo = (uint32_t)(context->old_offset & 0xffffffff);
-#else
-    clock_halt_latch_lo = (uint32_t)context->clock_halt_latch;
-    latch_lo = (uint32_t)context->latch;
-    offset_lo = (uint32_t)context->offset;
-    old_offset_lo = (uint32_t)context->old_offset;
-#endif
+    /* time_t can be either 32bit or 64bit, so we save as 64bit */
+    clock_halt_latch_hi = (uint32_t)((uint64_t)context->clock_halt_latch >> 32);
+    clock_halt_latch_lo = (uint32_t)((uint64_t)context->clock_halt_latch & 0xffffffff);
+    latch_hi = (uint32_t)((uint64_t)context->latch >> 32);
+    latch_lo = (uint32_t)((uint64_t)context->latch & 0xffffffff);
+    offset_hi = (uint32_t)((uint64_t)context->offset >> 32);
+    offset_lo = (uint32_t)((uint64_t)context->offset & 0xffffffff);
+    old_offset_hi = (uint32_t)((uint64_t)context->old_offset >> 32);
+    old_offset_lo = (uint32_t)((uint64_t)context->old_offset & 0xffffffff);
 
     m = snapshot_module_create(s, snap_module_name, SNAP_MAJOR, SNAP_MINOR);
 
@@ -819,6 +812,7 @@ int ds1202_1302_read_snapshot(rtc_ds1202_1302_t *context, snapshot_t *s)
     uint32_t old_offset_lo = 0;
     uint32_t old_offset_hi = 0;
     uint8_t vmajor, vminor;
+    char *device = NULL;
     snapshot_module_t *m;
 
     m = snapshot_module_open(s, snap_module_name, &vmajor, &vminor);
@@ -827,7 +821,7 @@ int ds1202_1302_read_snapshot(rtc_ds1202_1302_t *context, snapshot_t *s)
         return -1;
     }
 
-    / Do not accept versions higher than current /
+    /* Do not accept versions higher than current */
     if (vmajor > SNAP_MAJOR || vminor > SNAP_MINOR) {
         snapshot_set_error(SNAPSHOT_MODULE_HIGHER_VERSION);
         goto fail;
@@ -858,31 +852,25 @@ int ds1202_1302_read_snapshot(rtc_ds1202_1302_t *context, snapshot_t *s)
         || SMR_B(m, &context->io_byte) < 0
         || SMR_B(m, &context->sclk_line) < 0
         || SMR_B(m, &context->clock_register) < 0
-        || SMR_STR(m, &context->device) < 0) {
+        || SMR_STR(m, &device) < 0) {
         goto fail;
     }
 
     snapshot_module_close(m);
 
-#if (SIZE_OF_TIME_T == 8)
-    context->clock_halt_latch = (time_t)(clock_halt_latch_hi) << 32;
-    context->clock_halt_latch |= clock_halt_latch_lo;
-    context->latch = (time_t)(latch_hi) << 32;
-    context->latch |= latch_lo;
-    context->offset = (time_t)(offset_hi) << 32;
-    context->offset |= offset_lo;
-    context->old_offset = (time_t)(old_offset_hi) << 32;
-    context->old_offset |= old_offset_lo;
-#else
-    context->clock_halt_latch = clock_halt_latch_lo;
-    context->latch = latch_lo;
-    context->offset = offset_lo;
-    context->old_offset = old_offset_lo;
-#endif
+    if (device) {
+        lib_free(context->device);
+        context->device = device;
+    }
+
+    context->clock_halt_latch = (time_t)(((uint64_t)clock_halt_latch_hi << 32) | clock_halt_latch_lo);
+    context->latch = (time_t)(((uint64_t)latch_hi << 32) | latch_lo);
+    context->offset = (time_t)(((uint64_t)offset_hi << 32) | offset_lo);
+    context->old_offset = (time_t)(((uint64_t)old_offset_hi << 32) | old_offset_lo);
 
     return 0;
 
 fail:
     snapshot_module_close(m);
     return -1;
-}*/
+}
@@ -30,7 +30,7 @@
 #define VICE_DS1202_1302_H
 
 #include <stdint.h>
-//#include "snapshot.h"
+#include "../snapshot/snapshot.h"
 //#include "types.h"
 
 typedef struct rtc_ds1202_1302_s rtc_ds1202_1302_t;
@@ -44,7 +44,7 @@ extern uint8_t ds1202_1302_read_data_line(rtc_ds1202_1302_t *context);
 
 extern int ds1202_1302_dump(rtc_ds1202_1302_t *context);
 
-//extern int ds1202_1302_write_snapshot(rtc_ds1202_1302_t *context, snapshot_t *s);
-//extern int ds1202_1302_read_snapshot(rtc_ds1202_1302_t *context, snapshot_t *s);
+extern int ds1202_1302_write_snapshot(rtc_ds1202_1302_t *context, snapshot_t *s);
+extern int ds1202_1302_read_snapshot(rtc_ds1202_1302_t *context, snapshot_t *s);
 
 #endif
@@ -62,6 +62,14 @@ inline static int bcd_to_int(int bcd)
 
 /* ---------------------------------------------------------------------- */
 
+/* host clock, the emulator may substitute its own to record or replay runs */
+time_t (*rtc_time_hook)(void) = NULL;
+
+static time_t rtc_time_now(void)
+{
+    return (rtc_time_hook) ? rtc_time_hook() : time(NULL);
+}
+
 /* get 1/100 seconds from clock */
 uint8_t rtc_get_centisecond(int bcd)
 {
@@ -202,7 +210,7 @@ int rtc_get_dst(time_t time_val)
 /* get the current clock based on time + offset so the value can be latched */
 time_t rtc_get_latch(time_t offset)
 {
-    return time(NULL) + offset;
+    return rtc_time_now() + offset;
 }
 
 /* ---------------------------------------------------------------------- */
@@ -211,7 +219,7 @@ time_t rtc_get_latch(time_t offset)
    0 - 59 */
 time_t rtc_set_second(int seconds, time_t offset, int bcd)
 {
-    time_t now = time(NULL) + offset;
+    time_t now = rtc_time_now() + offset;
     struct tm *local = localtime(&now);
     time_t offset_now;
     int real_seconds = (bcd) ? bcd_to_int(seconds) : seconds;
@@ -230,7 +238,7 @@ time_t rtc_set_second(int seconds, time_t offset, int bcd)
    0 - 59 */
 time_t rtc_set_minute(int minutes, time_t offset, int bcd)
 {
-    time_t now = time(NULL) + offset;
+    time_t now = rtc_time_now() + offset;
     struct tm *local = localtime(&now);
     time_t offset_now;
     int real_minutes = (bcd) ? bcd_to_int(minutes) : minutes;
@@ -249,7 +257,7 @@ time_t rtc_set_minute(int minutes, time_t offset, int bcd)
    0 - 23 */
 time_t rtc_set_hour(int hours, time_t offset, int bcd)
 {
-    time_t now = time(NULL) + offset;
+    time_t now = rtc_time_now() + offset;
     struct tm *local = localtime(&now);
     time_t offset_now;
     int real_hours = (bcd) ? bcd_to_int(hours) : hours;
@@ -268,7 +276,7 @@ time_t rtc_set_hour(int hours, time_t offset, int bcd)
    1 - 12 and AM/PM indicator */
 time_t rtc_set_hour_am_pm(int hours, time_t offset, int bcd)
 {
-    time_t now = time(NULL) + offset;
+    time_t now = rtc_time_now() + offset;
     struct tm *local = localtime(&now);
     time_t offset_now;
     int real_hours = (bcd) ? bcd_to_int(hours & 0x1f) : hours & 0x1f;
@@ -295,7 +303,7 @@ time_t rtc_set_hour_am_pm(int hours, time_t offset, int bcd)
    1 - 31 */
 time_t rtc_set_day_of_month(int day, time_t offset, int bcd)
 {
-    time_t now = time(NULL) + offset;
+    time_t now = rtc_time_now() + offset;
     struct tm *local = localtime(&now);
     time_t offset_now;
     int is_leap_year = 0;
@@ -345,7 +353,7 @@ time_t rtc_set_day_of_month(int day, time_t offset, int bcd)
    1 - 12 */
 time_t rtc_set_month(int month, time_t offset, int bcd)
 {
-    time_t now = time(NULL) + offset;
+    time_t now = rtc_time_now() + offset;
     struct tm *local = localtime(&now);
     time_t offset_now;
     int real_month = (bcd) ? bcd_to_int(month) : month;
@@ -364,7 +372,7 @@ time_t rtc_set_month(int month, time_t offset, int bcd)
    0 - 99 */
 time_t rtc_set_year(int year, time_t offset, int bcd)
 {
-    time_t now = time(NULL) + offset;
+    time_t now = rtc_time_now() + offset;
     struct tm *local = localtime(&now);
     time_t offset_now;
     int real_year = (bcd) ? bcd_to_int(year) : year;
@@ -384,7 +392,7 @@ time_t rtc_set_year(int year, time_t offset, int bcd)
    19 - 20 */
 time_t rtc_set_century(int century, time_t offset, int bcd)
 {
-    time_t now = time(NULL) + offset;
+    time_t now = rtc_time_now() + offset;
     struct tm *local = localtime(&now);
     time_t offset_now;
     int real_century = (bcd) ? bcd_to_int(century) : century;
@@ -404,7 +412,7 @@ time_t rtc_set_century(int century, time_t offset, int bcd)
    0 - 6 */
 time_t rtc_set_weekday(int day, time_t offset)
 {
-    time_t now = time(NULL) + offset;
+    time_t now = rtc_time_now() + offset;
     struct tm *local = localtime(&now);
 
     /* sanity check */
@@ -418,7 +426,7 @@ time_t rtc_set_weekday(int day, time_t offset)
    0 - 365 */
 time_t rtc_set_day_of_year(int day, time_t offset)
 {
-    time_t now = time(NULL) + offset;
+    time_t now = rtc_time_now() + offset;
     struct tm *local = localtime(&now);
     int is_leap_year = 0;
     int year = local->tm_year + 1900;
@@ -55,6 +55,8 @@
 /* max amount of RTC's in use at the same time */
 #define RTC_MAX 20
 
+extern time_t (*rtc_time_hook)(void);
+
 extern uint8_t rtc_get_centisecond(int bcd);
 
 extern uint8_t rtc_get_second(time_t time_val, int bcd);         /* 0 - 61 (leap seconds would be 60 and 61) */
@@ -0,0 +1,68 @@
+/*
+ * hostprof.c - Host time spent per emulator subsystem.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <sys/time.h>
+
+#include "hostprof.h"
+
+#ifdef HOSTPROF
+
+struct hostprof hostprof;
+
+static const char *const names[HP_SLOTS] = {
+	"main loop, other", "cpu_execute_z280", "exec_op", "z280_check_dma",
+	"check_interrupts", "clock_timers", "debugger hook", "do_timers",
+	"io_device_update", "ide_read_sector", "ide_write_sector", "socket calls"
+};
+
+static struct timeval t0;
+static unsigned long long ticks0;
+
+void hostprof_start(void)
+{
+	memset(&hostprof, 0, sizeof(hostprof));
+	gettimeofday(&t0, 0);
+	hostprof.last = ticks0 = hostprof_ticks();
+}
+
+void hostprof_report(FILE *f)
+{
+	struct timeval t1;
+	unsigned long long total;
+	double secs;
+	int i;
+
+	hostprof_switch(hostprof.cur);
+	gettimeofday(&t1, 0);
+	total = hostprof.last - ticks0;
+	secs = (t1.tv_sec - t0.tv_sec) + (t1.tv_usec - t0.tv_usec) / 1e6;
+	if (!total)
+		total = 1;
+
+	fprintf(f, "Host time by subsystem, %.3f s\n", secs);
+	fprintf(f, "       %%    seconds          calls  ns/call  subsystem\n");
+	for (i = 0; i < HP_SLOTS; i++) {
+		double s = secs * hostprof.ticks[i] / total;
+		fprintf(f, "%8.2f %10.3f %14llu ", 100.0 * hostprof.ticks[i] / total, s, hostprof.calls[i]);
+		if (hostprof.calls[i])
+			fprintf(f, "%8.1f", s * 1e9 / hostprof.calls[i]);
+		else
+			fprintf(f, "%8s", "-");
+		fprintf(f, "  %s\n", names[i]);
+	}
+}
+
+#endif
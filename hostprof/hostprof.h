@@ -0,0 +1,94 @@
+/*
+ * hostprof.h - Host time spent per emulator subsystem.
+ *
+ * Built with -DHOSTPROF (make HOSTPROF=1), the code between
+ * HOSTPROF_ENTER and HOSTPROF_LEAVE is charged to a slot by reading the
+ * time stamp counter. Time in a nested slot is not charged to the outer
+ * one, so the slots add up to the whole run. Otherwise the macros are
+ * empty.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+
+#ifndef Z280EMU_HOSTPROF_H
+#define Z280EMU_HOSTPROF_H
+
+#include <stdio.h>
+
+#define HP_OTHER	0	/* main loop, anything not timed below */
+#define HP_CORE		1	/* cpu_execute_z280 itself */
+#define HP_EXEC		2	/* exec_op */
+#define HP_DMA		3	/* z280_check_dma */
+#define HP_INTERRUPTS	4	/* check_interrupts */
+#define HP_TIMERS	5	/* clock_timers */
+#define HP_HOOK		6	/* debugger hook: trace, profile, flight recorder */
+#define HP_DEVTIMERS	7	/* do_timers */
+#define HP_IOUPDATE	8	/* io_device_update */
+#define HP_IDEREAD	9	/* ide_read_sector */
+#define HP_IDEWRITE	10	/* ide_write_sector */
+#define HP_SOCKET	11	/* socket and fd calls of the serial ports */
+#define HP_SLOTS	12
+
+#ifdef HOSTPROF
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#define hostprof_ticks() __rdtsc()
+#else
+#include <time.h>
+static __inline__ unsigned long long hostprof_ticks(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+#endif
+
+struct hostprof {
+	unsigned long long ticks[HP_SLOTS];
+	unsigned long long calls[HP_SLOTS];
+	unsigned long long last;
+	int cur;
+};
+extern struct hostprof hostprof;
+
+/* charge the time so far to the current slot and continue in another */
+static __inline__ int hostprof_switch(int slot)
+{
+	unsigned long long t = hostprof_ticks();
+	int prev = hostprof.cur;
+
+	hostprof.ticks[prev] += t - hostprof.last;
+	hostprof.last = t;
+	hostprof.cur = slot;
+	return prev;
+}
+
+/* the slot left is remembered in a local, so a longjmp out of a slot
+   is set right by the next LEAVE further out */
+#define HOSTPROF_ENTER(slot)	int hostprof_prev = (hostprof.calls[slot]++, hostprof_switch(slot))
+#define HOSTPROF_LEAVE()	hostprof_switch(hostprof_prev)
+#define HOSTPROF_SWITCH(slot)	hostprof_switch(slot)
+#define HOSTPROF_TIME(slot, stmt)	{ HOSTPROF_ENTER(slot); stmt; HOSTPROF_LEAVE(); }
+
+void hostprof_start(void);
+void hostprof_report(FILE *f);
+
+#else
+
+#define HOSTPROF_ENTER(slot)
+#define HOSTPROF_LEAVE()
+#define HOSTPROF_SWITCH(slot)
+#define HOSTPROF_TIME(slot, stmt)	{ stmt; }
+
+#endif
+
+#endif
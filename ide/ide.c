@@ -27,8 +27,19 @@
 #include <stdlib.h>
 #include <errno.h>
 #include <time.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <sys/stat.h>
+#ifndef _WIN32
+#include <sys/mman.h>
+#include <pthread.h>
+#endif
 
 #include "ide.h"
+#include "../hostprof/hostprof.h"
+#ifdef HAVE_ZLIB
+#include <zlib.h>
+#endif
 
 #define IDE_IDLE	0
 #define IDE_CMD		1
@@ -50,6 +61,8 @@
 #define	ERR_MC		32
 #define ERR_UNC		64
 
+#define MAX_MULTIPLE	128	/* sectors per READ/WRITE MULTIPLE block */
+
 #define ST_ERR		1
 #define ST_IDX		2
 #define ST_CORR		4
@@ -74,6 +87,11 @@
 #define IDE_CMD_INTPARAMS	0x91
 #define IDE_CMD_IDENTIFY	0xEC
 #define IDE_CMD_SETFEATURES	0xEF
+#define IDE_CMD_READ_MULTIPLE	0xC4
+#define IDE_CMD_WRITE_MULTIPLE	0xC5
+#define IDE_CMD_SET_MULTIPLE	0xC6
+#define IDE_CMD_FLUSH_CACHE	0xE7
+#define IDE_CMD_FLUSH_CACHE_EXT	0xEA
 
 //#define IDE_DEBUG
 
@@ -159,6 +177,16 @@ static off_t xlate_block(struct ide_taskfile *t)
   return 2 + ((((t->lba3 << 8) + t->lba2) * d->heads + (t->lba4 & DEVH_HEAD)) * d->sectors + t->lba1 - 1);
 }
 
+/* Check a block exists and position the image there */
+static int ide_seek(struct ide_drive *d, off_t block)
+{
+  if (block < 0)
+    return -1;
+  if (d->backend != IDE_BACKEND_FD)
+    return block < d->size ? 0 : -1;
+  return lseek(d->fd, 512 * block, SEEK_SET) == -1 ? -1 : 0;
+}
+
 /* Indicate the drive is ready */
 static void ready(struct ide_taskfile *tf)
 {
@@ -198,7 +226,7 @@ static void data_out_state(struct ide_taskfile *tf)
   d->dptr = d->data;
   tf->status &= ~ (ST_BSY|ST_DRDY);
   tf->status |= ST_DRQ;
-  d->intrq = 1;			/* Double check */
+  /* no INTRQ: the host writes the first block on DRQ alone */
 }
 
 static void edd_setup(struct ide_taskfile *tf)
@@ -226,6 +254,10 @@ void ide_reset(struct ide_controller *c)
     c->drive[1].taskfile.status = ST_DRDY;
     c->drive[1].eightbit = 0;
   }
+  /* reset turns multiple mode off */
+  c->drive[0].multiple = c->drive[1].multiple = 0;
+  c->drive[0].block = c->drive[0].drq = 1;
+  c->drive[1].block = c->drive[1].drq = 1;
   c->selected = 0;
 }
 
@@ -268,6 +300,8 @@ static void cmd_edd_complete(struct ide_taskfile *tf)
 static void cmd_identify_complete(struct ide_taskfile *tf)
 {
   struct ide_drive *d = tf->drive;
+  /* current READ/WRITE MULTIPLE block size */
+  d->identify[59] = le16(d->multiple ? 0x0100 | d->multiple : 0);
   memcpy(d->data, d->identify, 512);
   data_in_state(tf);
   /* Arrange to copy just the identify buffer */
@@ -304,7 +338,7 @@ static void cmd_readsectors_complete(struct ide_taskfile *tf)
 #ifdef IDE_DEBUG
   fprintf(stderr, "READ %d SECTORS @ %ld\n", d->length, d->offset);
 #endif
-  if (d->offset == -1 ||  lseek(d->fd, 512 * d->offset, SEEK_SET) == -1) {
+  if (ide_seek(d, d->offset) == -1) {
     tf->status |= ST_ERR;
     tf->error |= ERR_IDNF;
     ide_fault(d, "seek error on readsectors");
@@ -327,7 +361,7 @@ static void cmd_verifysectors_complete(struct ide_taskfile *tf)
   d->offset = xlate_block(tf);
   /* 0 = 256 sectors */
   d->length = tf->count ? tf->count : 256;
-  if (lseek(d->fd, 512 * (d->offset + d->length - 1), SEEK_SET) == -1) {
+  if (ide_seek(d, d->offset + d->length - 1) == -1) {
     tf->status |= ST_ERR;
     tf->error |= ERR_IDNF;
     ide_fault(d, "seek error on verifysectors");
@@ -353,7 +387,7 @@ static void cmd_seek_complete(struct ide_taskfile *tf)
   if (d->failed)
     drive_failed(tf);
   d->offset = xlate_block(tf);
-  if (d->offset == -1 || lseek(d->fd, 512 * d->offset, SEEK_SET) == -1) {
+  if (ide_seek(d, d->offset) == -1) {
     tf->status |= ST_ERR;
     tf->error |= ERR_IDNF;
     ide_fault(d, "seek error");
@@ -400,7 +434,7 @@ static void cmd_writesectors_complete(struct ide_taskfile *tf)
 #ifdef IDE_DEBUG
   fprintf(stderr, "WRITE %d SECTORS @ %ld\n", d->length, d->offset);
 #endif
-  if (d->offset == -1 ||  lseek(d->fd, 512 * d->offset, SEEK_SET) == -1) {
+  if (ide_seek(d, d->offset) == -1) {
     tf->status |= ST_ERR;
     tf->error |= ERR_IDNF;
     ide_fault(d, "seek error on writesectors");
@@ -412,6 +446,45 @@ static void cmd_writesectors_complete(struct ide_taskfile *tf)
   data_out_state(tf);
 }
 
+/* Sectors per DRQ block, and so per interrupt, for the next transfer */
+static int set_block(struct ide_taskfile *tf, int multi)
+{
+  struct ide_drive *d = tf->drive;
+  if (multi && d->multiple == 0) {
+    /* READ/WRITE MULTIPLE before SET MULTIPLE MODE */
+    tf->status |= ST_ERR;
+    tf->error |= ERR_ABRT;
+    completed(tf);
+    return -1;
+  }
+  d->block = multi ? d->multiple : 1;
+  d->drq = d->block;
+  return 0;
+}
+
+static void cmd_setmultiple_complete(struct ide_taskfile *tf)
+{
+  struct ide_drive *d = tf->drive;
+  /* 0 disables, otherwise a power of two up to what IDENTIFY reports */
+  if (tf->count > (le16(d->identify[47]) & 0xFF) || (tf->count & (tf->count - 1))) {
+    tf->status |= ST_ERR;
+    tf->error |= ERR_ABRT;
+  } else
+    d->multiple = tf->count;
+  completed(tf);
+}
+
+static void cmd_flushcache_complete(struct ide_taskfile *tf)
+{
+  struct ide_drive *d = tf->drive;
+  if (ide_flush(d) < 0) {
+    tf->status |= ST_ERR;
+    tf->error |= ERR_ABRT;
+    ide_fault(d, "flush cache failed");
+  }
+  completed(tf);
+}
+
 static void ide_set_error(struct ide_drive *d)
 {
   d->taskfile.lba4 &= ~DEVH_HEAD;
@@ -435,19 +508,1045 @@ static void ide_set_error(struct ide_drive *d)
   completed(&d->taskfile);
 }
 
+/* Write dirty parts of a mapped image back to the file */
+void ide_sync(struct ide_drive *d)
+{
+#ifndef _WIN32
+  if (d->backend == IDE_BACKEND_MMAP && d->dirty) {
+    if (msync(d->map, 512 * d->size, MS_ASYNC) == -1)
+      ide_fault(d, "msync failed");
+    d->dirty = 0;
+  }
+#endif
+  d->synced = time(NULL);
+}
+
+/* Called from the main loop: sync mapped images whose interval has run out */
+void ide_poll(struct ide_controller *c)
+{
+  struct ide_drive *d;
+  for (d = c->drive; d < c->drive + 2; d++)
+    if (d->dirty && d->sync_interval && time(NULL) - d->synced >= d->sync_interval)
+      ide_sync(d);
+}
+
+#ifndef _WIN32
+/*
+ *	Copy-on-write overlay images
+ *
+ *	Sector 0 holds the overlay header: magic, base image size in sectors,
+ *	first data sector, base image mtime and the path of the base image.
+ *	It is followed by a bitmap with one bit per base sector, set when the
+ *	overlay holds its own copy. Data sectors sit at data_start + block, so
+ *	the overlay file is sparse and only grows by what the guest writes.
+ *	The base image is opened read-only and mapped, so all instances using
+ *	it share one copy in the page cache.
+ */
+
+const uint8_t ide_overlay_magic[8] = {
+  '1','D','E','O','V','L','0','0'
+};
+
+/* compressed images, recognised even when built without zlib */
+const uint8_t ide_zimage_magic[8] = {
+  '1','D','E','Z','I','P','0','0'
+};
+
+struct ide_overlay_header {
+  uint32_t size;
+  uint32_t data_start;
+  int64_t mtime;
+  char base[512 - 24];
+};
+
+static uint32_t get32(const uint8_t *p)
+{
+  return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+static void put32(uint8_t *p, uint32_t v)
+{
+  p[0] = v; p[1] = v >> 8; p[2] = v >> 16; p[3] = v >> 24;
+}
+
+static int overlay_read_header(int fd, struct ide_overlay_header *h)
+{
+  uint8_t buf[512];
+  if (pread(fd, buf, 512, 0) != 512 || memcmp(buf, ide_overlay_magic, 8))
+    return -1;
+  h->size = get32(buf + 8);
+  h->data_start = get32(buf + 12);
+  h->mtime = get32(buf + 16) | ((int64_t)get32(buf + 20) << 32);
+  memcpy(h->base, buf + 24, sizeof(h->base));
+  h->base[sizeof(h->base) - 1] = 0;
+  return 0;
+}
+
+static int overlay_write_header(int fd, struct ide_overlay_header *h)
+{
+  uint8_t buf[512];
+  memset(buf, 0, 512);
+  memcpy(buf, ide_overlay_magic, 8);
+  put32(buf + 8, h->size);
+  put32(buf + 12, h->data_start);
+  put32(buf + 16, h->mtime);
+  put32(buf + 20, h->mtime >> 32);
+  strncpy((char *)buf + 24, h->base, sizeof(h->base) - 1);
+  return pwrite(fd, buf, 512, 0) == 512 ? 0 : -1;
+}
+
+/* Empty the overlay: clear the bitmap and release all data blocks */
+static int overlay_clear(int fd, struct ide_overlay_header *h)
+{
+  if (ftruncate(fd, 512) == -1 ||
+      ftruncate(fd, 512 * ((off_t)h->data_start + h->size)) == -1)
+    return -1;
+  return 0;
+}
+
+#ifdef HAVE_ZLIB
+/*
+ *	Compressed images
+ *
+ *	A raw image is split into chunks of chunk_size bytes that are deflated
+ *	independently. Sector 0 holds magic, chunk size, image size in sectors
+ *	and number of chunks, followed by a table of nchunks + 1 file offsets
+ *	(64 bit) where chunk i occupies [offset[i], offset[i+1]). Chunks are
+ *	inflated on demand into a small LRU cache. The image itself is never
+ *	written; it is used as the base of an overlay.
+ */
+
+#define ZIMAGE_CHUNK	65536
+#define ZIMAGE_CACHE	32	/* chunks kept inflated */
+
+struct ide_zimage {
+  int fd;
+  uint32_t chunk_size;
+  uint32_t size;		/* sectors */
+  uint32_t nchunks;
+  uint64_t *index;
+  uint8_t *zbuf;		/* one compressed chunk */
+  uint32_t zbuf_len;
+  int last;			/* cache slot of the last hit */
+  unsigned long clock;
+  struct {
+    int64_t chunk;
+    unsigned long used;
+    uint8_t *data;
+  } cache[ZIMAGE_CACHE];
+};
+
+static uint64_t get64(const uint8_t *p)
+{
+  return get32(p) | ((uint64_t)get32(p + 4) << 32);
+}
+
+static void put64(uint8_t *p, uint64_t v)
+{
+  put32(p, v);
+  put32(p + 4, v >> 32);
+}
+
+static void zimage_close(struct ide_zimage *z)
+{
+  int i;
+  for (i = 0; i < ZIMAGE_CACHE; i++)
+    free(z->cache[i].data);
+  free(z->index);
+  free(z->zbuf);
+  free(z);
+}
+
+static struct ide_zimage *zimage_open(int fd)
+{
+  struct ide_zimage *z;
+  uint8_t hdr[512], *raw = NULL;
+  uint32_t i;
+  size_t len;
+
+  if (pread(fd, hdr, 512, 0) != 512 || memcmp(hdr, ide_zimage_magic, 8))
+    return NULL;
+  if ((z = calloc(1, sizeof(*z))) == NULL)
+    return NULL;
+  z->fd = fd;
+  z->chunk_size = get32(hdr + 8);
+  z->size = get32(hdr + 12);
+  z->nchunks = get32(hdr + 16);
+  if (z->chunk_size == 0 || z->chunk_size % 512 ||
+      z->nchunks != ((uint64_t)z->size * 512 + z->chunk_size - 1) / z->chunk_size)
+    goto fail;
+  len = 8 * ((size_t)z->nchunks + 1);
+  if ((raw = malloc(len)) == NULL || (z->index = malloc(len)) == NULL ||
+      pread(fd, raw, len, 512) != len)
+    goto fail;
+  for (i = 0; i <= z->nchunks; i++) {
+    z->index[i] = get64(raw + 8 * i);
+    if (i && z->index[i] < z->index[i - 1])
+      goto fail;
+    if (i && z->index[i] - z->index[i - 1] > z->zbuf_len)
+      z->zbuf_len = z->index[i] - z->index[i - 1];
+  }
+  free(raw);
+  raw = NULL;
+  if ((z->zbuf = malloc(z->zbuf_len ? z->zbuf_len : 1)) == NULL)
+    goto fail;
+  for (i = 0; i < ZIMAGE_CACHE; i++) {
+    z->cache[i].chunk = -1;
+    if ((z->cache[i].data = malloc(z->chunk_size)) == NULL)
+      goto fail;
+  }
+  return z;
+fail:
+  free(raw);
+  zimage_close(z);
+  return NULL;
+}
+
+static int zimage_read(struct ide_zimage *z, off_t block, uint8_t *buf)
+{
+  int64_t chunk = (int64_t)block * 512 / z->chunk_size;
+  uLongf len = z->chunk_size;
+  uint32_t zlen;
+  int i, slot;
+
+  if (block >= z->size)
+    return 0;
+  slot = z->last;
+  if (z->cache[slot].chunk != chunk) {
+    slot = 0;
+    for (i = 0; i < ZIMAGE_CACHE; i++) {
+      if (z->cache[i].chunk == chunk) {
+        slot = i;
+        break;
+      }
+      if (z->cache[i].used < z->cache[slot].used)
+        slot = i;
+    }
+    if (z->cache[slot].chunk != chunk) {
+      /* evict the least recently used chunk */
+      zlen = z->index[chunk + 1] - z->index[chunk];
+      z->cache[slot].chunk = -1;
+      if (pread(z->fd, z->zbuf, zlen, z->index[chunk]) != zlen ||
+          uncompress(z->cache[slot].data, &len, z->zbuf, zlen) != Z_OK) {
+        errno = EIO;
+        return -1;
+      }
+      z->cache[slot].chunk = chunk;
+    }
+    z->last = slot;
+  }
+  z->cache[slot].used = ++z->clock;
+  memcpy(buf, z->cache[slot].data + (block * 512) % z->chunk_size, 512);
+  return 512;
+}
+
+/* Convert the raw image on in into a compressed image on out */
+int ide_compress_image(int in, int out)
+{
+  struct stat st;
+  uint8_t hdr[512], *chunk = NULL, *zchunk = NULL, *index = NULL;
+  uint32_t size, nchunks, i;
+  uLongf zlen;
+  off_t pos;
+  size_t len;
+  int r = -1;
+
+  if (fstat(in, &st) == -1)
+    return -1;
+  size = st.st_size / 512;
+  nchunks = ((uint64_t)size * 512 + ZIMAGE_CHUNK - 1) / ZIMAGE_CHUNK;
+  if ((chunk = malloc(ZIMAGE_CHUNK)) == NULL ||
+      (zchunk = malloc(compressBound(ZIMAGE_CHUNK))) == NULL ||
+      (index = calloc(nchunks + 1, 8)) == NULL)
+    goto out;
+  if (pread(in, chunk, 8, 0) != 8 || memcmp(chunk, ide_magic, 8)) {
+    errno = EINVAL;
+    goto out;
+  }
+  pos = 512 + 8 * ((off_t)nchunks + 1);
+  for (i = 0; i < nchunks; i++) {
+    len = (uint64_t)size * 512 - (uint64_t)i * ZIMAGE_CHUNK;
+    if (len > ZIMAGE_CHUNK)
+      len = ZIMAGE_CHUNK;
+    memset(chunk, 0, ZIMAGE_CHUNK);
+    if (pread(in, chunk, len, (off_t)i * ZIMAGE_CHUNK) != len)
+      goto out;
+    zlen = compressBound(ZIMAGE_CHUNK);
+    if (compress2(zchunk, &zlen, chunk, ZIMAGE_CHUNK, Z_BEST_COMPRESSION) != Z_OK) {
+      errno = ENOMEM;
+      goto out;
+    }
+    put64(index + 8 * i, pos);
+    if (pwrite(out, zchunk, zlen, pos) != zlen)
+      goto out;
+    pos += zlen;
+  }
+  put64(index + 8 * nchunks, pos);
+  memset(hdr, 0, 512);
+  memcpy(hdr, ide_zimage_magic, 8);
+  put32(hdr + 8, ZIMAGE_CHUNK);
+  put32(hdr + 12, size);
+  put32(hdr + 16, nchunks);
+  len = 8 * ((size_t)nchunks + 1);
+  if (pwrite(out, index, len, 512) != len || pwrite(out, hdr, 512, 0) != 512)
+    goto out;
+  r = 0;
+out:
+  free(chunk);
+  free(zchunk);
+  free(index);
+  return r;
+}
+#endif
+
+/* Size in sectors of a raw or compressed image that can serve as a base */
+static int64_t base_image_size(int fd)
+{
+  struct stat st;
+  uint8_t buf[16];
+
+  if (fstat(fd, &st) == -1 || pread(fd, buf, 16, 0) != 16)
+    return -1;
+  if (memcmp(buf, ide_magic, 8) == 0)
+    return st.st_size / 512;
+  if (memcmp(buf, ide_zimage_magic, 8) == 0) {
+#ifdef HAVE_ZLIB
+    return get32(buf + 12);
+#else
+    errno = EOPNOTSUPP;
+    return -1;
+#endif
+  }
+  errno = EINVAL;
+  return -1;
+}
+
+int ide_make_overlay(int fd, const char *base)
+{
+  struct ide_overlay_header h;
+  struct stat st;
+  char path[PATH_MAX];
+  int64_t size;
+  int bfd;
+
+  memset(&h, 0, sizeof(h));
+  if (realpath(base, path) == NULL)
+    return -1;
+  if (strlen(path) >= sizeof(h.base)) {
+    errno = ENAMETOOLONG;
+    return -1;
+  }
+  strcpy(h.base, path);
+  if ((bfd = open(h.base, O_RDONLY)) == -1)
+    return -1;
+  if (fstat(bfd, &st) == -1 || (size = base_image_size(bfd)) < 0) {
+    close(bfd);
+    return -1;
+  }
+  close(bfd);
+  h.size = size;
+  h.data_start = 1 + (h.size + 4095) / 4096;
+  h.mtime = st.st_mtime;
+  if (overlay_clear(fd, &h) == -1 || overlay_write_header(fd, &h) == -1)
+    return -1;
+  return 0;
+}
+
+/* Copy all blocks held by the overlay into the base image, then empty it */
+int ide_commit_overlay(int fd)
+{
+  struct ide_overlay_header h;
+  struct stat st;
+  uint8_t map[512], buf[512];
+  uint32_t i, j;
+  int bfd;
+
+  if (overlay_read_header(fd, &h) == -1) {
+    errno = EINVAL;
+    return -1;
+  }
+  if ((bfd = open(h.base, O_RDWR)) == -1)
+    return -1;
+  if (pread(bfd, buf, 8, 0) != 8 || memcmp(buf, ide_magic, 8)) {
+    close(bfd);
+    errno = EROFS;		/* compressed bases are read-only */
+    return -1;
+  }
+  if (fstat(bfd, &st) == -1 || st.st_mtime != h.mtime || st.st_size / 512 != h.size) {
+    close(bfd);
+    errno = ESTALE;
+    return -1;
+  }
+  for (i = 0; i < h.size; i += 4096) {
+    if (pread(fd, map, 512, 512 * (off_t)(1 + i / 4096)) != 512)
+      goto fail;
+    for (j = 0; j < 4096 && i + j < h.size; j++) {
+      if (!(map[j >> 3] & (1 << (j & 7))))
+        continue;
+      if (pread(fd, buf, 512, 512 * ((off_t)h.data_start + i + j)) != 512 ||
+          pwrite(bfd, buf, 512, 512 * (off_t)(i + j)) != 512)
+        goto fail;
+    }
+  }
+  if (fsync(bfd) == -1 || fstat(bfd, &st) == -1)
+    goto fail;
+  close(bfd);
+  h.mtime = st.st_mtime;	/* the overlay stays usable on the new base */
+  if (overlay_clear(fd, &h) == -1 || overlay_write_header(fd, &h) == -1)
+    return -1;
+  return 0;
+fail:
+  close(bfd);
+  return -1;
+}
+
+int ide_discard_overlay(int fd)
+{
+  struct ide_overlay_header h;
+
+  if (overlay_read_header(fd, &h) == -1) {
+    errno = EINVAL;
+    return -1;
+  }
+  if (overlay_clear(fd, &h) == -1 || overlay_write_header(fd, &h) == -1)
+    return -1;
+  return 0;
+}
+
+static int base_read_block(struct ide_drive *d, off_t block, uint8_t *buf)
+{
+#ifdef HAVE_ZLIB
+  if (d->zimage)
+    return zimage_read(d->zimage, block, buf);
+#endif
+  memcpy(buf, d->base_map + 512 * block, 512);
+  return 512;
+}
+
+/* Map or open the base image on d->base_fd, load the bitmap and header sectors */
+static int overlay_open_base(struct ide_drive *d, struct ide_overlay_header *h)
+{
+  size_t bitmap_len;
+  int64_t size;
+
+  if ((size = base_image_size(d->base_fd)) < 0 && errno == EOPNOTSUPP) {
+    ide_fault(d, "compressed base, built without zlib");
+    return -1;
+  }
+  if (size != h->size || h->size < 2) {
+    ide_fault(d, "overlay base has changed");
+    return -1;
+  }
+#ifdef HAVE_ZLIB
+  if ((d->zimage = zimage_open(d->base_fd)) == NULL) {
+#else
+  {
+#endif
+    d->base_map = mmap(NULL, 512 * (off_t)h->size, PROT_READ, MAP_SHARED, d->base_fd, 0);
+    if (d->base_map == MAP_FAILED) {
+      d->base_map = NULL;
+      ide_fault(d, "cannot map overlay base");
+      return -1;
+    }
+  }
+  bitmap_len = 512 * (h->data_start - 1);
+  if ((d->bitmap = malloc(bitmap_len)) == NULL ||
+      pread(d->fd, d->bitmap, bitmap_len, 512) != bitmap_len) {
+    ide_fault(d, "cannot read overlay bitmap");
+    goto fail;
+  }
+  d->size = h->size;
+  d->data_start = h->data_start;
+  if (base_read_block(d, 0, d->data) != 512 ||
+      base_read_block(d, 1, (uint8_t *)d->identify) != 512) {
+    ide_fault(d, "i/o error on overlay base");
+    goto fail;
+  }
+  d->backend = IDE_BACKEND_OVERLAY;
+  return 0;
+fail:
+  free(d->bitmap);
+  d->bitmap = NULL;
+  if (d->base_map)
+    munmap(d->base_map, 512 * (off_t)h->size);
+  d->base_map = NULL;
+#ifdef HAVE_ZLIB
+  if (d->zimage)
+    zimage_close(d->zimage);
+  d->zimage = NULL;
+#endif
+  return -1;
+}
+
+/* Set up an overlay drive and read the base image header sectors */
+static int ide_open_overlay(struct ide_drive *d)
+{
+  struct ide_overlay_header h;
+  struct stat st;
+
+  if (overlay_read_header(d->fd, &h) == -1) {
+    ide_fault(d, "bad overlay header");
+    return -1;
+  }
+  if ((d->base_fd = open(h.base, O_RDONLY)) == -1) {
+    ide_fault(d, "cannot open overlay base");
+    return -1;
+  }
+  if (fstat(d->base_fd, &st) == -1 || st.st_mtime != h.mtime) {
+    ide_fault(d, "overlay base has changed");
+    goto fail;
+  }
+  if (overlay_open_base(d, &h) == 0)
+    return 0;
+fail:
+  close(d->base_fd);
+  d->base_fd = -1;
+  return -1;
+}
+
+/* Create an empty overlay of size sectors that is deleted at once */
+static int overlay_temp(struct ide_drive *d, struct ide_overlay_header *h, uint32_t size)
+{
+  char path[PATH_MAX];
+  const char *tmp = getenv("TMPDIR");
+  int fd;
+
+  snprintf(path, sizeof(path), "%s/ideXXXXXX", tmp ? tmp : "/tmp");
+  if ((fd = mkstemp(path)) == -1) {
+    ide_fault(d, "cannot create temporary overlay");
+    return -1;
+  }
+  unlink(path);
+  memset(h, 0, sizeof(*h));
+  h->size = size;
+  h->data_start = 1 + (h->size + 4095) / 4096;
+  if (overlay_clear(fd, h) == -1 || overlay_write_header(fd, h) == -1) {
+    ide_fault(d, "cannot create temporary overlay");
+    close(fd);
+    return -1;
+  }
+  return fd;
+}
+
+#ifdef HAVE_ZLIB
+/*
+ *	A compressed image attached directly gets a temporary overlay, so the
+ *	guest can write but changes are lost at exit.
+ */
+static int ide_open_zimage(struct ide_drive *d)
+{
+  struct ide_overlay_header h;
+  int64_t size;
+  int fd;
+
+  if ((size = base_image_size(d->fd)) < 2) {
+    ide_fault(d, "bad compressed image");
+    return -1;
+  }
+  if ((fd = overlay_temp(d, &h, size)) == -1)
+    return -1;
+  d->base_fd = d->fd;
+  d->fd = fd;
+  if (overlay_open_base(d, &h) == 0) {
+    ide_fault(d, "compressed image, changes are discarded at exit");
+    return 0;
+  }
+  d->fd = d->base_fd;
+  d->base_fd = -1;
+  close(fd);
+  return -1;
+}
+#endif
+
+static void ide_close_overlay(struct ide_drive *d)
+{
+  if (d->base_map)
+    munmap(d->base_map, 512 * d->size);
+#ifdef HAVE_ZLIB
+  if (d->zimage)
+    zimage_close(d->zimage);
+  d->zimage = NULL;
+#endif
+  close(d->base_fd);
+  free(d->bitmap);
+  d->base_map = NULL;
+  d->base_fd = -1;
+  d->bitmap = NULL;
+}
+
+static int overlay_read_block(struct ide_drive *d, off_t block, uint8_t *buf)
+{
+  if (block >= d->size)
+    return 0;
+  if (d->bitmap[block >> 3] & (1 << (block & 7)))
+    return pread(d->fd, buf, 512, 512 * (d->data_start + block));
+  return base_read_block(d, block, buf);
+}
+
+static int overlay_write_block(struct ide_drive *d, off_t block, uint8_t *buf)
+{
+  int len;
+  if (block >= d->size)
+    return 0;
+  if ((len = pwrite(d->fd, buf, 512, 512 * (d->data_start + block))) != 512)
+    return len;
+  if (!(d->bitmap[block >> 3] & (1 << (block & 7)))) {
+    /* data first, then the bit: a crash never exposes an unwritten block */
+    d->bitmap[block >> 3] |= 1 << (block & 7);
+    if (pwrite(d->fd, &d->bitmap[block >> 3], 1, 512 + (block >> 3)) != 1)
+      return -1;
+  }
+  return 512;
+}
+
+/* Copy an overlay, header, bitmap and the blocks it holds, into a temporary one */
+static int overlay_clone(struct ide_drive *d)
+{
+  struct ide_overlay_header h;
+  uint8_t buf[512];
+  off_t i;
+  int fd;
+
+  if ((fd = overlay_temp(d, &h, d->size)) == -1)
+    return -1;
+  if (pread(d->fd, buf, 512, 0) != 512 || pwrite(fd, buf, 512, 0) != 512 ||
+      pwrite(fd, d->bitmap, 512 * (d->data_start - 1), 512) != 512 * (d->data_start - 1))
+    goto fail;
+  for (i = 0; i < d->size; i++) {
+    if (!(d->bitmap[i >> 3] & (1 << (i & 7))))
+      continue;
+    if (pread(d->fd, buf, 512, 512 * (d->data_start + i)) != 512 ||
+        pwrite(fd, buf, 512, 512 * (d->data_start + i)) != 512)
+      goto fail;
+  }
+  close(d->fd);
+  d->fd = fd;
+  return 0;
+fail:
+  ide_fault(d, "cannot copy overlay");
+  close(fd);
+  return -1;
+}
+
+/*
+ *	After fork(), give this process a private copy-on-write view of the
+ *	drive: a raw image becomes the shared read-only base of a temporary
+ *	overlay, an overlay is copied. The write-back cache must be off.
+ */
+int ide_fork(struct ide_drive *d)
+{
+  struct ide_overlay_header h;
+  uint8_t data[512], identify[512];
+  int fd;
+
+  if (!d->present)
+    return 0;
+  if (d->cache) {
+    ide_fault(d, "cannot fork with write-back cache");
+    return -1;
+  }
+  if (d->backend == IDE_BACKEND_OVERLAY)
+    return overlay_clone(d);
+  if ((fd = overlay_temp(d, &h, d->size)) == -1)
+    return -1;
+  if (d->backend == IDE_BACKEND_MMAP) {
+    munmap(d->map, 512 * d->size);
+    d->map = NULL;
+  }
+  /* opening the base reloads the header sectors, keep the live ones */
+  memcpy(data, d->data, 512);
+  memcpy(identify, d->identify, 512);
+  d->base_fd = d->fd;
+  d->fd = fd;
+  if (overlay_open_base(d, &h) == -1) {
+    close(fd);
+    d->failed = 1;
+    return -1;
+  }
+  memcpy(d->data, data, 512);
+  memcpy(d->identify, identify, 512);
+  return 0;
+}
+
+/*
+ *	Write-back sector cache
+ *
+ *	Written sectors are collected in the dirty set and the guest carries
+ *	on at once. A flusher thread swaps in the other, empty set, sorts the
+ *	sectors and writes each run of adjacent ones with a single call. Reads
+ *	look in the dirty set first, then in the set being flushed.
+ */
+
+#define CACHE_SECTORS	2048
+#define CACHE_HASH	1024
+
+struct ide_cache_set {
+  int count;
+  off_t block[CACHE_SECTORS];
+  int next[CACHE_SECTORS];
+  int head[CACHE_HASH];
+  uint8_t data[CACHE_SECTORS][512];
+};
+
+struct ide_cache_run {
+  off_t block;
+  int slot;
+};
+
+struct ide_cache {
+  struct ide_drive *drive;
+  int policy;
+  int interval;			/* ms between flushes, IDE_CACHE_PERIODIC */
+  pthread_t thread;
+  pthread_mutex_t lock;
+  pthread_cond_t wake;		/* work for the flusher */
+  pthread_cond_t done;		/* the flusher finished a set */
+  struct ide_cache_set *dirty;
+  struct ide_cache_set *flushing;
+  int flush_requested;
+  int quit;
+  int error;			/* errno of a failed write, reported on the next one */
+  struct ide_cache_run order[CACHE_SECTORS];
+  uint8_t run[CACHE_SECTORS * 512];
+};
+
+static void cache_clear(struct ide_cache_set *s)
+{
+  s->count = 0;
+  memset(s->head, 0xFF, sizeof(s->head));
+}
+
+static int cache_find(struct ide_cache_set *s, off_t block)
+{
+  int i;
+  for (i = s->head[block % CACHE_HASH]; i >= 0; i = s->next[i])
+    if (s->block[i] == block)
+      return i;
+  return -1;
+}
+
+static int cache_cmp(const void *a, const void *b)
+{
+  off_t x = ((const struct ide_cache_run *)a)->block;
+  off_t y = ((const struct ide_cache_run *)b)->block;
+  return x < y ? -1 : x > y;
+}
+
+/*
+ *	Write n adjacent sectors straight to the image. The CPU thread tests
+ *	overlay bits under c->lock, so they are set and copied out under it.
+ */
+static int ide_store_run(struct ide_cache *c, off_t block, int n, uint8_t *buf)
+{
+  struct ide_drive *d = c->drive;
+  uint8_t bits[CACHE_SECTORS / 8 + 1];
+  off_t i;
+  if (d->backend == IDE_BACKEND_OVERLAY) {
+    if (pwrite(d->fd, buf, 512 * n, 512 * (d->data_start + block)) != 512 * n)
+      return -1;
+    pthread_mutex_lock(&c->lock);
+    for (i = block; i < block + n; i++)
+      d->bitmap[i >> 3] |= 1 << (i & 7);
+    i = (block + n - 1) / 8 - block / 8 + 1;
+    memcpy(bits, &d->bitmap[block >> 3], i);
+    pthread_mutex_unlock(&c->lock);
+    if (pwrite(d->fd, bits, i, 512 + (block >> 3)) != i)
+      return -1;
+    return 0;
+  }
+  return pwrite(d->fd, buf, 512 * n, 512 * block) == 512 * n ? 0 : -1;
+}
+
+static void cache_write_set(struct ide_cache *c, struct ide_cache_set *s)
+{
+  int i, n;
+  for (i = 0; i < s->count; i++) {
+    c->order[i].block = s->block[i];
+    c->order[i].slot = i;
+  }
+  qsort(c->order, s->count, sizeof(c->order[0]), cache_cmp);
+  for (i = 0; i < s->count; i += n) {
+    for (n = 0; i + n < s->count && c->order[i + n].block == c->order[i].block + n; n++)
+      memcpy(c->run + 512 * n, s->data[c->order[i + n].slot], 512);
+    if (ide_store_run(c, c->order[i].block, n, c->run) < 0) {
+      c->error = errno ? errno : EIO;
+      ide_fault(c->drive, "write-back failed");
+    }
+  }
+}
+
+static void *cache_flusher(void *arg)
+{
+  struct ide_cache *c = arg;
+  struct ide_cache_set *s;
+  struct timespec ts;
+
+  pthread_mutex_lock(&c->lock);
+  for (;;) {
+    if (!c->flush_requested && !c->quit) {
+      if (c->policy == IDE_CACHE_PERIODIC) {
+        clock_gettime(CLOCK_REALTIME, &ts);
+        ts.tv_sec += c->interval / 1000;
+        ts.tv_nsec += (c->interval % 1000) * 1000000L;
+        if (ts.tv_nsec >= 1000000000L) {
+          ts.tv_sec++;
+          ts.tv_nsec -= 1000000000L;
+        }
+        pthread_cond_timedwait(&c->wake, &c->lock, &ts);
+      } else
+        pthread_cond_wait(&c->wake, &c->lock);
+    }
+    c->flush_requested = 0;
+    if (c->dirty->count) {
+      s = c->dirty;
+      c->dirty = c->flushing;
+      c->flushing = s;
+      pthread_mutex_unlock(&c->lock);
+      cache_write_set(c, s);
+      pthread_mutex_lock(&c->lock);
+      cache_clear(s);
+    } else if (c->quit)
+      break;
+    pthread_cond_broadcast(&c->done);
+  }
+  pthread_cond_broadcast(&c->done);
+  pthread_mutex_unlock(&c->lock);
+  return NULL;
+}
+
+static int cache_read_block(struct ide_drive *d, off_t block, uint8_t *buf)
+{
+  struct ide_cache *c = d->cache;
+  int i, present = 0;
+
+  if (block >= d->size)
+    return 0;
+  pthread_mutex_lock(&c->lock);
+  if ((i = cache_find(c->dirty, block)) >= 0)
+    memcpy(buf, c->dirty->data[i], 512);
+  else if ((i = cache_find(c->flushing, block)) >= 0)
+    memcpy(buf, c->flushing->data[i], 512);
+  else if (d->backend == IDE_BACKEND_OVERLAY)
+    present = d->bitmap[block >> 3] & (1 << (block & 7));
+  pthread_mutex_unlock(&c->lock);
+  if (i >= 0)
+    return 512;
+  /* not cached, so the flusher is done with it and the bit is final */
+  if (d->backend != IDE_BACKEND_OVERLAY)
+    return pread(d->fd, buf, 512, 512 * block);
+  if (present)
+    return pread(d->fd, buf, 512, 512 * (d->data_start + block));
+  return base_read_block(d, block, buf);
+}
+
+static int cache_write_block(struct ide_drive *d, off_t block, uint8_t *buf)
+{
+  struct ide_cache *c = d->cache;
+  struct ide_cache_set *s;
+  int i;
+
+  if (block >= d->size)
+    return 0;
+  pthread_mutex_lock(&c->lock);
+  if (c->error) {
+    errno = c->error;
+    c->error = 0;
+    pthread_mutex_unlock(&c->lock);
+    return -1;
+  }
+  while ((i = cache_find(c->dirty, block)) < 0 && c->dirty->count == CACHE_SECTORS) {
+    /* full: wait until the flusher has taken the set */
+    c->flush_requested = 1;
+    pthread_cond_signal(&c->wake);
+    pthread_cond_wait(&c->done, &c->lock);
+  }
+  s = c->dirty;
+  if (i < 0) {
+    i = s->count++;
+    s->block[i] = block;
+    s->next[i] = s->head[block % CACHE_HASH];
+    s->head[block % CACHE_HASH] = i;
+  }
+  memcpy(s->data[i], buf, 512);
+  if (s->count == CACHE_SECTORS / 2) {
+    /* start writing before the guest has to wait for it */
+    c->flush_requested = 1;
+    pthread_cond_signal(&c->wake);
+  }
+  pthread_mutex_unlock(&c->lock);
+  return 512;
+}
+
+/* Wait until everything written so far has reached the image */
+static int cache_drain(struct ide_cache *c)
+{
+  int err;
+  pthread_mutex_lock(&c->lock);
+  while (c->dirty->count || c->flushing->count) {
+    c->flush_requested = 1;
+    pthread_cond_signal(&c->wake);
+    pthread_cond_wait(&c->done, &c->lock);
+  }
+  err = c->error;
+  c->error = 0;
+  pthread_mutex_unlock(&c->lock);
+  if (err) {
+    errno = err;
+    return -1;
+  }
+  return 0;
+}
+
+static void ide_free_cache(struct ide_drive *d)
+{
+  struct ide_cache *c = d->cache;
+  if (c == NULL)
+    return;
+  cache_drain(c);
+  pthread_mutex_lock(&c->lock);
+  c->quit = 1;
+  pthread_cond_signal(&c->wake);
+  pthread_mutex_unlock(&c->lock);
+  pthread_join(c->thread, NULL);
+  pthread_mutex_destroy(&c->lock);
+  pthread_cond_destroy(&c->wake);
+  pthread_cond_destroy(&c->done);
+  free(c->dirty);
+  free(c->flushing);
+  free(c);
+  d->cache = NULL;
+}
+#endif
+
+/*
+ *	Select how writes reach the image: IDE_CACHE_WRITETHROUGH writes each
+ *	sector as it arrives, IDE_CACHE_FLUSH collects them and writes them
+ *	back when the cache fills up, on FLUSH CACHE and at detach, and
+ *	IDE_CACHE_PERIODIC also every interval ms. Mapped images already
+ *	write back through the page cache and keep their own interval.
+ */
+int ide_set_cache(struct ide_drive *d, int policy, int interval)
+{
+#ifndef _WIN32
+  struct ide_cache *c;
+
+  ide_free_cache(d);
+  if (policy == IDE_CACHE_WRITETHROUGH)
+    return 0;
+  if (!d->present || d->backend == IDE_BACKEND_MMAP) {
+    ide_fault(d, "write-back cache not available");
+    return -1;
+  }
+  if ((c = calloc(1, sizeof(*c))) == NULL ||
+      (c->dirty = malloc(sizeof(*c->dirty))) == NULL ||
+      (c->flushing = malloc(sizeof(*c->flushing))) == NULL) {
+    if (c) {
+      free(c->dirty);
+      free(c);
+    }
+    return -1;
+  }
+  cache_clear(c->dirty);
+  cache_clear(c->flushing);
+  c->drive = d;
+  c->policy = policy;
+  c->interval = interval > 0 ? interval : 1000;
+  pthread_mutex_init(&c->lock, NULL);
+  pthread_cond_init(&c->wake, NULL);
+  pthread_cond_init(&c->done, NULL);
+  if (pthread_create(&c->thread, NULL, cache_flusher, c)) {
+    ide_fault(d, "cannot start flusher");
+    free(c->dirty);
+    free(c->flushing);
+    free(c);
+    return -1;
+  }
+  d->cache = c;
+  return 0;
+#else
+  if (policy == IDE_CACHE_WRITETHROUGH)
+    return 0;
+  ide_fault(d, "write-back cache not available");
+  return -1;
+#endif
+}
+
+/* Make everything the guest has written durable (ATA FLUSH CACHE) */
+int ide_flush(struct ide_drive *d)
+{
+#ifndef _WIN32
+  if (d->cache && cache_drain(d->cache) < 0)
+    return -1;
+  if (d->backend == IDE_BACKEND_MMAP) {
+    d->dirty = 0;
+    d->synced = time(NULL);
+    return msync(d->map, 512 * d->size, MS_SYNC);
+  }
+  return fsync(d->fd);
+#else
+  return 0;
+#endif
+}
+
+/* Transfer the sector at d->offset, return like read()/write() */
+static int ide_read_block(struct ide_drive *d, uint8_t *buf)
+{
+#ifndef _WIN32
+  if (d->cache)
+    return cache_read_block(d, d->offset, buf);
+#endif
+  switch(d->backend) {
+    case IDE_BACKEND_MMAP:
+      if (d->offset >= d->size)
+        return 0;
+      memcpy(buf, d->map + 512 * d->offset, 512);
+      return 512;
+#ifndef _WIN32
+    case IDE_BACKEND_OVERLAY:
+      return overlay_read_block(d, d->offset, buf);
+#endif
+    default:
+      return read(d->fd, buf, 512);
+  }
+}
+
+static int ide_write_block(struct ide_drive *d, uint8_t *buf)
+{
+#ifndef _WIN32
+  if (d->cache)
+    return cache_write_block(d, d->offset, buf);
+#endif
+  switch(d->backend) {
+    case IDE_BACKEND_MMAP:
+      if (d->offset >= d->size)
+        return 0;
+      memcpy(d->map + 512 * d->offset, buf, 512);
+      d->dirty = 1;		/* ide_poll() syncs it */
+      return 512;
+#ifndef _WIN32
+    case IDE_BACKEND_OVERLAY:
+      return overlay_write_block(d, d->offset, buf);
+#endif
+    default:
+      return write(d->fd, buf, 512);
+  }
+}
+
 static int ide_read_sector(struct ide_drive *d)
 {
   int len;
 
   d->dptr = d->data;
-  if ((len = read(d->fd, d->data, 512)) != 512) {
+  HOSTPROF_TIME(HP_IDEREAD, len = ide_read_block(d, d->data));
+  if (len != 512) {
     perror("ide_read_sector");
     d->taskfile.status |= ST_ERR;
     ide_xlate_errno(&d->taskfile, len);
     return -1;
   }
 //  hexdump(d->data);
-  d->offset += 512;
+  d->offset++;
+  d->sectors_read++;
   return 0;
 }
 
@@ -456,13 +1555,17 @@ static int ide_write_sector(struct ide_drive *d)
   int len;
 
   d->dptr = d->data;
-  if ((len = write(d->fd, d->data, 512)) != 512) {
+  HOSTPROF_TIME(HP_IDEWRITE, len = ide_write_block(d, d->data));
+  if (len != 512) {
     d->taskfile.status |= ST_ERR;
     ide_xlate_errno(&d->taskfile, len);
     return -1;
   }
 //  hexdump(d->data);
-  d->offset += 512;
+  if (d->written && d->offset < d->size)
+    d->written[d->offset >> 3] |= 1 << (d->offset & 7);
+  d->offset++;
+  d->sectors_written++;
   return 0;
 }
 
@@ -485,11 +1588,13 @@ static uint16_t ide_data_in(struct ide_drive *d, int len)
       d->dptr++;
     d->taskfile.data = v;
     if (d->dptr == d->data + 512) {
-      d->length--;
-      d->intrq = 1;		/* we don't yet emulate multimode */
-      if (d->length == 0) {
-        d->state = IDE_IDLE;
-        completed(&d->taskfile);
+      /* INTRQ announces each DRQ block as it becomes ready, so none
+         follows the last one */
+      if (--d->length == 0)
+        ready(&d->taskfile);
+      else if (--d->drq == 0) {
+        d->intrq = 1;		/* next DRQ block ready */
+        d->drq = d->block;
       }
     }
   } else
@@ -519,11 +1624,11 @@ static void ide_data_out(struct ide_drive *d, uint16_t v, int len)
         ide_set_error(d);
         return;	
       }
-      d->length--;
-      d->intrq = 1;
-      if (d->length == 0) {
-        d->state = IDE_IDLE;
-        completed(&d->taskfile);
+      if (--d->length == 0)
+        completed(&d->taskfile);	/* the last block's INTRQ */
+      else if (--d->drq == 0) {
+        d->intrq = 1;		/* end of a DRQ block */
+        d->drq = d->block;
       }
     }
   }
@@ -542,6 +1647,7 @@ static void ide_issue_command(struct ide_taskfile *t)
       cmd_edd_complete(t);
       break;
     case IDE_CMD_IDENTIFY:	/* 0xEC */
+      set_block(t, 0);
       cmd_identify_complete(t);
       break;
     case IDE_CMD_INTPARAMS:	/* 0x91 */
@@ -549,7 +1655,15 @@ static void ide_issue_command(struct ide_taskfile *t)
       break;
     case IDE_CMD_READ:		/* 0x20 */
     case IDE_CMD_READ_NR:	/* 0x21 */
-      cmd_readsectors_complete(t);
+      if (set_block(t, 0) == 0)
+        cmd_readsectors_complete(t);
+      break;
+    case IDE_CMD_READ_MULTIPLE:	/* 0xC4 */
+      if (set_block(t, 1) == 0)
+        cmd_readsectors_complete(t);
+      break;
+    case IDE_CMD_SET_MULTIPLE:	/* 0xC6 */
+      cmd_setmultiple_complete(t);
       break;
     case IDE_CMD_SETFEATURES:	/* 0xEF */
       cmd_setfeatures_complete(t);
@@ -560,7 +1674,16 @@ static void ide_issue_command(struct ide_taskfile *t)
       break;
     case IDE_CMD_WRITE:		/* 0x30 */
     case IDE_CMD_WRITE_NR:	/* 0x31 */
-      cmd_writesectors_complete(t);
+      if (set_block(t, 0) == 0)
+        cmd_writesectors_complete(t);
+      break;
+    case IDE_CMD_WRITE_MULTIPLE:	/* 0xC5 */
+      if (set_block(t, 1) == 0)
+        cmd_writesectors_complete(t);
+      break;
+    case IDE_CMD_FLUSH_CACHE:	/* 0xE7 */
+    case IDE_CMD_FLUSH_CACHE_EXT: /* 0xEA */
+      cmd_flushcache_complete(t);
       break;
     default:
       if ((t->command & 0xF0) == IDE_CMD_CALIB)	/* 1x */
@@ -721,13 +1844,34 @@ struct ide_controller *ide_allocate(const char *name)
 int ide_attach(struct ide_controller *c, int drive, int fd)
 {
   struct ide_drive *d = &c->drive[drive];
+  struct stat st;
   if (d->present) {
     ide_fault(d, "double attach");
     return -1;
   }
   d->fd = fd;
-  if (read(d->fd, d->data, 512) != 512 ||
-      read(d->fd, d->identify, 512) != 512) {
+  d->backend = IDE_BACKEND_FD;
+  d->size = fstat(fd, &st) == 0 ? st.st_size / 512 : 0;
+  if (read(d->fd, d->data, 512) != 512) {
+    ide_fault(d, "i/o error on attach");
+    return -1;
+  }
+#ifndef _WIN32
+  if (memcmp(d->data, ide_overlay_magic, 8) == 0) {
+    if (ide_open_overlay(d) < 0)
+      return -1;
+  } else
+  if (memcmp(d->data, ide_zimage_magic, 8) == 0) {
+#ifdef HAVE_ZLIB
+    if (ide_open_zimage(d) < 0)
+      return -1;
+#else
+    ide_fault(d, "compressed image, built without zlib");
+    return -1;
+#endif
+  } else
+#endif
+  if (read(d->fd, d->identify, 512) != 512) {
     ide_fault(d, "i/o error on attach");
     return -1;
   }
@@ -744,6 +1888,45 @@ int ide_attach(struct ide_controller *c, int drive, int fd)
     d->lba = 1;
   else
     d->lba = 0;
+  /* images made before multiple mode was supported report 0 */
+  if ((le16(d->identify[47]) & 0xFF) == 0)
+    d->identify[47] = le16(0x8000 | MAX_MULTIPLE);
+  d->multiple = 0;
+  return 0;
+}
+
+/*
+ *	Attach a file and serve sectors from a shared mapping of it. Falls
+ *	back to plain file i/o if the image cannot be mapped.
+ */
+int ide_attach_mmap(struct ide_controller *c, int drive, int fd, int sync_interval)
+{
+  struct ide_drive *d = &c->drive[drive];
+  struct stat st;
+  
+  if (ide_attach(c, drive, fd) < 0)
+    return -1;
+  if (d->backend != IDE_BACKEND_FD)
+    return 0;			/* overlays map their base already */
+#ifndef _WIN32
+  if (fstat(fd, &st) == -1 || st.st_size < 1024) {
+    ide_fault(d, "cannot size image for mmap");
+    return 0;
+  }
+  d->map = mmap(NULL, st.st_size & ~511, PROT_READ|PROT_WRITE, MAP_SHARED, fd, 0);
+  if (d->map == MAP_FAILED) {
+    d->map = NULL;
+    ide_fault(d, "mmap failed");
+    return 0;
+  }
+  d->size = st.st_size / 512;
+  d->backend = IDE_BACKEND_MMAP;
+  d->dirty = 0;
+  d->sync_interval = sync_interval;
+  d->synced = time(NULL);
+#else
+  ide_fault(d, "mmap not supported");
+#endif
   return 0;
 }
 
@@ -752,8 +1935,22 @@ int ide_attach(struct ide_controller *c, int drive, int fd)
  */
 void ide_detach(struct ide_drive *d)
 {
+#ifndef _WIN32
+  ide_free_cache(d);
+  if (d->backend == IDE_BACKEND_MMAP) {
+    if (msync(d->map, 512 * d->size, MS_SYNC) == -1)
+      ide_fault(d, "msync failed");
+    munmap(d->map, 512 * d->size);
+    d->map = NULL;
+  }
+  if (d->backend == IDE_BACKEND_OVERLAY)
+    ide_close_overlay(d);
+  d->backend = IDE_BACKEND_FD;
+#endif
   close(d->fd);
+  free(d->written);
   d->fd = -1;
+  d->written = NULL;
   d->present = 0;
 }
 
@@ -800,6 +1997,321 @@ void ide_write_latched(struct ide_controller *c, uint8_t reg, uint8_t v)
   ide_write16(c, reg, d);  
 }
 
+/*
+ *	Snapshot support. Only the controller and drive state is saved, the
+ *	disk contents stay in the image files, which are brought up to date
+ *	first. A snapshot must be restored with the same images attached.
+ */
+#define SNAP_MAJOR 0
+#define SNAP_MINOR 0
+
+static int ide_write_drive_snapshot(struct ide_drive *d, snapshot_module_t *m)
+{
+  struct ide_taskfile *t = &d->taskfile;
+  uint16_t dptr = d->dptr ? d->dptr - d->data : 0;
+
+  if (d->present && ide_flush(d) < 0) {
+    ide_fault(d, "flush failed");
+    return -1;
+  }
+  if (0
+      || SMW_B(m, d->present) < 0
+      || SMW_W(m, t->data) < 0
+      || SMW_B(m, t->error) < 0
+      || SMW_B(m, t->feature) < 0
+      || SMW_B(m, t->count) < 0
+      || SMW_B(m, t->lba1) < 0
+      || SMW_B(m, t->lba2) < 0
+      || SMW_B(m, t->lba3) < 0
+      || SMW_B(m, t->lba4) < 0
+      || SMW_B(m, t->status) < 0
+      || SMW_B(m, t->command) < 0
+      || SMW_B(m, t->devctrl) < 0
+      || SMW_B(m, d->intrq) < 0
+      || SMW_B(m, d->failed) < 0
+      || SMW_B(m, d->lba) < 0
+      || SMW_B(m, d->eightbit) < 0
+      || SMW_BA(m, d->data, 512) < 0
+      || SMW_BA(m, (uint8_t *)d->identify, 512) < 0
+      || SMW_W(m, dptr) < 0
+      || SMW_DW(m, d->state) < 0
+      || SMW_QW(m, d->offset) < 0
+      || SMW_DW(m, d->length) < 0
+      || SMW_B(m, d->multiple) < 0
+      || SMW_DW(m, d->block) < 0
+      || SMW_DW(m, d->drq) < 0)
+    return -1;
+  return 0;
+}
+
+static int ide_read_drive_snapshot(struct ide_drive *d, snapshot_module_t *m)
+{
+  struct ide_taskfile *t = &d->taskfile;
+  uint8_t present, intrq, failed, lba, eightbit;
+  uint16_t dptr;
+  uint64_t offset;
+
+  if (0
+      || SMR_B(m, &present) < 0
+      || SMR_W(m, &t->data) < 0
+      || SMR_B(m, &t->error) < 0
+      || SMR_B(m, &t->feature) < 0
+      || SMR_B(m, &t->count) < 0
+      || SMR_B(m, &t->lba1) < 0
+      || SMR_B(m, &t->lba2) < 0
+      || SMR_B(m, &t->lba3) < 0
+      || SMR_B(m, &t->lba4) < 0
+      || SMR_B(m, &t->status) < 0
+      || SMR_B(m, &t->command) < 0
+      || SMR_B(m, &t->devctrl) < 0
+      || SMR_B(m, &intrq) < 0
+      || SMR_B(m, &failed) < 0
+      || SMR_B(m, &lba) < 0
+      || SMR_B(m, &eightbit) < 0
+      || SMR_BA(m, d->data, 512) < 0
+      || SMR_BA(m, (uint8_t *)d->identify, 512) < 0
+      || SMR_W(m, &dptr) < 0
+      || SMR_DW_INT(m, &d->state) < 0
+      || SMR_QW(m, &offset) < 0
+      || SMR_DW_INT(m, &d->length) < 0
+      || SMR_B(m, &d->multiple) < 0
+      || SMR_DW_INT(m, &d->block) < 0
+      || SMR_DW_INT(m, &d->drq) < 0)
+    return -1;
+  if (present != d->present || dptr > 512) {
+    snapshot_set_error(SNAPSHOT_MODULE_INCOMPATIBLE);
+    return -1;
+  }
+  d->intrq = intrq;
+  d->failed = failed;
+  d->lba = lba;
+  d->eightbit = eightbit;
+  d->dptr = d->data + dptr;
+  d->offset = offset;
+  return 0;
+}
+
+int ide_write_snapshot(struct ide_controller *c, snapshot_t *s)
+{
+  snapshot_module_t *m = snapshot_module_create(s, c->name, SNAP_MAJOR, SNAP_MINOR);
+
+  if (m == NULL)
+    return -1;
+  if (SMW_DW(m, c->selected) < 0 || SMW_W(m, c->data_latch) < 0 ||
+      ide_write_drive_snapshot(&c->drive[0], m) < 0 ||
+      ide_write_drive_snapshot(&c->drive[1], m) < 0) {
+    snapshot_module_close(m);
+    return -1;
+  }
+  return snapshot_module_close(m);
+}
+
+int ide_read_snapshot(struct ide_controller *c, snapshot_t *s)
+{
+  uint8_t vmajor, vminor;
+  snapshot_module_t *m = snapshot_module_open(s, c->name, &vmajor, &vminor);
+
+  if (m == NULL)
+    return -1;
+  if (vmajor > SNAP_MAJOR || vminor > SNAP_MINOR) {
+    snapshot_set_error(SNAPSHOT_MODULE_HIGHER_VERSION);
+    goto fail;
+  }
+  if (SMR_DW_INT(m, &c->selected) < 0 || SMR_W(m, &c->data_latch) < 0 ||
+      ide_read_drive_snapshot(&c->drive[0], m) < 0 ||
+      ide_read_drive_snapshot(&c->drive[1], m) < 0)
+    goto fail;
+  return snapshot_module_close(m);
+fail:
+  snapshot_module_close(m);
+  return -1;
+}
+
+/*
+ *	Disk contents for checkpoints, in a module of their own. An overlay
+ *	drive stores what the overlay holds at a full checkpoint and the
+ *	sectors written since the previous one otherwise, so any checkpoint
+ *	of a chain can be loaded over the same base. For a plain image only
+ *	its size and modification time are kept: it can be resumed only
+ *	while the image is exactly as the checkpoint left it.
+ */
+#define DISK_ABSENT	0
+#define DISK_IMAGE	1
+#define DISK_OVERLAY	2
+
+#ifndef _WIN32
+static int ide_write_drive_disk(struct ide_drive *d, snapshot_module_t *m, int mode)
+{
+  struct ide_overlay_header h;
+  struct stat st;
+  uint8_t buf[512], *set;
+  uint32_t n = 0;
+  off_t i;
+
+  if (!d->present)
+    return SMW_B(m, DISK_ABSENT);
+  if (ide_flush(d) < 0) {
+    ide_fault(d, "flush failed");
+    return -1;
+  }
+  if (d->backend != IDE_BACKEND_OVERLAY) {
+    if (fstat(d->fd, &st) == -1)
+      return -1;
+    if (SMW_B(m, DISK_IMAGE) < 0 || SMW_QW(m, st.st_size) < 0 ||
+        SMW_QW(m, st.st_mtim.tv_sec) < 0 || SMW_DW(m, st.st_mtim.tv_nsec) < 0)
+      return -1;
+    return 0;
+  }
+  if (d->written == NULL) {
+    /* the first checkpoint starts the tracking, it has to be a full one */
+    if ((d->written = calloc((d->size + 7) / 8, 1)) == NULL)
+      return -1;
+    mode = IDE_DISK_FULL;
+  }
+  if (overlay_read_header(d->fd, &h) == -1)
+    return -1;
+  set = mode == IDE_DISK_FULL ? d->bitmap : d->written;
+  for (i = 0; i < d->size; i++)
+    if (set[i >> 3] & (1 << (i & 7)))
+      n++;
+  if (SMW_B(m, DISK_OVERLAY) < 0 || SMW_B(m, mode == IDE_DISK_FULL) < 0 ||
+      SMW_DW(m, h.size) < 0 || SMW_QW(m, h.mtime) < 0 || SMW_DW(m, n) < 0)
+    return -1;
+  for (i = 0; i < d->size; i++) {
+    if (!(set[i >> 3] & (1 << (i & 7))))
+      continue;
+    if (overlay_read_block(d, i, buf) != 512) {
+      ide_fault(d, "i/o error on checkpoint");
+      return -1;
+    }
+    if (SMW_DW(m, i) < 0 || SMW_BA(m, buf, 512) < 0)
+      return -1;
+  }
+  return 0;
+}
+
+static int ide_read_drive_disk(struct ide_drive *d, snapshot_module_t *m, int last)
+{
+  struct ide_overlay_header h;
+  struct stat st;
+  uint8_t kind, full, buf[512];
+  uint64_t size, mtime;
+  uint32_t nsec, base, n, block;
+  int len;
+
+  if (SMR_B(m, &kind) < 0)
+    return -1;
+  switch (kind) {
+    case DISK_ABSENT:
+      return 0;
+    case DISK_IMAGE:
+      if (SMR_QW(m, &size) < 0 || SMR_QW(m, &mtime) < 0 || SMR_DW(m, &nsec) < 0)
+        return -1;
+      /* only the checkpoint being resumed has to match, not its parents */
+      if (last && (d->backend == IDE_BACKEND_OVERLAY || fstat(d->fd, &st) == -1 ||
+          st.st_size != size || st.st_mtim.tv_sec != mtime || st.st_mtim.tv_nsec != nsec)) {
+        ide_fault(d, "image changed since the checkpoint, use an overlay to go back");
+        snapshot_set_error(SNAPSHOT_MODULE_INCOMPATIBLE);
+        return -1;
+      }
+      return 0;
+    case DISK_OVERLAY:
+      break;
+    default:
+      snapshot_set_error(SNAPSHOT_MODULE_INCOMPATIBLE);
+      return -1;
+  }
+  if (SMR_B(m, &full) < 0 || SMR_DW(m, &base) < 0 || SMR_QW(m, &mtime) < 0 || SMR_DW(m, &n) < 0)
+    return -1;
+  if (d->backend != IDE_BACKEND_OVERLAY || overlay_read_header(d->fd, &h) == -1 ||
+      h.size != base || h.mtime != mtime) {
+    ide_fault(d, "checkpoint needs an overlay on the same base");
+    snapshot_set_error(SNAPSHOT_MODULE_INCOMPATIBLE);
+    return -1;
+  }
+  if (full) {
+    /* start from the bare base */
+    if (ide_flush(d) < 0 || overlay_clear(d->fd, &h) == -1) {
+      ide_fault(d, "cannot clear overlay");
+      return -1;
+    }
+    memset(d->bitmap, 0, 512 * (d->data_start - 1));
+  }
+  while (n--) {
+    if (SMR_DW(m, &block) < 0 || SMR_BA(m, buf, 512) < 0)
+      return -1;
+    if (block >= d->size) {
+      snapshot_set_error(SNAPSHOT_MODULE_INCOMPATIBLE);
+      return -1;
+    }
+    len = d->cache ? cache_write_block(d, block, buf) : overlay_write_block(d, block, buf);
+    if (len != 512) {
+      ide_fault(d, "i/o error restoring checkpoint");
+      return -1;
+    }
+  }
+  return 0;
+}
+#endif
+
+/* mode is IDE_DISK_FULL or IDE_DISK_DELTA */
+int ide_write_disk_snapshot(struct ide_controller *c, snapshot_t *s, int mode)
+{
+#ifndef _WIN32
+  char name[SNAPSHOT_MODULE_NAME_LEN];
+  snapshot_module_t *m;
+
+  snprintf(name, sizeof(name), "%sDISK", c->name);
+  if ((m = snapshot_module_create(s, name, SNAP_MAJOR, SNAP_MINOR)) == NULL)
+    return -1;
+  if (ide_write_drive_disk(&c->drive[0], m, mode) < 0 ||
+      ide_write_drive_disk(&c->drive[1], m, mode) < 0) {
+    snapshot_module_close(m);
+    return -1;
+  }
+  return snapshot_module_close(m);
+#else
+  return 0;
+#endif
+}
+
+/* last is set for the snapshot being loaded, clear for its parents; a
+   snapshot without disk contents (-save-state) leaves the images alone */
+int ide_read_disk_snapshot(struct ide_controller *c, snapshot_t *s, int last)
+{
+#ifndef _WIN32
+  char name[SNAPSHOT_MODULE_NAME_LEN];
+  uint8_t vmajor, vminor;
+  snapshot_module_t *m;
+
+  snprintf(name, sizeof(name), "%sDISK", c->name);
+  if ((m = snapshot_module_open(s, name, &vmajor, &vminor)) == NULL)
+    return snapshot_get_error() == SNAPSHOT_MODULE_NOT_FOUND_ERROR ? 0 : -1;
+  if (vmajor > SNAP_MAJOR || vminor > SNAP_MINOR) {
+    snapshot_set_error(SNAPSHOT_MODULE_HIGHER_VERSION);
+    goto fail;
+  }
+  if (ide_read_drive_disk(&c->drive[0], m, last) < 0 ||
+      ide_read_drive_disk(&c->drive[1], m, last) < 0)
+    goto fail;
+  return snapshot_module_close(m);
+fail:
+  snapshot_module_close(m);
+  return -1;
+#else
+  return 0;
+#endif
+}
+
+/* the checkpoint was written, track writes for the next one */
+void ide_checkpoint_done(struct ide_controller *c)
+{
+  int i;
+  for (i = 0; i < 2; i++)
+    if (c->drive[i].written)
+      memset(c->drive[i].written, 0, (c->drive[i].size + 7) / 8);
+}
+
 static void make_ascii(uint16_t *p, const char *t, int len)
 {
   int i;
@@ -840,7 +2352,7 @@ int ide_make_drive(uint8_t type, int fd)
   memset(ident, 0, 8);
   ident[0] = le16((1 << 15) | (1 << 6));	/* Non removable */
   make_serial(ident + 10);
-  ident[47] = 0; /* no read multi for now */
+  ident[47] = le16(0x8000 | MAX_MULTIPLE);	/* READ/WRITE MULTIPLE */
   ident[51] = le16(240 /* PIO2 */ << 8);	/* PIO cycle time */
   ident[53] = le16(1);		/* Geometry words are valid */
   
@@ -1,4 +1,7 @@
 #include <stdint.h>
+#include <sys/types.h>
+#include <time.h>
+#include "../snapshot/snapshot.h"
 
 #define ACME_ROADRUNNER		1	/* 504MB classic IDE drive */
 #define ACME_COYOTE		2	/* 20MB early IDE drive */
@@ -7,6 +10,17 @@
 
 #define MAX_DRIVE_TYPE		4
 
+#define IDE_BACKEND_FD		0	/* read()/write() per sector */
+#define IDE_BACKEND_MMAP	1	/* image mapped into memory */
+#define IDE_BACKEND_OVERLAY	2	/* copy-on-write delta over a shared base */
+
+#define IDE_CACHE_WRITETHROUGH	0	/* write each sector as it arrives */
+#define IDE_CACHE_FLUSH		1	/* write back when full, on FLUSH CACHE and detach */
+#define IDE_CACHE_PERIODIC	2	/* ...and every interval ms */
+
+#define IDE_DISK_FULL		0	/* checkpoint everything an overlay holds */
+#define IDE_DISK_DELTA		1	/* ...or the sectors written since the last one */
+
 #define		ide_data	0
 #define		ide_error_r	1
 #define		ide_feature_w	1
@@ -40,6 +54,8 @@ struct ide_taskfile {
   struct ide_drive *drive;
 };
 
+struct ide_cache;
+
 struct ide_drive {
   struct ide_controller *controller;
   struct ide_taskfile taskfile;
@@ -53,6 +69,24 @@ struct ide_drive {
   int fd;
   off_t offset;
   int length;
+  uint8_t multiple;		/* SET MULTIPLE MODE block size, 0 = off */
+  int block;			/* sectors per DRQ block of the current command */
+  int drq;			/* sectors left in the current DRQ block */
+  int backend;
+  uint8_t *map;			/* IDE_BACKEND_MMAP: whole image */
+  off_t size;			/* image size in sectors, header included */
+  unsigned int dirty:1;
+  int sync_interval;		/* seconds between msyncs, 0 = at detach only */
+  time_t synced;
+  int base_fd;			/* IDE_BACKEND_OVERLAY: read-only base image */
+  uint8_t *base_map;
+  uint8_t *bitmap;		/* blocks present in the overlay */
+  struct ide_zimage *zimage;	/* compressed base image */
+  off_t data_start;		/* first data sector in the overlay file */
+  struct ide_cache *cache;	/* write-back cache, NULL for write-through */
+  uint8_t *written;		/* sectors written since the last checkpoint */
+  uint64_t sectors_read;	/* statistics */
+  uint64_t sectors_written;
 };
 
 struct ide_controller {
@@ -63,6 +97,7 @@ struct ide_controller {
 };
 
 extern const uint8_t ide_magic[8];
+extern const uint8_t ide_overlay_magic[8];
 
 void ide_reset_begin(struct ide_controller *c);
 uint8_t ide_read8(struct ide_controller *c, uint8_t r);
@@ -74,7 +109,25 @@ void ide_write_latched(struct ide_controller *c, uint8_t r, uint8_t v);
 
 struct ide_controller *ide_allocate(const char *name);
 int ide_attach(struct ide_controller *c, int drive, int fd);
+int ide_attach_mmap(struct ide_controller *c, int drive, int fd, int sync_interval);
+void ide_sync(struct ide_drive *d);
+void ide_poll(struct ide_controller *c);
+int ide_set_cache(struct ide_drive *d, int policy, int interval);
+int ide_flush(struct ide_drive *d);
+int ide_fork(struct ide_drive *d);
 void ide_detach(struct ide_drive *d);
 void ide_free(struct ide_controller *c);
 
+int ide_write_snapshot(struct ide_controller *c, snapshot_t *s);
+int ide_read_snapshot(struct ide_controller *c, snapshot_t *s);
+int ide_write_disk_snapshot(struct ide_controller *c, snapshot_t *s, int mode);
+int ide_read_disk_snapshot(struct ide_controller *c, snapshot_t *s, int last);
+void ide_checkpoint_done(struct ide_controller *c);
+
 int ide_make_drive(uint8_t type, int fd);
+int ide_make_overlay(int fd, const char *base);
+int ide_commit_overlay(int fd);
+int ide_discard_overlay(int fd);
+#ifdef HAVE_ZLIB
+int ide_compress_image(int in, int out);
+#endif
@@ -1,16 +1,103 @@
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <fcntl.h>
 #include <unistd.h>
 #include "ide.h"
 
-int main(int argc, const char *argv[])
+static void usage(const char *name)
 {
-  int t, fd;
-  if (argc != 3) {
-    fprintf(stderr, "%s [type] [path]\n", argv[0]);
+  fprintf(stderr, "%s [type] [path]\n", name);
+#ifndef _WIN32
+  fprintf(stderr, "%s -overlay [base] [path]\n", name);
+  fprintf(stderr, "%s -commit [path]\n", name);
+  fprintf(stderr, "%s -discard [path]\n", name);
+#endif
+#ifdef HAVE_ZLIB
+  fprintf(stderr, "%s -compress [image] [path]\n", name);
+#endif
+  exit(1);
+}
+
+#ifndef _WIN32
+
+/* Overlay maintenance: create, fold into the base, or throw away */
+static int overlay_main(int argc, const char *argv[])
+{
+  int fd, r;
+  if (strcmp(argv[1], "-overlay") == 0) {
+    if (argc != 4)
+      usage(argv[0]);
+    fd = open(argv[3], O_RDWR|O_CREAT|O_EXCL, 0666);
+    if (fd == -1) {
+      perror(argv[3]);
+      exit(1);
+    }
+    if (ide_make_overlay(fd, argv[2]) < 0) {
+      perror(argv[2]);
+      unlink(argv[3]);
+      exit(1);
+    }
+    return 0;
+  }
+#ifdef HAVE_ZLIB
+  if (strcmp(argv[1], "-compress") == 0) {
+    int in;
+    if (argc != 4)
+      usage(argv[0]);
+    in = open(argv[2], O_RDONLY);
+    if (in == -1) {
+      perror(argv[2]);
+      exit(1);
+    }
+    fd = open(argv[3], O_WRONLY|O_CREAT|O_EXCL, 0666);
+    if (fd == -1) {
+      perror(argv[3]);
+      exit(1);
+    }
+    if (ide_compress_image(in, fd) < 0) {
+      perror(argv[2]);
+      unlink(argv[3]);
+      exit(1);
+    }
+    return 0;
+  }
+#else
+  if (strcmp(argv[1], "-compress") == 0) {
+    fprintf(stderr, "%s: built without zlib, -compress is not available.\n", argv[0]);
     exit(1);
   }
+#endif
+  if (argc != 3)
+    usage(argv[0]);
+  fd = open(argv[2], O_RDWR);
+  if (fd == -1) {
+    perror(argv[2]);
+    exit(1);
+  }
+  if (strcmp(argv[1], "-commit") == 0)
+    r = ide_commit_overlay(fd);
+  else if (strcmp(argv[1], "-discard") == 0)
+    r = ide_discard_overlay(fd);
+  else
+    usage(argv[0]);
+  if (r < 0) {
+    perror(argv[2]);
+    exit(1);
+  }
+  return 0;
+}
+#endif
+
+int main(int argc, const char *argv[])
+{
+  int t, fd;
+#ifndef _WIN32
+  if (argc > 1 && argv[1][0] == '-')
+    return overlay_main(argc, argv);
+#endif
+  if (argc != 3)
+    usage(argv[0]);
   t = atoi(argv[1]);
   if (t < 1 || t > MAX_DRIVE_TYPE) {
     fprintf(stderr, "%s: unknown drive type.\n", argv[0]);
@@ -1198,3 +1198,147 @@ void pc16554_device_w( struct pc16554_device *d, offs_t offset, uint8_t data )
 {
 	ins8250_device_w(d->channel[(offset>>3)&3], offset & 7, data);
 }
+
+/* snapshot support: one module per channel, named after the channel tag */
+#define SNAP_MAJOR 0
+#define SNAP_MINOR 0
+
+int ins8250_device_write_snapshot(struct ins8250_device *d, snapshot_t *s)
+{
+	snapshot_module_t *m = snapshot_module_create(s, d->m_tag, SNAP_MAJOR, SNAP_MINOR);
+
+	if (m == NULL)
+		return -1;
+	if (0
+		|| SMW_B(m, d->m_regs.thr) < 0
+		|| SMW_B(m, d->m_regs.rbr) < 0
+		|| SMW_B(m, d->m_regs.ier) < 0
+		|| SMW_W(m, d->m_regs.dl) < 0
+		|| SMW_B(m, d->m_regs.iir) < 0
+		|| SMW_B(m, d->m_regs.fcr) < 0
+		|| SMW_B(m, d->m_regs.lcr) < 0
+		|| SMW_B(m, d->m_regs.mcr) < 0
+		|| SMW_B(m, d->m_regs.lsr) < 0
+		|| SMW_B(m, d->m_regs.msr) < 0
+		|| SMW_B(m, d->m_regs.scr) < 0
+		|| SMW_B(m, d->m_regs.efr) < 0
+		|| SMW_B(m, d->m_regs.xon1) < 0
+		|| SMW_B(m, d->m_regs.xon2) < 0
+		|| SMW_B(m, d->m_regs.xoff1) < 0
+		|| SMW_B(m, d->m_regs.xoff2) < 0
+		|| SMW_B(m, d->m_regs.asr) < 0
+		|| SMW_BA(m, d->m_regs.icr, sizeof(d->m_regs.icr)) < 0
+		|| SMW_B(m, d->m_650eregs) < 0
+		|| SMW_B(m, d->m_int_pending) < 0
+		|| SMW_DW(m, d->m_txd) < 0
+		|| SMW_DW(m, d->m_rxd) < 0
+		|| SMW_DW(m, d->m_dcd) < 0
+		|| SMW_DW(m, d->m_dsr) < 0
+		|| SMW_DW(m, d->m_ri) < 0
+		|| SMW_DW(m, d->m_cts) < 0
+		|| SMW_W(m, d->tx_timer) < 0
+		|| SMW_W(m, d->m_brg_const) < 0
+		|| SMW_B(m, d->rx_bits_rem) < 0
+		|| SMW_B(m, d->rx_data) < 0
+		|| SMW_B(m, d->tx_bits_rem) < 0
+		|| SMW_B(m, d->tx_data) < 0
+		|| SMW_B(m, d->m_bit_count) < 0
+		|| SMW_DW(m, d->m_rintlvl) < 0
+		|| SMW_BA(m, d->m_rfifo, sizeof(d->m_rfifo)) < 0
+		|| SMW_BA(m, d->m_tfifo, sizeof(d->m_tfifo)) < 0
+		|| SMW_DW(m, d->m_rhead) < 0
+		|| SMW_DW(m, d->m_rtail) < 0
+		|| SMW_DW(m, d->m_rnum) < 0
+		|| SMW_DW(m, d->m_thead) < 0
+		|| SMW_DW(m, d->m_ttail) < 0
+		|| SMW_QW(m, d->m_timeout) < 0) {
+		snapshot_module_close(m);
+		return -1;
+	}
+	return snapshot_module_close(m);
+}
+
+int ins8250_device_read_snapshot(struct ins8250_device *d, snapshot_t *s)
+{
+	uint8_t vmajor, vminor;
+	snapshot_module_t *m = snapshot_module_open(s, d->m_tag, &vmajor, &vminor);
+
+	if (m == NULL)
+		return -1;
+	if (vmajor > SNAP_MAJOR || vminor > SNAP_MINOR) {
+		snapshot_set_error(SNAPSHOT_MODULE_HIGHER_VERSION);
+		goto fail;
+	}
+	if (0
+		|| SMR_B(m, &d->m_regs.thr) < 0
+		|| SMR_B(m, &d->m_regs.rbr) < 0
+		|| SMR_B(m, &d->m_regs.ier) < 0
+		|| SMR_W(m, &d->m_regs.dl) < 0
+		|| SMR_B(m, &d->m_regs.iir) < 0
+		|| SMR_B(m, &d->m_regs.fcr) < 0
+		|| SMR_B(m, &d->m_regs.lcr) < 0
+		|| SMR_B(m, &d->m_regs.mcr) < 0
+		|| SMR_B(m, &d->m_regs.lsr) < 0
+		|| SMR_B(m, &d->m_regs.msr) < 0
+		|| SMR_B(m, &d->m_regs.scr) < 0
+		|| SMR_B(m, &d->m_regs.efr) < 0
+		|| SMR_B(m, &d->m_regs.xon1) < 0
+		|| SMR_B(m, &d->m_regs.xon2) < 0
+		|| SMR_B(m, &d->m_regs.xoff1) < 0
+		|| SMR_B(m, &d->m_regs.xoff2) < 0
+		|| SMR_B(m, &d->m_regs.asr) < 0
+		|| SMR_BA(m, d->m_regs.icr, sizeof(d->m_regs.icr)) < 0
+		|| SMR_B(m, &d->m_650eregs) < 0
+		|| SMR_B(m, &d->m_int_pending) < 0
+		|| SMR_DW_INT(m, &d->m_txd) < 0
+		|| SMR_DW_INT(m, &d->m_rxd) < 0
+		|| SMR_DW_INT(m, &d->m_dcd) < 0
+		|| SMR_DW_INT(m, &d->m_dsr) < 0
+		|| SMR_DW_INT(m, &d->m_ri) < 0
+		|| SMR_DW_INT(m, &d->m_cts) < 0
+		|| SMR_W(m, &d->tx_timer) < 0
+		|| SMR_W(m, &d->m_brg_const) < 0
+		|| SMR_B(m, &d->rx_bits_rem) < 0
+		|| SMR_B(m, &d->rx_data) < 0
+		|| SMR_B(m, &d->tx_bits_rem) < 0
+		|| SMR_B(m, &d->tx_data) < 0
+		|| SMR_B(m, &d->m_bit_count) < 0
+		|| SMR_DW_INT(m, &d->m_rintlvl) < 0
+		|| SMR_BA(m, d->m_rfifo, sizeof(d->m_rfifo)) < 0
+		|| SMR_BA(m, d->m_tfifo, sizeof(d->m_tfifo)) < 0
+		|| SMR_DW_INT(m, &d->m_rhead) < 0
+		|| SMR_DW_INT(m, &d->m_rtail) < 0
+		|| SMR_DW_INT(m, &d->m_rnum) < 0
+		|| SMR_DW_INT(m, &d->m_thead) < 0
+		|| SMR_DW_INT(m, &d->m_ttail) < 0
+		|| SMR_QW(m, &d->m_timeout) < 0) {
+		goto fail;
+	}
+	return snapshot_module_close(m);
+
+fail:
+	snapshot_module_close(m);
+	return -1;
+}
+
+int pc16554_device_write_snapshot(struct pc16554_device *d, snapshot_t *s)
+{
+	int i;
+	for (i=0;i<4;i++)
+	{
+		if (ins8250_device_write_snapshot(d->channel[i], s) < 0)
+			return -1;
+	}
+	return 0;
+}
+
+int pc16554_device_read_snapshot(struct pc16554_device *d, snapshot_t *s)
+{
+	int i;
+	for (i=0;i<4;i++)
+	{
+		if (ins8250_device_read_snapshot(d->channel[i], s) < 0)
+			return -1;
+	}
+	return 0;
+}
@@ -19,6 +19,7 @@ int VERBOSE;
 
 //#include "diserial.h"
 #include <stdint.h>
+#include "../snapshot/snapshot.h"
 typedef void device_t;
 typedef uint32_t offs_t;
 typedef uint16_t emu_timer;
@@ -258,6 +259,11 @@ void pc16554_device_reset(struct pc16554_device *d);
 
 void ins8250_device_timer(struct ins8250_device *d);
 
+int ins8250_device_write_snapshot(struct ins8250_device *d, snapshot_t *s);
+int ins8250_device_read_snapshot(struct ins8250_device *d, snapshot_t *s);
+int pc16554_device_write_snapshot(struct pc16554_device *d, snapshot_t *s);
+int pc16554_device_read_snapshot(struct pc16554_device *d, snapshot_t *s);
+
 /*DECLARE_DEVICE_TYPE(PC16552D, pc16552_device)
 DECLARE_DEVICE_TYPE(INS8250,  ins8250_device)
 DECLARE_DEVICE_TYPE(NS16450,  ns16450_device)
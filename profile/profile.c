@@ -0,0 +1,614 @@
+/*
+ * profile.c - Guest PC sampling profiler.
+ *
+ * Samples are counted in a hash table keyed by physical PC, logical PC,
+ * CPU mode and task context. At the end they are resolved to symbols
+ * and summed per routine.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+
+#include "profile.h"
+#include "../z280/z280.h"
+
+struct sample {
+	uint32_t ppc;
+	uint16_t pc;
+	uint16_t ctx;
+	int user;
+	unsigned long count;
+};
+
+static struct sample *hist;
+static unsigned int hist_size, hist_used;
+static unsigned long total;
+
+struct symbol {
+	uint32_t addr;
+	char *name;
+};
+
+struct symtab {
+	struct symbol *sym;
+	int count;
+	int physical;
+};
+
+#define MAX_SYMTABS 8
+static struct symtab symtabs[MAX_SYMTABS];
+static int nsymtabs;
+
+/* ---------------------------------------------------------------------- */
+
+static unsigned int hash(uint32_t ppc, uint16_t pc, int user, uint16_t ctx)
+{
+	uint32_t h = ppc * 2654435761u ^ pc * 40503u ^ ctx * 2246822519u ^ user;
+	return h ^ (h >> 15);
+}
+
+static void hist_grow(void)
+{
+	struct sample *old = hist;
+	unsigned int old_size = hist_size, i, h;
+
+	hist_size = hist_size ? hist_size * 2 : 4096;
+	hist = calloc(hist_size, sizeof(*hist));
+	if (hist == NULL) {
+		printf("Profile: out of memory\n");
+		exit(1);
+	}
+	for (i = 0; i < old_size; i++) {
+		if (!old[i].count)
+			continue;
+		h = hash(old[i].ppc, old[i].pc, old[i].user, old[i].ctx) & (hist_size - 1);
+		while (hist[h].count)
+			h = (h + 1) & (hist_size - 1);
+		hist[h] = old[i];
+	}
+	free(old);
+}
+
+void profile_sample(uint32_t ppc, uint16_t pc, int user, uint16_t ctx)
+{
+	struct sample *s;
+	unsigned int h;
+
+	if (hist_used * 2 >= hist_size)
+		hist_grow();
+	h = hash(ppc, pc, user, ctx) & (hist_size - 1);
+	for (;;) {
+		s = &hist[h];
+		if (!s->count) {
+			s->ppc = ppc;
+			s->pc = pc;
+			s->user = user;
+			s->ctx = ctx;
+			hist_used++;
+			break;
+		}
+		if (s->ppc == ppc && s->pc == pc && s->user == user && s->ctx == ctx)
+			break;
+		h = (h + 1) & (hist_size - 1);
+	}
+	s->count++;
+	total++;
+}
+
+/* ---------------------------------------------------------------------- */
+
+/* 0123, 0123H, 0x123, 0123' (relocatable); plain words like BEEF are names */
+static int parse_addr(const char *t, uint32_t *addr)
+{
+	char *e;
+	int digit = 0;
+	const char *p;
+
+	if (t[0] == '0' && (t[1] == 'x' || t[1] == 'X'))
+		digit = 1;
+	for (p = t; isxdigit((unsigned char)*p); p++)
+		digit |= isdigit((unsigned char)*p) != 0;
+	if (p == t || !digit)
+		return 0;
+	*addr = strtoul(t, &e, 16);
+	if (*e == 'H' || *e == 'h' || *e == '\'')
+		e++;
+	return *e == 0;
+}
+
+static int is_name(const char *t)
+{
+	return isalpha((unsigned char)*t) || *t == '_' || *t == '.' || *t == '$' || *t == '?' || *t == '@';
+}
+
+static int symcmp(const void *a, const void *b)
+{
+	const struct symbol *x = a, *y = b;
+	return x->addr < y->addr ? -1 : x->addr > y->addr;
+}
+
+/* takes "addr name" and "name addr" pairs, several per line, and skips
+   = EQU and : so that .SYM, .MAP and listing symbol tables all work */
+int profile_load_symbols(const char *spec)
+{
+	char *path = strdup(spec), *c, line[512], *tok[64];
+	struct symtab *st;
+	uint32_t base = 0, addr;
+	int n, i, alloc = 0;
+	FILE *f;
+
+	if (nsymtabs == MAX_SYMTABS) {
+		printf("Profile: too many symbol files\n");
+		return -1;
+	}
+	st = &symtabs[nsymtabs];
+	if ((c = strrchr(path, ','))) {
+		*c = 0;
+		base = strtoul(c + 1, NULL, 16);
+		st->physical = 1;
+	}
+	if (!(f = fopen(path, "r"))) {
+		printf("Profile: cannot open %s\n", path);
+		free(path);
+		return -1;
+	}
+	while (fgets(line, sizeof(line), f)) {
+		n = 0;
+		for (c = strtok(line, " \t\r\n"); c && n < 64; c = strtok(NULL, " \t\r\n")) {
+			if (strcmp(c, "=") == 0 || strcasecmp(c, "EQU") == 0 || strcmp(c, ":") == 0)
+				continue;
+			if (c[strlen(c) - 1] == ':')
+				c[strlen(c) - 1] = 0;
+			tok[n++] = c;
+		}
+		for (i = 0; i + 1 < n; ) {
+			char *name = NULL;
+			if (parse_addr(tok[i], &addr) && is_name(tok[i + 1]))
+				name = tok[i + 1];
+			else if (is_name(tok[i]) && parse_addr(tok[i + 1], &addr))
+				name = tok[i];
+			if (!name) {
+				i++;
+				continue;
+			}
+			if (st->count == alloc) {
+				alloc = alloc ? alloc * 2 : 256;
+				st->sym = realloc(st->sym, alloc * sizeof(*st->sym));
+			}
+			st->sym[st->count].addr = st->physical ? base + addr : addr & 0xffff;
+			st->sym[st->count].name = strdup(name);
+			st->count++;
+			i += 2;
+		}
+	}
+	fclose(f);
+	qsort(st->sym, st->count, sizeof(*st->sym), symcmp);
+	printf("Profile: %d symbols from %s\n", st->count, path);
+	free(path);
+	nsymtabs++;
+	return 0;
+}
+
+static struct symbol *lookup(struct symtab *st, uint32_t addr)
+{
+	int lo = 0, hi = st->count - 1, mid;
+	struct symbol *best = NULL;
+
+	while (lo <= hi) {
+		mid = (lo + hi) / 2;
+		if (st->sym[mid].addr <= addr) {
+			best = &st->sym[mid];
+			lo = mid + 1;
+		} else
+			hi = mid - 1;
+	}
+	if (best && addr - best->addr >= PROFILE_MAXOFF)
+		return NULL;
+	return best;
+}
+
+/* physical symbol files first, then the logical ones */
+const char *profile_symbol(uint32_t ppc, uint16_t pc, uint32_t *offset)
+{
+	struct symbol *s;
+	int pass, i;
+
+	for (pass = 1; pass >= 0; pass--)
+		for (i = 0; i < nsymtabs; i++) {
+			if (symtabs[i].physical != pass)
+				continue;
+			if ((s = lookup(&symtabs[i], pass ? ppc : pc))) {
+				*offset = (pass ? ppc : pc) - s->addr;
+				return s->name;
+			}
+		}
+	return NULL;
+}
+
+/* ---------------------------------------------------------------------- */
+
+struct row {
+	char label[48];
+	int user;
+	uint16_t ctx;
+	unsigned long count;
+};
+
+static int rowcmp_label(const void *a, const void *b)
+{
+	const struct row *x = a, *y = b;
+	int r = strcmp(x->label, y->label);
+	if (r)
+		return r;
+	if (x->user != y->user)
+		return x->user - y->user;
+	return (int)x->ctx - (int)y->ctx;
+}
+
+static int rowcmp_count(const void *a, const void *b)
+{
+	const struct row *x = a, *y = b;
+	return x->count < y->count ? 1 : x->count > y->count ? -1 : 0;
+}
+
+int profile_write(const char *path, unsigned long period, const uint8_t *mem, size_t memsize)
+{
+	struct row *rows;
+	const char *name;
+	char ibuf[20];
+	uint32_t off;
+	unsigned int i, n = 0, m;
+	FILE *f;
+
+	if (!(f = fopen(path, "w"))) {
+		printf("Profile: cannot create %s\n", path);
+		return -1;
+	}
+	rows = calloc(hist_used ? hist_used : 1, sizeof(*rows));
+	for (i = 0; i < hist_size; i++) {
+		struct sample *s = &hist[i];
+		if (!s->count)
+			continue;
+		if ((name = profile_symbol(s->ppc, s->pc, &off)))
+			snprintf(rows[n].label, sizeof(rows[n].label), "%s", name);
+		else {
+			if (s->ppc + 8 <= memsize)
+				cpu_disassemble_z280(NULL, ibuf, s->pc, &mem[s->ppc], 0);
+			else
+				strcpy(ibuf, "?");
+			snprintf(rows[n].label, sizeof(rows[n].label), "%06X %04X %s", s->ppc, s->pc, ibuf);
+		}
+		rows[n].user = s->user;
+		rows[n].ctx = s->ctx;
+		rows[n].count = s->count;
+		n++;
+	}
+
+	/* sum up each routine */
+	qsort(rows, n, sizeof(*rows), rowcmp_label);
+	for (i = 0, m = 0; i < n; i++) {
+		if (m && rowcmp_label(&rows[m - 1], &rows[i]) == 0)
+			rows[m - 1].count += rows[i].count;
+		else
+			rows[m++] = rows[i];
+	}
+	qsort(rows, m, sizeof(*rows), rowcmp_count);
+
+	fprintf(f, "# %lu samples, one every %lu cycles on average\n", total, period);
+	fprintf(f, "#      %%    samples mode ctx  routine\n");
+	for (i = 0; i < m; i++) {
+		fprintf(f, "%8.2f %10lu %s ", 100.0 * rows[i].count / total, rows[i].count,
+			rows[i].user ? "usr " : "sys ");
+		if (rows[i].user)
+			fprintf(f, "%04X ", rows[i].ctx);
+		else
+			fprintf(f, "-    ");
+		fprintf(f, "%s\n", rows[i].label);
+	}
+	free(rows);
+	fclose(f);
+	return 0;
+}
+
+/* ---------------------------------------------------------------------- */
+
+/* the call graph is a tree of call paths; every guest stack (the system
+   stack and one user stack per task) has a shadow stack of nodes in it */
+struct cg_node {
+	uint32_t ppc;
+	uint16_t pc;
+	uint8_t kind;		/* Z280_CG_CALL, _INT or _TRAP, CG_ROOT */
+	int parent;
+	int next;		/* hash chain */
+	unsigned long calls;
+	unsigned long long self, incl;
+};
+
+#define CG_ROOT		0xff
+#define CG_HASH		65536
+#define CG_MAXPATH	(2 * PROFILE_MAXDEPTH + 1)	/* task root, user and system stack */
+
+struct cg_frame {
+	uint16_t ret_sp;
+	int node;
+};
+
+struct cg_stack {
+	int user;
+	uint16_t ctx;
+	int root;
+	struct cg_frame frame[PROFILE_MAXDEPTH];
+	int depth;
+};
+
+static struct cg_node *nodes;
+static unsigned int nnodes, nodes_alloc;
+static int cg_hash[CG_HASH];
+static struct cg_stack **stacks;
+static int nstacks;
+static int active = -1, cur;
+static unsigned long long cg_last;
+
+static int cg_node(int parent, uint32_t ppc, uint16_t pc, int kind)
+{
+	unsigned int h = (hash(ppc, pc, kind, parent) >> 4) & (CG_HASH - 1);
+	struct cg_node *n;
+	int i;
+
+	if (!nodes)
+		memset(cg_hash, -1, sizeof(cg_hash));
+	for (i = cg_hash[h]; i >= 0; i = nodes[i].next)
+		if (nodes[i].parent == parent && nodes[i].ppc == ppc &&
+		    nodes[i].pc == pc && nodes[i].kind == kind)
+			return i;
+	if (nnodes == nodes_alloc) {
+		nodes_alloc = nodes_alloc ? nodes_alloc * 2 : 4096;
+		nodes = realloc(nodes, nodes_alloc * sizeof(*nodes));
+		if (nodes == NULL) {
+			printf("Profile: out of memory\n");
+			exit(1);
+		}
+	}
+	n = &nodes[nnodes];
+	memset(n, 0, sizeof(*n));
+	n->ppc = ppc;
+	n->pc = pc;
+	n->kind = kind;
+	n->parent = parent;
+	n->next = cg_hash[h];
+	cg_hash[h] = nnodes;
+	return nnodes++;
+}
+
+static int cg_stack(int user, uint16_t ctx)
+{
+	struct cg_stack *s;
+	int i;
+
+	if (!user)
+		ctx = 0;
+	if (active >= 0 && stacks[active]->user == user && stacks[active]->ctx == ctx)
+		return active;
+	for (i = 0; i < nstacks; i++)
+		if (stacks[i]->user == user && stacks[i]->ctx == ctx)
+			return i;
+	stacks = realloc(stacks, (nstacks + 1) * sizeof(*stacks));
+	s = stacks[nstacks] = calloc(1, sizeof(**stacks));
+	if (s == NULL) {
+		printf("Profile: out of memory\n");
+		exit(1);
+	}
+	s->user = user;
+	s->ctx = ctx;
+	s->root = cg_node(-1, user, ctx, CG_ROOT);
+	return nstacks++;
+}
+
+static int cg_top(int stack)
+{
+	struct cg_stack *s = stacks[stack];
+	return s->depth ? s->frame[s->depth - 1].node : s->root;
+}
+
+/* the cycles since the last event belong to the current path */
+static void cg_charge(unsigned long long now)
+{
+	if (active >= 0)
+		nodes[cur].self += now - cg_last;
+	cg_last = now;
+}
+
+void profile_cg_enter(int kind, int user, uint16_t ctx, uint16_t ret_sp,
+	uint32_t ppc, uint16_t pc, unsigned long long now)
+{
+	struct cg_stack *s;
+	int from;
+
+	cg_charge(now);
+	if (kind == Z280_CG_CALL)
+		from = active = cg_stack(user, ctx);
+	else {
+		/* interrupts and traps nest on the system stack, on top of
+		   whatever was running */
+		from = active >= 0 ? active : cg_stack(0, 0);
+		active = cg_stack(0, 0);
+	}
+	s = stacks[active];
+	/* a live frame returns above the new one, the rest were abandoned */
+	while (s->depth && s->frame[s->depth - 1].ret_sp <= ret_sp)
+		s->depth--;
+	cur = cg_node(cg_top(from), ppc, pc, kind);
+	nodes[cur].calls++;
+	if (s->depth < PROFILE_MAXDEPTH) {
+		s->frame[s->depth].ret_sp = ret_sp;
+		s->frame[s->depth].node = cur;
+		s->depth++;
+	}
+	else
+		cur = cg_top(active);
+}
+
+/* unwinds every frame at or below ret_sp, so frames left by code that
+   never returned go as well; then continues in the to_ stack */
+void profile_cg_return(int user, uint16_t ctx, uint16_t ret_sp,
+	int to_user, uint16_t to_ctx, unsigned long long now)
+{
+	struct cg_stack *s;
+
+	cg_charge(now);
+	s = stacks[cg_stack(user, ctx)];
+	while (s->depth && s->frame[s->depth - 1].ret_sp <= ret_sp)
+		s->depth--;
+	active = cg_stack(to_user, to_ctx);
+	cur = cg_top(active);
+}
+
+static void cg_label(int i, char *buf, size_t len)
+{
+	struct cg_node *n = &nodes[i];
+	const char *name;
+	uint32_t off;
+
+	if (n->kind == CG_ROOT) {
+		if (n->ppc)
+			snprintf(buf, len, "task_%04X", n->pc);
+		else
+			snprintf(buf, len, "system");
+		return;
+	}
+	if ((name = profile_symbol(n->ppc, n->pc, &off)) && off)
+		snprintf(buf, len, "%s%s+%X", n->kind == Z280_CG_INT ? "int:" :
+			n->kind == Z280_CG_TRAP ? "trap:" : "", name, off);
+	else if (name)
+		snprintf(buf, len, "%s%s", n->kind == Z280_CG_INT ? "int:" :
+			n->kind == Z280_CG_TRAP ? "trap:" : "", name);
+	else
+		snprintf(buf, len, "%s%06X", n->kind == Z280_CG_INT ? "int:" :
+			n->kind == Z280_CG_TRAP ? "trap:" : "", n->ppc);
+}
+
+struct edge {
+	int caller, callee;
+	unsigned long calls;
+	unsigned long long incl, self;
+};
+
+static char (*labels)[48];
+
+static int edgecmp_label(const void *a, const void *b)
+{
+	const struct edge *x = a, *y = b;
+	int r = strcmp(labels[x->caller], labels[y->caller]);
+	return r ? r : strcmp(labels[x->callee], labels[y->callee]);
+}
+
+static int edgecmp_incl(const void *a, const void *b)
+{
+	const struct edge *x = a, *y = b;
+	return x->incl < y->incl ? 1 : x->incl > y->incl ? -1 : 0;
+}
+
+/* does the caller->callee edge of node i repeat further up the path?
+   then recursion already counts its inclusive time */
+static int cg_recursive(int i)
+{
+	int p = nodes[i].parent, a;
+
+	for (a = nodes[p].parent; a >= 0 && nodes[a].parent >= 0; a = nodes[a].parent)
+		if (strcmp(labels[a], labels[i]) == 0 &&
+		    strcmp(labels[nodes[a].parent], labels[p]) == 0)
+			return 1;
+	return 0;
+}
+
+/* collapsed stacks ("a;b;c cycles") in path, call edges in path.edges */
+int profile_cg_write(const char *path, unsigned long long now)
+{
+	struct edge *edges;
+	char *epath, *line;
+	int i, j, p, n, m, depth, *chain;
+	size_t len;
+	FILE *f;
+
+	cg_charge(now);
+	if (!(f = fopen(path, "w"))) {
+		printf("Profile: cannot create %s\n", path);
+		return -1;
+	}
+	labels = calloc(nnodes ? nnodes : 1, sizeof(*labels));
+	chain = malloc(CG_MAXPATH * sizeof(*chain));
+	line = malloc(CG_MAXPATH * sizeof(*labels));
+	for (i = 0; i < nnodes; i++)
+		cg_label(i, labels[i], sizeof(labels[i]));
+	for (i = 0; i < nnodes; i++) {
+		if (!nodes[i].self)
+			continue;
+		for (depth = 0, p = i; p >= 0; p = nodes[p].parent)
+			chain[depth++] = p;
+		for (len = 0, j = depth - 1; j >= 0; j--)
+			len += sprintf(line + len, "%s%s", labels[chain[j]], j ? ";" : "");
+		fprintf(f, "%s %llu\n", line, nodes[i].self);
+	}
+	fclose(f);
+
+	/* children always come after their parents */
+	for (i = 0; i < nnodes; i++)
+		nodes[i].incl = nodes[i].self;
+	for (i = nnodes - 1; i >= 0; i--)
+		if (nodes[i].parent >= 0)
+			nodes[nodes[i].parent].incl += nodes[i].incl;
+	edges = calloc(nnodes ? nnodes : 1, sizeof(*edges));
+	for (i = 0, n = 0; i < nnodes; i++) {
+		if (nodes[i].parent < 0)
+			continue;
+		edges[n].caller = nodes[i].parent;
+		edges[n].callee = i;
+		edges[n].calls = nodes[i].calls;
+		edges[n].incl = cg_recursive(i) ? 0 : nodes[i].incl;
+		edges[n].self = nodes[i].self;
+		n++;
+	}
+	qsort(edges, n, sizeof(*edges), edgecmp_label);
+	for (i = 0, m = 0; i < n; i++) {
+		if (m && edgecmp_label(&edges[m - 1], &edges[i]) == 0) {
+			edges[m - 1].calls += edges[i].calls;
+			edges[m - 1].incl += edges[i].incl;
+			edges[m - 1].self += edges[i].self;
+		}
+		else
+			edges[m++] = edges[i];
+	}
+	qsort(edges, m, sizeof(*edges), edgecmp_incl);
+
+	epath = malloc(strlen(path) + 7);
+	sprintf(epath, "%s.edges", path);
+	if (!(f = fopen(epath, "w"))) {
+		printf("Profile: cannot create %s\n", epath);
+		free(epath);
+		return -1;
+	}
+	fprintf(f, "# cycles spent in each callee when called from each caller\n");
+	fprintf(f, "#     calls        inclusive        exclusive  caller -> callee\n");
+	for (i = 0; i < m; i++)
+		fprintf(f, "%11lu %16llu %16llu  %s -> %s\n", edges[i].calls, edges[i].incl,
+			edges[i].self, labels[edges[i].caller], labels[edges[i].callee]);
+	fclose(f);
+	free(epath);
+	free(edges);
+	free(line);
+	free(chain);
+	free(labels);
+	return 0;
+}
@@ -0,0 +1,45 @@
+/*
+ * profile.h - Guest PC sampling profiler.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+
+#ifndef Z280EMU_PROFILE_H
+#define Z280EMU_PROFILE_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+#define PROFILE_PERIOD	10000	/* default cycles between samples */
+#define PROFILE_MAXOFF	0x1000	/* farther from any symbol is unknown */
+#define PROFILE_MAXDEPTH	256	/* deepest call path followed */
+
+/* symbols: file[,base], base is the physical load address in hex;
+   without it the symbols are matched against the logical PC */
+int profile_load_symbols(const char *spec);
+const char *profile_symbol(uint32_t ppc, uint16_t pc, uint32_t *offset);
+
+/* one sample; ctx tells user tasks apart, e.g. the frame of user PDR 0 */
+void profile_sample(uint32_t ppc, uint16_t pc, int user, uint16_t ctx);
+
+/* flat profile, unknown addresses shown disassembled from mem */
+int profile_write(const char *path, unsigned long period, const uint8_t *mem, size_t memsize);
+
+/* call graph: kind is Z280_CG_*; a call pushes onto the stack of user/ctx,
+   interrupts and traps onto the system stack; a return pops user/ctx back
+   to ret_sp and resumes in to_user/to_ctx */
+void profile_cg_enter(int kind, int user, uint16_t ctx, uint16_t ret_sp,
+	uint32_t ppc, uint16_t pc, unsigned long long now);
+void profile_cg_return(int user, uint16_t ctx, uint16_t ret_sp,
+	int to_user, uint16_t to_ctx, unsigned long long now);
+int profile_cg_write(const char *path, unsigned long long now);
+
+#endif
@@ -20,14 +20,18 @@
  *
  */
 
+#include <limits.h>
+
 #ifdef _WIN32
 #include <winsock2.h>
 #include <ws2tcpip.h>
 #define TCPIP_error WSAGetLastError()
+#define TCPIP_wouldblock (WSAGetLastError()==WSAEWOULDBLOCK)
 #else
 #include <sys/types.h>
 #include <sys/socket.h>
 #include <sys/ioctl.h>
+#include <sys/time.h>
 #include <netdb.h>
 #include <unistd.h>
 #include <errno.h>
@@ -36,19 +40,142 @@
 #define SOCKET int
 #define closesocket close
 #define TCPIP_error errno
+#define TCPIP_wouldblock (errno==EAGAIN || errno==EWOULDBLOCK || errno==EINTR)
 #define SD_BOTH SHUT_RDWR
 #define ioctlsocket ioctl
+#include <sys/un.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <termios.h>
+#ifndef SCONSOLE_NOPTY
+#if defined(__APPLE__) || defined(__NetBSD__) || defined(__OpenBSD__)
+#include <util.h>
+#elif defined(__FreeBSD__)
+#include <libutil.h>
+#else
+#include <pty.h>
+#endif
+#endif
+#include <sys/select.h>
+#ifdef __linux__
+#include <sys/epoll.h>
+#define SCONSOLE_EPOLL
+#endif
+#endif
+
+#ifndef MSG_NOSIGNAL
+#define MSG_NOSIGNAL 0
 #endif
 
+/* All sockets are nonblocking. poll_socket_ports() is called from the
+   emulation loop and does all the waiting: it accepts new clients, reads
+   their input into rx_buffers and notices disconnects. The guest keeps
+   running while a port has no client; its output is then kept in a bounded
+   replay ring and sent to the next client that attaches.
+   On Linux the sockets are watched with epoll, elsewhere with select().
+
+   Each port has a backend selected by port_specs[port] before init:
+     NULL or "tcp"  listen on TCP port BASE_PORT+port
+     "unix:path"    listen on a Unix domain socket
+     "pty"          create a pseudo-terminal, always connected
+     "fd:n"         use an already open descriptor (socket, pipe or tty)
+   The last three are not available on Windows, pty also not when built
+   with SCONSOLE_NOPTY (no openpty() library). For pty and fd ports
+   client_sockets holds a plain descriptor that is accessed with
+   read()/write(), and there is no listening socket. */
+
 // MAX_SOCKET_PORTS and BASE_PORT needs to be defined
 SOCKET listen_sockets[MAX_SOCKET_PORTS];
 SOCKET client_sockets[MAX_SOCKET_PORTS];
+char *port_specs[MAX_SOCKET_PORTS];
+int port_instance = 0; // >0 in a forked clone: own TCP ports and socket paths
+int fd_ports[MAX_SOCKET_PORTS]; // client is not a socket, use read/write
+#ifndef _WIN32
+int pty_slaves[MAX_SOCKET_PORTS]; // kept open so the master never sees a hangup
+char unix_paths[MAX_SOCKET_PORTS][sizeof(((struct sockaddr_un*)0)->sun_path)];
+#endif
+
+#define RX_BUFFER_SIZE 256
+uint8_t rx_buffers[MAX_SOCKET_PORTS][RX_BUFFER_SIZE];
+int rx_head[MAX_SOCKET_PORTS];
+int rx_count[MAX_SOCKET_PORTS];
+
+/* Transmitted bytes are coalesced per port and sent in one go when the buffer
+   fills up, when the guest has not sent anything for TX_IDLE_CYCLES, or when
+   the oldest pending byte is older than tx_latency emulated cycles.
+   The guest is never held up by a slow client: when its socket is full the
+   output stays in a backlog that grows up to TX_BACKLOG_MAX, and the port is
+   watched for writability instead of being retried. Only once the client has
+   taken nothing for TX_STALL_MS of wall time, checked between CPU slices,
+   does the port count as stalled; further output is then dropped, and
+   counted, until the client reads again. */
+#define TX_BUFFER_SIZE 4096	/* initial size of the backlog */
+#define TX_BACKLOG_MAX (1 << 20)
+#define TX_FLUSH_THRESHOLD 1024
+#define TX_IDLE_CYCLES 10000
+#define TX_STALL_MS 1000
+uint8_t *tx_buffers[MAX_SOCKET_PORTS];
+int tx_size[MAX_SOCKET_PORTS];
+int tx_count[MAX_SOCKET_PORTS];
+unsigned long tx_idle[MAX_SOCKET_PORTS];
+unsigned long tx_age[MAX_SOCKET_PORTS];
+unsigned long tx_latency = 0;
+int tx_active = 0; // something was transmitted since the last update_tx_socket_ports
+int tx_blocked[MAX_SOCKET_PORTS]; // the client's socket is full, wait until it is writable
+unsigned long tx_blocked_since[MAX_SOCKET_PORTS]; // wall ms of the last progress while blocked
+int tx_stalled[MAX_SOCKET_PORTS];
+unsigned long long tx_dropped[MAX_SOCKET_PORTS];
+
+#define REPLAY_BUFFER_SIZE 16384
+uint8_t replay_buffers[MAX_SOCKET_PORTS][REPLAY_BUFFER_SIZE];
+int replay_head[MAX_SOCKET_PORTS];
+int replay_count[MAX_SOCKET_PORTS];
+unsigned long long replay_dropped[MAX_SOCKET_PORTS]; // oldest bytes pushed out of the ring
+
+#ifdef SCONSOLE_EPOLL
+#define EPOLL_LISTEN 0x100 // tag for listening sockets, ORed with the port number
+int epoll_fd = -1;
+
+void epoll_watch(int op, SOCKET s, uint32_t events, uint32_t tag) {
+	struct epoll_event ev;
+	memset(&ev, 0, sizeof(ev));
+	ev.events = events;
+	ev.data.u32 = tag;
+	epoll_ctl(epoll_fd, op, s, &ev);
+}
+
+// input while there is room for it, output while a send would block
+void epoll_watch_client(int port) {
+	epoll_watch(EPOLL_CTL_MOD, client_sockets[port],
+		(rx_count[port] < RX_BUFFER_SIZE ? EPOLLIN : 0) | (tx_blocked[port] ? EPOLLOUT : 0), port);
+}
+#endif
+
+unsigned long sconsole_ms() {
+#ifdef _WIN32
+	return GetTickCount();
+#else
+	struct timeval tv;
+	gettimeofday(&tv, NULL);
+	return tv.tv_sec * 1000UL + tv.tv_usec / 1000;
+#endif
+}
 
 int init_TCPIP() {
 	int i;
 	for (i=0;i<MAX_SOCKET_PORTS;i++) {
 		client_sockets[i] = INVALID_SOCKET;
 		listen_sockets[i] = INVALID_SOCKET;
+		fd_ports[i] = 0;
+#ifndef _WIN32
+		pty_slaves[i] = -1;
+		unix_paths[i][0] = 0;
+#endif
+		rx_head[i] = rx_count[i] = 0;
+		replay_head[i] = replay_count[i] = 0;
+		tx_count[i] = 0;
+		tx_age[i] = 0;
+		tx_blocked[i] = tx_stalled[i] = 0;
 	}
 #ifdef _WIN32
 	int e;
@@ -57,6 +184,12 @@ int init_TCPIP() {
 		printf("Serial: WSAStartup err %d\n", e);
 		return -1;
 	}
+#endif
+#ifdef SCONSOLE_EPOLL
+	if ((epoll_fd = epoll_create(MAX_SOCKET_PORTS*2)) < 0) {
+		printf("Serial: epoll_create err %d\n", errno);
+		return -1;
+	}
 #endif
 	return 0;
 }
@@ -65,9 +198,31 @@ void shutdown_TCPIP() {
 #ifdef _WIN32
 	WSACleanup();
 #endif
+#ifdef SCONSOLE_EPOLL
+	if (epoll_fd >= 0) {
+		close(epoll_fd);
+		epoll_fd = -1;
+	}
+#endif
 }
 
-int init_socket_port(int port) {
+int listen_socket_port(int port) {
+	unsigned long mode = 1;
+
+	if (listen(listen_sockets[port], SOMAXCONN) == SOCKET_ERROR) {
+		printf("Serial: listen err %d\n", TCPIP_error);
+		closesocket(listen_sockets[port]);
+		listen_sockets[port] = INVALID_SOCKET;
+		return -1;
+	}
+	ioctlsocket(listen_sockets[port], FIONBIO, &mode); // nonblocking accept
+#ifdef SCONSOLE_EPOLL
+	epoll_watch(EPOLL_CTL_ADD, listen_sockets[port], EPOLLIN, EPOLL_LISTEN|port);
+#endif
+	return 0;
+}
+
+int init_tcp_socket_port(int port) {
 
 	struct addrinfo *res = NULL;
 	struct addrinfo h;
@@ -80,7 +235,7 @@ int init_socket_port(int port) {
 	h.ai_protocol = IPPROTO_TCP;
 	h.ai_flags = AI_PASSIVE;
 
-	sprintf(port_str,"%d",BASE_PORT+port);
+	sprintf(port_str,"%d",BASE_PORT+port+port_instance*MAX_SOCKET_PORTS);
 	if ( (e = getaddrinfo(NULL, port_str, &h, &res)) != 0 ) {
 		printf("Serial: getaddrinfo err %d\n", e);
 		return -1;
@@ -99,49 +254,385 @@ int init_socket_port(int port) {
 		printf("Serial: bind err %d\n", TCPIP_error);
 		freeaddrinfo(res);
 		closesocket(listen_sockets[port]);
+		listen_sockets[port] = INVALID_SOCKET;
 		return -1;
 	}
 	freeaddrinfo(res);
 
-	if (listen(listen_sockets[port], SOMAXCONN) == SOCKET_ERROR) {
-		printf("Serial: listen err %d\n", TCPIP_error);
+	if (listen_socket_port(port)) return -1;
+
+	printf("Serial port %d listening on %s\n", port, port_str);
+	return 0;
+}
+
+#ifndef _WIN32
+int init_unix_socket_port(int port, char *path) {
+
+	struct sockaddr_un a;
+
+	memset(&a, 0, sizeof(a));
+	a.sun_family = AF_UNIX;
+	if (strlen(path) >= sizeof(a.sun_path)) {
+		printf("Serial: socket path too long: %s\n", path);
+		return -1;
+	}
+	strcpy(a.sun_path, path);
+
+	listen_sockets[port] = socket(AF_UNIX, SOCK_STREAM, 0);
+	if (listen_sockets[port] == INVALID_SOCKET) {
+		printf("Serial: socket err %d\n", TCPIP_error);
+		return -1;
+	}
+	unlink(path); // stale socket from a previous run
+	if (bind( listen_sockets[port], (struct sockaddr*)&a, sizeof(a)) == SOCKET_ERROR) {
+		printf("Serial: bind err %d\n", TCPIP_error);
 		closesocket(listen_sockets[port]);
+		listen_sockets[port] = INVALID_SOCKET;
 		return -1;
 	}
+	strcpy(unix_paths[port], path);
 
-	printf("Serial port %d listening on %s\n", port, port_str);
+	if (listen_socket_port(port)) return -1;
+
+	printf("Serial port %d listening on %s\n", port, path);
 	return 0;
 }
 
-int open_socket_port(int port) {
-	
-	if (client_sockets[port] != INVALID_SOCKET) {
-	   printf("Serial port %d connection lost\n", port);
-	   closesocket(client_sockets[port]);
+// use fd as an always connected client
+void attach_fd_socket_port(int port, int fd) {
+	struct stat st;
+
+	fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+	fd_ports[port] = !(fstat(fd, &st) == 0 && S_ISSOCK(st.st_mode));
+	client_sockets[port] = fd;
+#ifdef SCONSOLE_EPOLL
+	epoll_watch(EPOLL_CTL_ADD, fd, EPOLLIN, port);
+#endif
+}
+
+#ifndef SCONSOLE_NOPTY
+int init_pty_socket_port(int port) {
+
+	int master, slave;
+	char name[64];
+	struct termios t;
+
+	if (openpty(&master, &slave, name, NULL, NULL) < 0) {
+		printf("Serial: openpty err %d\n", errno);
+		return -1;
 	}
+	// pass bytes through unchanged in both directions
+	tcgetattr(slave, &t);
+	cfmakeraw(&t);
+	tcsetattr(slave, TCSANOW, &t);
+	pty_slaves[port] = slave;
+	attach_fd_socket_port(port, master);
+
+	printf("Serial port %d on %s\n", port, name);
+	return 0;
+}
+#endif
+
+int init_fd_socket_port(int port, int fd) {
+
+	if (fcntl(fd, F_GETFL) < 0) {
+		printf("Serial: fd %d is not open\n", fd);
+		return -1;
+	}
+	attach_fd_socket_port(port, fd);
+
+	printf("Serial port %d on fd %d\n", port, fd);
+	return 0;
+}
+#endif
+
+int init_socket_port(int port) {
+	char *spec = port_specs[port];
+
+	if (!spec || strcmp(spec,"tcp")==0)
+		return init_tcp_socket_port(port);
+#ifndef _WIN32
+	if (strncmp(spec,"unix:",5)==0) {
+		char path[sizeof(unix_paths[0])];
+		if (!port_instance)
+			return init_unix_socket_port(port, &spec[5]);
+		snprintf(path, sizeof(path), "%s.%d", &spec[5], port_instance);
+		return init_unix_socket_port(port, path);
+	}
+#ifndef SCONSOLE_NOPTY
+	if (strcmp(spec,"pty")==0)
+		return init_pty_socket_port(port);
+#endif
+	if (strncmp(spec,"fd:",3)==0) {
+		if (port_instance) // the descriptor belongs to the parent
+			return init_tcp_socket_port(port);
+		return init_fd_socket_port(port, atoi(&spec[3]));
+	}
+#endif
+	printf("Serial port %d: unsupported backend %s\n", port, spec);
+	return -1;
+}
+
+int recv_socket_port(int port, uint8_t *buf, int len) {
+	int n;
+	HOSTPROF_ENTER(HP_SOCKET);
+#ifndef _WIN32
+	if (fd_ports[port]) n = read(client_sockets[port], buf, len);
+	else
+#endif
+	n = recv(client_sockets[port], (char*)buf, len, 0);
+	HOSTPROF_LEAVE();
+	return n;
+}
+
+int send_socket_port(int port, uint8_t *buf, int len) {
+	int n;
+	HOSTPROF_ENTER(HP_SOCKET);
+#ifndef _WIN32
+	if (fd_ports[port]) n = write(client_sockets[port], buf, len);
+	else
+#endif
+	n = send(client_sockets[port], (char*)buf, len, MSG_NOSIGNAL);
+	HOSTPROF_LEAVE();
+	return n;
+}
 
+void close_client_socket_port(int port) {
+
+	if (client_sockets[port] == INVALID_SOCKET) return;
+
+	printf("Serial port %d connection lost\n", port);
+#ifdef SCONSOLE_EPOLL
+	epoll_watch(EPOLL_CTL_DEL, client_sockets[port], 0, port);
+	if (listen_sockets[port] != INVALID_SOCKET) // take the next client
+		epoll_watch(EPOLL_CTL_MOD, listen_sockets[port], EPOLLIN, EPOLL_LISTEN|port);
+#endif
+	closesocket(client_sockets[port]);
 	client_sockets[port] = INVALID_SOCKET;
-	client_sockets[port] = accept(listen_sockets[port], NULL, NULL);
-	if (listen_sockets[port]!= INVALID_SOCKET ) {  // don't complain when shutting down
-		if (client_sockets[port] == INVALID_SOCKET) {
-			printf("Serial: accept err %d\n", TCPIP_error);
-			//closesocket(listen_sockets[port]);
+	fd_ports[port] = 0;
+	rx_head[port] = rx_count[port] = 0;
+	tx_count[port] = 0; // drop output nobody is going to read
+	tx_age[port] = 0;
+	tx_blocked[port] = tx_stalled[port] = 0;
+}
+
+void replay_socket_port(int port);
+
+int open_socket_port(int port) {
+
+	SOCKET s;
+	unsigned long mode = 1;
+
+	s = accept(listen_sockets[port], NULL, NULL);
+	if (s == INVALID_SOCKET) {
+		if (TCPIP_wouldblock) return 0; // client went away before we got to it
+		printf("Serial: accept err %d\n", TCPIP_error);
+		return -1;
+	}
+	ioctlsocket(s, FIONBIO, &mode); // nonblocking
+	client_sockets[port] = s;
+	rx_head[port] = rx_count[port] = 0;
+	tx_count[port] = 0;
+	tx_age[port] = 0;
+	tx_blocked[port] = tx_stalled[port] = 0;
+#ifdef SCONSOLE_EPOLL
+	epoll_watch(EPOLL_CTL_ADD, s, EPOLLIN, port);
+	epoll_watch(EPOLL_CTL_MOD, listen_sockets[port], 0, EPOLL_LISTEN|port); // one client per port
+#endif
+	printf("Serial port %d connected\n",port);
+	replay_socket_port(port);
+	return 0;
+}
+
+// move pending input into the rx buffer; returns -1 if the client has gone
+int read_socket_port(int port) {
+	int n, tail, room;
+
+	while (rx_count[port] < RX_BUFFER_SIZE) {
+		tail = (rx_head[port] + rx_count[port]) % RX_BUFFER_SIZE;
+		room = tail >= rx_head[port] ? RX_BUFFER_SIZE - tail : rx_head[port] - tail;
+		n = recv_socket_port(port, &rx_buffers[port][tail], room);
+		if (n == 0 || (n < 0 && !TCPIP_wouldblock)) {
+			close_client_socket_port(port);
 			return -1;
 		}
-		unsigned long mode = 1;
-		ioctlsocket(client_sockets[port], FIONBIO, &mode); // nonblocking
-		printf("Serial port %d connected\n",port);
+		if (n < 0) break;
+		rx_count[port] += n;
+		if (n < room) break;
 	}
+#ifdef SCONSOLE_EPOLL
+	if (rx_count[port] == RX_BUFFER_SIZE) // stop polling until the guest catches up
+		epoll_watch_client(port);
+#endif
+	return 0;
+}
+
+// wait up to timeout ms for socket events and process them; returns the number of events
+int flush_socket_port(int port);
+
+int poll_socket_ports(int timeout) {
+	int i, port, n;
+#ifdef SCONSOLE_EPOLL
+	struct epoll_event ev[MAX_SOCKET_PORTS*2];
+
+	HOSTPROF_TIME(HP_SOCKET, n = epoll_wait(epoll_fd, ev, MAX_SOCKET_PORTS*2, timeout));
+	for (i=0;i<n;i++)
+	{
+		port = ev[i].data.u32 & 0xff;
+		if (ev[i].data.u32 & EPOLL_LISTEN) {
+			if (client_sockets[port] == INVALID_SOCKET) open_socket_port(port);
+		}
+		else if (client_sockets[port] != INVALID_SOCKET) {
+			if (ev[i].events & EPOLLOUT) // the client takes output again
+				flush_socket_port(port);
+			if (client_sockets[port] != INVALID_SOCKET && (ev[i].events & ~EPOLLOUT)
+				&& read_socket_port(port) == 0 && (ev[i].events & (EPOLLHUP|EPOLLERR)))
+				close_client_socket_port(port);
+		}
+	}
+	return n < 0 ? 0 : n;
+#else
+	fd_set rfds, wfds;
+	struct timeval tv;
+	SOCKET maxfd = 0;
+
+	FD_ZERO(&rfds);
+	FD_ZERO(&wfds);
+	for (i=0;i<MAX_SOCKET_PORTS;i++)
+	{
+		if (client_sockets[i] != INVALID_SOCKET) {
+			if (tx_blocked[i]) FD_SET(client_sockets[i], &wfds);
+			if (rx_count[i] < RX_BUFFER_SIZE) FD_SET(client_sockets[i], &rfds);
+			if (client_sockets[i] > maxfd) maxfd = client_sockets[i];
+		}
+		else if (listen_sockets[i] != INVALID_SOCKET) {
+			FD_SET(listen_sockets[i], &rfds);
+			if (listen_sockets[i] > maxfd) maxfd = listen_sockets[i];
+		}
+	}
+	tv.tv_sec = timeout / 1000;
+	tv.tv_usec = (timeout % 1000) * 1000;
+	HOSTPROF_TIME(HP_SOCKET, n = select(maxfd+1, &rfds, &wfds, NULL, &tv));
+	if (n <= 0) return 0;
+	for (port=0;port<MAX_SOCKET_PORTS;port++)
+	{
+		if (client_sockets[port] != INVALID_SOCKET) {
+			if (FD_ISSET(client_sockets[port], &wfds)) flush_socket_port(port);
+			if (client_sockets[port] != INVALID_SOCKET && FD_ISSET(client_sockets[port], &rfds))
+				read_socket_port(port);
+		}
+		else if (listen_sockets[port] != INVALID_SOCKET && FD_ISSET(listen_sockets[port], &rfds))
+			open_socket_port(port);
+	}
+	return n;
+#endif
+}
+
+// true when every listening port has a client
+int all_connected_socket_ports() {
+	int i;
+	for (i=0;i<MAX_SOCKET_PORTS;i++)
+		if (listen_sockets[i] != INVALID_SOCKET && client_sockets[i] == INVALID_SOCKET)
+			return 0;
+	return 1;
+}
+
+// a full socket is polled for writability instead of retried
+void block_tx_socket_port(int port, int blocked) {
+	if (tx_blocked[port] == blocked || client_sockets[port] == INVALID_SOCKET)
+		return;
+	tx_blocked[port] = blocked;
+	tx_blocked_since[port] = sconsole_ms();
+#ifdef SCONSOLE_EPOLL
+	epoll_watch_client(port);
+#endif
+}
+
+// make room for more output, up to TX_BACKLOG_MAX
+int grow_tx_socket_port(int port) {
+	int size = tx_size[port] ? 2 * tx_size[port] : TX_BUFFER_SIZE;
+	uint8_t *b;
+	if (size > TX_BACKLOG_MAX || !(b = realloc(tx_buffers[port], size)))
+		return -1;
+	tx_buffers[port] = b;
+	tx_size[port] = size;
 	return 0;
 }
 
+int flush_socket_port(int port) {
+	int n, sent = 0;
+
+	if (client_sockets[port] == INVALID_SOCKET) {
+		tx_count[port] = 0;
+	}
+	while (sent < tx_count[port]) {
+		n = send_socket_port(port, &tx_buffers[port][sent], tx_count[port]-sent);
+		if (n < 0 && !TCPIP_wouldblock) {
+			close_client_socket_port(port);
+			return sent;
+		}
+		if (n <= 0) break; // socket buffer full; keep the rest for later
+		sent += n;
+	}
+	if (sent) {
+		memmove(tx_buffers[port], &tx_buffers[port][sent], tx_count[port]-sent);
+		tx_count[port] -= sent;
+		tx_blocked_since[port] = sconsole_ms();
+		tx_stalled[port] = 0;
+	}
+	block_tx_socket_port(port, tx_count[port] != 0);
+	if (!tx_count[port]) tx_age[port] = 0;
+	return sent;
+}
+
+// call periodically with the number of emulated cycles elapsed since the last call;
+// returns nonzero if the guest transmitted anything in the meantime
+int update_tx_socket_ports(unsigned long cycles) {
+	int i, active = tx_active;
+	for (i=0;i<MAX_SOCKET_PORTS;i++)
+	{
+		if (tx_count[i]) {
+			tx_age[i] += cycles;
+			tx_idle[i] += cycles;
+			if (tx_blocked[i]) {
+				// sent when the client becomes writable; give up on it after a while
+				if (!tx_stalled[i] && sconsole_ms() - tx_blocked_since[i] >= TX_STALL_MS)
+					tx_stalled[i] = 1;
+			}
+			else if (tx_idle[i] >= TX_IDLE_CYCLES || tx_age[i] >= tx_latency)
+				flush_socket_port(i);
+		}
+	}
+	tx_active = 0;
+	return active;
+}
+
+// emulated cycles until update_tx_socket_ports has to flush some port
+unsigned long next_tx_deadline_socket_ports() {
+	int i;
+	unsigned long d, deadline = ULONG_MAX;
+	for (i=0;i<MAX_SOCKET_PORTS;i++)
+	{
+		if (tx_count[i] && !tx_blocked[i]) {
+			d = tx_age[i] < tx_latency ? tx_latency - tx_age[i] : 0;
+			if (deadline > d) deadline = d;
+			d = tx_idle[i] < TX_IDLE_CYCLES ? TX_IDLE_CYCLES - tx_idle[i] : 0;
+			if (deadline > d) deadline = d;
+		}
+	}
+	return deadline;
+}
+
 void shutdown_socket_ports() {
 
 	int i;
 	for (i=0;i<MAX_SOCKET_PORTS;i++) 
 	{
 		if (client_sockets[i] != INVALID_SOCKET) {
-			shutdown(client_sockets[i], SD_BOTH);
+			flush_socket_port(i);
+		}
+		if (client_sockets[i] != INVALID_SOCKET) {
+			if (!fd_ports[i]) shutdown(client_sockets[i], SD_BOTH);
 			closesocket(client_sockets[i]);
 			client_sockets[i] = INVALID_SOCKET;
 		}
@@ -150,27 +641,95 @@ void shutdown_socket_ports() {
 			closesocket(listen_sockets[i]);
 			listen_sockets[i] = INVALID_SOCKET;
 		}
+#ifndef _WIN32
+		if (pty_slaves[i] >= 0) {
+			close(pty_slaves[i]);
+			pty_slaves[i] = -1;
+		}
+		if (unix_paths[i][0]) {
+			unlink(unix_paths[i]);
+			unix_paths[i][0] = 0;
+		}
+#endif
 	}
 	shutdown_TCPIP();
 }
 
+#ifndef _WIN32
+// in a forked child: let go of the parent's descriptors without disturbing
+// its clients and start over, so init_socket_port() can open new ports
+void release_socket_ports() {
+
+	int i;
+	for (i=0;i<MAX_SOCKET_PORTS;i++)
+	{
+		if (client_sockets[i] != INVALID_SOCKET)
+			close(client_sockets[i]);
+		if (listen_sockets[i] != INVALID_SOCKET)
+			close(listen_sockets[i]);
+		if (pty_slaves[i] >= 0)
+			close(pty_slaves[i]);
+	}
+#ifdef SCONSOLE_EPOLL
+	close(epoll_fd);
+	epoll_fd = -1;
+#endif
+	init_TCPIP();
+}
+#endif
+
 int char_available_socket_port(int port) {
-	  unsigned long iMode = 0;
-	  ioctlsocket(client_sockets[port], FIONREAD, &iMode);
-	  return iMode!=0;
+	  return rx_count[port]!=0;
 }
 
 int is_connected_socket_port(int port) {
-	char buf;
-	  return client_sockets[port] != INVALID_SOCKET && recv(client_sockets[port], &buf, 1, MSG_PEEK)!=0;
+	  return client_sockets[port] != INVALID_SOCKET;
 }
 
 void tx_socket_port(int port, uint8_t data) {
-	send( client_sockets[port], (char*)&data, 1, 0 );
+	if (client_sockets[port] == INVALID_SOCKET) {
+		// no client, keep the most recent output for the next one
+		replay_buffers[port][(replay_head[port] + replay_count[port]) % REPLAY_BUFFER_SIZE] = data;
+		if (replay_count[port] < REPLAY_BUFFER_SIZE)
+			replay_count[port]++;
+		else {
+			replay_head[port] = (replay_head[port] + 1) % REPLAY_BUFFER_SIZE;
+			replay_dropped[port]++;
+		}
+		return;
+	}
+	if (tx_stalled[port] || (tx_count[port] == tx_size[port] && grow_tx_socket_port(port) < 0)) {
+		tx_dropped[port]++; // the client hasn't read for a while
+		return;
+	}
+	tx_buffers[port][tx_count[port]++] = data;
+	tx_idle[port] = 0;
+	tx_active = 1;
+	if (tx_count[port] >= TX_FLUSH_THRESHOLD && !tx_blocked[port])
+		flush_socket_port(port);
+}
+
+// send the output collected while the port had no client
+void replay_socket_port(int port) {
+	while (replay_count[port] && client_sockets[port] != INVALID_SOCKET) {
+		tx_socket_port(port, replay_buffers[port][replay_head[port]]);
+		replay_head[port] = (replay_head[port] + 1) % REPLAY_BUFFER_SIZE;
+		replay_count[port]--;
+	}
+	flush_socket_port(port);
 }
 
 int rx_socket_port(int port) {
 	int data = 0;
-	recv( client_sockets[port], (char*)&data, 1, 0);
+	if (rx_count[port]) {
+		data = rx_buffers[port][rx_head[port]];
+		rx_head[port] = (rx_head[port] + 1) % RX_BUFFER_SIZE;
+#ifdef SCONSOLE_EPOLL
+		if (rx_count[port]-- == RX_BUFFER_SIZE) // room again, resume polling
+			epoll_watch_client(port);
+#else
+		rx_count[port]--;
+#endif
+	}
 	return data;
 }
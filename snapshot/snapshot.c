@@ -0,0 +1,596 @@
+/*
+ * snapshot.c - Implementation of machine snapshot files.
+ *
+ * Modeled on the VICE snapshot module API, so that the snapshot code
+ * of modules taken from VICE can be used unchanged.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+
+/* Snapshot file format:
+
+   type   | name         | description
+   -------------------------------------
+   ARRAY  | magic        | "Z280EMU Snapshot\032" (17 BYTES)
+   BYTE   | major        | file format major version
+   BYTE   | minor        | file format minor version
+   ARRAY  | machine      | 16 BYTES machine name, zero padded
+
+   followed by any number of modules, each starting with
+
+   ARRAY  | name         | 16 BYTES module name, zero padded
+   BYTE   | major        | module major version
+   BYTE   | minor        | module minor version
+   DWORD  | size         | module size including this header
+
+   All values are little endian.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "snapshot.h"
+
+static const char snapshot_magic_string[] = "Z280EMU Snapshot\032";
+
+#define SNAPSHOT_MAGIC_LEN              17
+#define SNAPSHOT_MODULE_HEADER_LEN      (SNAPSHOT_MODULE_NAME_LEN + 6)
+
+struct snapshot_s {
+    FILE *file;
+    long first_module_offset;   /* file offset of the first module */
+    int write_mode;
+};
+
+struct snapshot_module_s {
+    FILE *file;
+    long offset;                /* file offset of the module header */
+    uint32_t size;              /* size including the header */
+    int write_mode;
+};
+
+static int current_error = SNAPSHOT_NO_ERROR;
+
+void snapshot_set_error(int error)
+{
+    current_error = error;
+}
+
+int snapshot_get_error(void)
+{
+    return current_error;
+}
+
+const char *snapshot_error_string(int error)
+{
+    switch (error) {
+        case SNAPSHOT_NO_ERROR:
+            return "no error";
+        case SNAPSHOT_WRITE_EOF_ERROR:
+        case SNAPSHOT_WRITE_BYTE_ARRAY_ERROR:
+        case SNAPSHOT_CANNOT_WRITE_SNAPSHOT_ERROR:
+            return "cannot write snapshot file";
+        case SNAPSHOT_READ_EOF_ERROR:
+        case SNAPSHOT_READ_BYTE_ARRAY_ERROR:
+            return "unexpected end of snapshot file";
+        case SNAPSHOT_ILLEGAL_STRING_LENGTH_ERROR:
+            return "illegal string length";
+        case SNAPSHOT_READ_OUT_OF_BOUNDS_ERROR:
+            return "read past the end of a module";
+        case SNAPSHOT_CANNOT_CREATE_SNAPSHOT_ERROR:
+            return "cannot create snapshot file";
+        case SNAPSHOT_CANNOT_OPEN_FOR_READ_ERROR:
+            return "cannot open snapshot file";
+        case SNAPSHOT_MAGIC_STRING_MISMATCH_ERROR:
+            return "not a snapshot file";
+        case SNAPSHOT_MACHINE_MISMATCH_ERROR:
+            return "snapshot is for a different machine";
+        case SNAPSHOT_MODULE_HEADER_READ_ERROR:
+            return "bad module header";
+        case SNAPSHOT_MODULE_NOT_FOUND_ERROR:
+            return "module not found";
+        case SNAPSHOT_MODULE_HIGHER_VERSION:
+            return "module version is too new";
+        case SNAPSHOT_MODULE_INCOMPATIBLE:
+            return "module does not match this configuration";
+    }
+    return "unknown error";
+}
+
+/* ------------------------------------------------------------------------- */
+
+static int snapshot_write_byte(FILE *f, uint8_t data)
+{
+    if (fputc(data, f) == EOF) {
+        snapshot_set_error(SNAPSHOT_WRITE_EOF_ERROR);
+        return -1;
+    }
+    return 0;
+}
+
+static int snapshot_write_word(FILE *f, uint16_t data)
+{
+    if (snapshot_write_byte(f, (uint8_t)(data & 0xff)) < 0
+        || snapshot_write_byte(f, (uint8_t)(data >> 8)) < 0) {
+        return -1;
+    }
+    return 0;
+}
+
+static int snapshot_write_dword(FILE *f, uint32_t data)
+{
+    if (snapshot_write_word(f, (uint16_t)(data & 0xffff)) < 0
+        || snapshot_write_word(f, (uint16_t)(data >> 16)) < 0) {
+        return -1;
+    }
+    return 0;
+}
+
+static int snapshot_write_padded_string(FILE *f, const char *s, int len)
+{
+    int i, found_zero = 0;
+
+    for (i = 0; i < len; i++) {
+        uint8_t c = found_zero ? 0 : (uint8_t)s[i];
+
+        if (c == 0) {
+            found_zero = 1;
+        }
+        if (snapshot_write_byte(f, c) < 0) {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+static int snapshot_read_byte(FILE *f, uint8_t *b_return)
+{
+    int c = fgetc(f);
+
+    if (c == EOF) {
+        snapshot_set_error(SNAPSHOT_READ_EOF_ERROR);
+        return -1;
+    }
+    *b_return = (uint8_t)c;
+    return 0;
+}
+
+static int snapshot_read_word(FILE *f, uint16_t *w_return)
+{
+    uint8_t lo, hi;
+
+    if (snapshot_read_byte(f, &lo) < 0 || snapshot_read_byte(f, &hi) < 0) {
+        return -1;
+    }
+    *w_return = lo | (hi << 8);
+    return 0;
+}
+
+static int snapshot_read_dword(FILE *f, uint32_t *dw_return)
+{
+    uint16_t lo, hi;
+
+    if (snapshot_read_word(f, &lo) < 0 || snapshot_read_word(f, &hi) < 0) {
+        return -1;
+    }
+    *dw_return = lo | ((uint32_t)hi << 16);
+    return 0;
+}
+
+/* ------------------------------------------------------------------------- */
+
+/* Reads must not run past the end of the module being read */
+static int snapshot_module_check(snapshot_module_t *m, unsigned int num)
+{
+    if (ftell(m->file) + (long)num > m->offset + (long)m->size) {
+        snapshot_set_error(SNAPSHOT_READ_OUT_OF_BOUNDS_ERROR);
+        return -1;
+    }
+    return 0;
+}
+
+int snapshot_module_write_byte(snapshot_module_t *m, uint8_t data)
+{
+    if (snapshot_write_byte(m->file, data) < 0) {
+        return -1;
+    }
+    m->size++;
+    return 0;
+}
+
+int snapshot_module_write_word(snapshot_module_t *m, uint16_t data)
+{
+    if (snapshot_write_word(m->file, data) < 0) {
+        return -1;
+    }
+    m->size += 2;
+    return 0;
+}
+
+int snapshot_module_write_dword(snapshot_module_t *m, uint32_t data)
+{
+    if (snapshot_write_dword(m->file, data) < 0) {
+        return -1;
+    }
+    m->size += 4;
+    return 0;
+}
+
+int snapshot_module_write_qword(snapshot_module_t *m, uint64_t data)
+{
+    if (snapshot_module_write_dword(m, (uint32_t)(data & 0xffffffff)) < 0
+        || snapshot_module_write_dword(m, (uint32_t)(data >> 32)) < 0) {
+        return -1;
+    }
+    return 0;
+}
+
+int snapshot_module_write_byte_array(snapshot_module_t *m, const uint8_t *data, unsigned int num)
+{
+    if (fwrite(data, 1, num, m->file) != num) {
+        snapshot_set_error(SNAPSHOT_WRITE_BYTE_ARRAY_ERROR);
+        return -1;
+    }
+    m->size += num;
+    return 0;
+}
+
+int snapshot_module_write_word_array(snapshot_module_t *m, const uint16_t *data, unsigned int num)
+{
+    unsigned int i;
+
+    for (i = 0; i < num; i++) {
+        if (snapshot_module_write_word(m, data[i]) < 0) {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+int snapshot_module_write_dword_array(snapshot_module_t *m, const uint32_t *data, unsigned int num)
+{
+    unsigned int i;
+
+    for (i = 0; i < num; i++) {
+        if (snapshot_module_write_dword(m, data[i]) < 0) {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+/* Strings are stored as a WORD length (including the terminating zero)
+   followed by the characters */
+int snapshot_module_write_string(snapshot_module_t *m, const char *s)
+{
+    size_t len = s ? strlen(s) + 1 : 0;
+
+    if (len > 0xffff) {
+        snapshot_set_error(SNAPSHOT_ILLEGAL_STRING_LENGTH_ERROR);
+        return -1;
+    }
+    if (snapshot_module_write_word(m, (uint16_t)len) < 0
+        || (len && snapshot_module_write_byte_array(m, (const uint8_t *)s, (unsigned int)len) < 0)) {
+        return -1;
+    }
+    return 0;
+}
+
+int snapshot_module_read_byte(snapshot_module_t *m, uint8_t *b_return)
+{
+    if (snapshot_module_check(m, 1) < 0) {
+        return -1;
+    }
+    return snapshot_read_byte(m->file, b_return);
+}
+
+int snapshot_module_read_word(snapshot_module_t *m, uint16_t *w_return)
+{
+    if (snapshot_module_check(m, 2) < 0) {
+        return -1;
+    }
+    return snapshot_read_word(m->file, w_return);
+}
+
+int snapshot_module_read_dword(snapshot_module_t *m, uint32_t *dw_return)
+{
+    if (snapshot_module_check(m, 4) < 0) {
+        return -1;
+    }
+    return snapshot_read_dword(m->file, dw_return);
+}
+
+int snapshot_module_read_qword(snapshot_module_t *m, uint64_t *qw_return)
+{
+    uint32_t lo, hi;
+
+    if (snapshot_module_read_dword(m, &lo) < 0
+        || snapshot_module_read_dword(m, &hi) < 0) {
+        return -1;
+    }
+    *qw_return = lo | ((uint64_t)hi << 32);
+    return 0;
+}
+
+int snapshot_module_read_byte_array(snapshot_module_t *m, uint8_t *b_return, unsigned int num)
+{
+    if (snapshot_module_check(m, num) < 0) {
+        return -1;
+    }
+    if (fread(b_return, 1, num, m->file) != num) {
+        snapshot_set_error(SNAPSHOT_READ_BYTE_ARRAY_ERROR);
+        return -1;
+    }
+    return 0;
+}
+
+int snapshot_module_read_word_array(snapshot_module_t *m, uint16_t *w_return, unsigned int num)
+{
+    unsigned int i;
+
+    for (i = 0; i < num; i++) {
+        if (snapshot_module_read_word(m, w_return + i) < 0) {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+int snapshot_module_read_dword_array(snapshot_module_t *m, uint32_t *dw_return, unsigned int num)
+{
+    unsigned int i;
+
+    for (i = 0; i < num; i++) {
+        if (snapshot_module_read_dword(m, dw_return + i) < 0) {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+/* Allocates the string, which the caller has to free */
+int snapshot_module_read_string(snapshot_module_t *m, char **s)
+{
+    uint16_t len;
+
+    if (snapshot_module_read_word(m, &len) < 0) {
+        return -1;
+    }
+    if (len == 0) {
+        *s = NULL;
+        return 0;
+    }
+    *s = malloc(len);
+    if (*s == NULL || snapshot_module_read_byte_array(m, (uint8_t *)*s, len) < 0) {
+        free(*s);
+        *s = NULL;
+        return -1;
+    }
+    (*s)[len - 1] = 0;
+    return 0;
+}
+
+int snapshot_module_read_byte_into_int(snapshot_module_t *m, int *value_return)
+{
+    uint8_t b;
+
+    if (snapshot_module_read_byte(m, &b) < 0) {
+        return -1;
+    }
+    *value_return = (int)b;
+    return 0;
+}
+
+int snapshot_module_read_word_into_int(snapshot_module_t *m, int *value_return)
+{
+    uint16_t w;
+
+    if (snapshot_module_read_word(m, &w) < 0) {
+        return -1;
+    }
+    *value_return = (int)w;
+    return 0;
+}
+
+int snapshot_module_read_dword_into_int(snapshot_module_t *m, int *value_return)
+{
+    uint32_t dw;
+
+    if (snapshot_module_read_dword(m, &dw) < 0) {
+        return -1;
+    }
+    *value_return = (int)dw;
+    return 0;
+}
+
+/* ------------------------------------------------------------------------- */
+
+snapshot_module_t *snapshot_module_create(snapshot_t *s, const char *name, uint8_t major_version, uint8_t minor_version)
+{
+    snapshot_module_t *m;
+
+    m = malloc(sizeof(snapshot_module_t));
+    if (m == NULL) {
+        return NULL;
+    }
+    m->file = s->file;
+    m->write_mode = 1;
+    m->offset = ftell(s->file);
+    if (m->offset == -1) {
+        snapshot_set_error(SNAPSHOT_CANNOT_WRITE_SNAPSHOT_ERROR);
+        free(m);
+        return NULL;
+    }
+
+    if (snapshot_write_padded_string(s->file, name, SNAPSHOT_MODULE_NAME_LEN) < 0
+        || snapshot_write_byte(s->file, major_version) < 0
+        || snapshot_write_byte(s->file, minor_version) < 0
+        || snapshot_write_dword(s->file, 0) < 0) {
+        free(m);
+        return NULL;
+    }
+    m->size = SNAPSHOT_MODULE_HEADER_LEN;
+    return m;
+}
+
+snapshot_module_t *snapshot_module_open(snapshot_t *s, const char *name, uint8_t *major_version_return, uint8_t *minor_version_return)
+{
+    snapshot_module_t *m;
+    char n[SNAPSHOT_MODULE_NAME_LEN];
+    long offset = s->first_module_offset;
+    uint32_t size;
+
+    m = malloc(sizeof(snapshot_module_t));
+    if (m == NULL) {
+        return NULL;
+    }
+    m->file = s->file;
+    m->write_mode = 0;
+
+    /* search all modules from the start of the file */
+    for (;;) {
+        if (fseek(s->file, offset, SEEK_SET) < 0
+            || fread(n, 1, SNAPSHOT_MODULE_NAME_LEN, s->file) != SNAPSHOT_MODULE_NAME_LEN
+            || snapshot_read_byte(s->file, major_version_return) < 0
+            || snapshot_read_byte(s->file, minor_version_return) < 0
+            || snapshot_read_dword(s->file, &size) < 0) {
+            snapshot_set_error(SNAPSHOT_MODULE_NOT_FOUND_ERROR);
+            goto fail;
+        }
+        if (size < SNAPSHOT_MODULE_HEADER_LEN) {
+            snapshot_set_error(SNAPSHOT_MODULE_HEADER_READ_ERROR);
+            goto fail;
+        }
+        if (strncmp(name, n, SNAPSHOT_MODULE_NAME_LEN) == 0) {
+            break;
+        }
+        offset += size;
+    }
+
+    m->offset = offset;
+    m->size = size;
+    return m;
+
+fail:
+    fseek(s->file, s->first_module_offset, SEEK_SET);
+    free(m);
+    return NULL;
+}
+
+int snapshot_module_close(snapshot_module_t *m)
+{
+    /* backpatch the module size */
+    if (m->write_mode) {
+        if (fseek(m->file, m->offset + SNAPSHOT_MODULE_NAME_LEN + 2, SEEK_SET) < 0
+            || snapshot_write_dword(m->file, m->size) < 0
+            || fseek(m->file, m->offset + m->size, SEEK_SET) < 0) {
+            snapshot_set_error(SNAPSHOT_CANNOT_WRITE_SNAPSHOT_ERROR);
+            free(m);
+            return -1;
+        }
+    }
+    free(m);
+    return 0;
+}
+
+/* ------------------------------------------------------------------------- */
+
+snapshot_t *snapshot_create(const char *filename, uint8_t major_version, uint8_t minor_version, const char *machine_name)
+{
+    FILE *f;
+    snapshot_t *s;
+
+    f = fopen(filename, "wb");
+    if (f == NULL) {
+        snapshot_set_error(SNAPSHOT_CANNOT_CREATE_SNAPSHOT_ERROR);
+        return NULL;
+    }
+
+    if (fwrite(snapshot_magic_string, 1, SNAPSHOT_MAGIC_LEN, f) != SNAPSHOT_MAGIC_LEN
+        || snapshot_write_byte(f, major_version) < 0
+        || snapshot_write_byte(f, minor_version) < 0
+        || snapshot_write_padded_string(f, machine_name, SNAPSHOT_MACHINE_NAME_LEN) < 0) {
+        snapshot_set_error(SNAPSHOT_CANNOT_WRITE_SNAPSHOT_ERROR);
+        fclose(f);
+        remove(filename);
+        return NULL;
+    }
+
+    s = malloc(sizeof(snapshot_t));
+    if (s == NULL) {
+        fclose(f);
+        return NULL;
+    }
+    s->file = f;
+    s->first_module_offset = ftell(f);
+    s->write_mode = 1;
+    return s;
+}
+
+snapshot_t *snapshot_open(const char *filename, uint8_t *major_version_return, uint8_t *minor_version_return, const char *machine_name)
+{
+    FILE *f;
+    snapshot_t *s;
+    char magic[SNAPSHOT_MAGIC_LEN];
+    char read_name[SNAPSHOT_MACHINE_NAME_LEN];
+
+    f = fopen(filename, "rb");
+    if (f == NULL) {
+        snapshot_set_error(SNAPSHOT_CANNOT_OPEN_FOR_READ_ERROR);
+        return NULL;
+    }
+
+    if (fread(magic, 1, SNAPSHOT_MAGIC_LEN, f) != SNAPSHOT_MAGIC_LEN
+        || memcmp(magic, snapshot_magic_string, SNAPSHOT_MAGIC_LEN) != 0) {
+        snapshot_set_error(SNAPSHOT_MAGIC_STRING_MISMATCH_ERROR);
+        goto fail;
+    }
+    if (snapshot_read_byte(f, major_version_return) < 0
+        || snapshot_read_byte(f, minor_version_return) < 0
+        || fread(read_name, 1, SNAPSHOT_MACHINE_NAME_LEN, f) != SNAPSHOT_MACHINE_NAME_LEN) {
+        snapshot_set_error(SNAPSHOT_READ_EOF_ERROR);
+        goto fail;
+    }
+    if (strncmp(machine_name, read_name, SNAPSHOT_MACHINE_NAME_LEN) != 0) {
+        snapshot_set_error(SNAPSHOT_MACHINE_MISMATCH_ERROR);
+        goto fail;
+    }
+
+    s = malloc(sizeof(snapshot_t));
+    if (s == NULL) {
+        goto fail;
+    }
+    s->file = f;
+    s->first_module_offset = ftell(f);
+    s->write_mode = 0;
+    return s;
+
+fail:
+    fclose(f);
+    return NULL;
+}
+
+int snapshot_close(snapshot_t *s)
+{
+    int retval;
+
+    if (!s->write_mode) {
+        retval = fclose(s->file) == EOF ? -1 : 0;
+    } else {
+        retval = (fflush(s->file) == EOF || fclose(s->file) == EOF) ? -1 : 0;
+        if (retval < 0) {
+            snapshot_set_error(SNAPSHOT_CANNOT_WRITE_SNAPSHOT_ERROR);
+        }
+    }
+    free(s);
+    return retval;
+}
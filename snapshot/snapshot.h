@@ -0,0 +1,100 @@
+/*
+ * snapshot.h - Implementation of machine snapshot files.
+ *
+ * Modeled on the VICE snapshot module API, so that the snapshot code
+ * of modules taken from VICE can be used unchanged.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+
+#ifndef Z280EMU_SNAPSHOT_H
+#define Z280EMU_SNAPSHOT_H
+
+#include <stdint.h>
+
+#define SNAPSHOT_MODULE_NAME_LEN        16
+#define SNAPSHOT_MACHINE_NAME_LEN       16
+
+/* error codes, see snapshot_get_error() */
+#define SNAPSHOT_NO_ERROR                       0
+#define SNAPSHOT_WRITE_EOF_ERROR                1
+#define SNAPSHOT_WRITE_BYTE_ARRAY_ERROR         2
+#define SNAPSHOT_READ_EOF_ERROR                 3
+#define SNAPSHOT_READ_BYTE_ARRAY_ERROR          4
+#define SNAPSHOT_ILLEGAL_STRING_LENGTH_ERROR    5
+#define SNAPSHOT_READ_OUT_OF_BOUNDS_ERROR       6
+#define SNAPSHOT_CANNOT_CREATE_SNAPSHOT_ERROR   7
+#define SNAPSHOT_CANNOT_WRITE_SNAPSHOT_ERROR    8
+#define SNAPSHOT_CANNOT_OPEN_FOR_READ_ERROR     9
+#define SNAPSHOT_MAGIC_STRING_MISMATCH_ERROR    10
+#define SNAPSHOT_MACHINE_MISMATCH_ERROR         11
+#define SNAPSHOT_MODULE_HEADER_READ_ERROR       12
+#define SNAPSHOT_MODULE_NOT_FOUND_ERROR         13
+#define SNAPSHOT_MODULE_HIGHER_VERSION          14
+#define SNAPSHOT_MODULE_INCOMPATIBLE            15
+
+typedef struct snapshot_s snapshot_t;
+typedef struct snapshot_module_s snapshot_module_t;
+
+extern int snapshot_module_write_byte(snapshot_module_t *m, uint8_t data);
+extern int snapshot_module_write_word(snapshot_module_t *m, uint16_t data);
+extern int snapshot_module_write_dword(snapshot_module_t *m, uint32_t data);
+extern int snapshot_module_write_qword(snapshot_module_t *m, uint64_t data);
+extern int snapshot_module_write_byte_array(snapshot_module_t *m, const uint8_t *data, unsigned int num);
+extern int snapshot_module_write_word_array(snapshot_module_t *m, const uint16_t *data, unsigned int num);
+extern int snapshot_module_write_dword_array(snapshot_module_t *m, const uint32_t *data, unsigned int num);
+extern int snapshot_module_write_string(snapshot_module_t *m, const char *s);
+
+extern int snapshot_module_read_byte(snapshot_module_t *m, uint8_t *b_return);
+extern int snapshot_module_read_word(snapshot_module_t *m, uint16_t *w_return);
+extern int snapshot_module_read_dword(snapshot_module_t *m, uint32_t *dw_return);
+extern int snapshot_module_read_qword(snapshot_module_t *m, uint64_t *qw_return);
+extern int snapshot_module_read_byte_array(snapshot_module_t *m, uint8_t *b_return, unsigned int num);
+extern int snapshot_module_read_word_array(snapshot_module_t *m, uint16_t *w_return, unsigned int num);
+extern int snapshot_module_read_dword_array(snapshot_module_t *m, uint32_t *dw_return, unsigned int num);
+extern int snapshot_module_read_string(snapshot_module_t *m, char **s);
+extern int snapshot_module_read_byte_into_int(snapshot_module_t *m, int *value_return);
+extern int snapshot_module_read_word_into_int(snapshot_module_t *m, int *value_return);
+extern int snapshot_module_read_dword_into_int(snapshot_module_t *m, int *value_return);
+
+extern snapshot_module_t *snapshot_module_create(snapshot_t *s, const char *name, uint8_t major_version, uint8_t minor_version);
+extern snapshot_module_t *snapshot_module_open(snapshot_t *s, const char *name, uint8_t *major_version_return, uint8_t *minor_version_return);
+extern int snapshot_module_close(snapshot_module_t *m);
+
+extern snapshot_t *snapshot_create(const char *filename, uint8_t major_version, uint8_t minor_version, const char *machine_name);
+extern snapshot_t *snapshot_open(const char *filename, uint8_t *major_version_return, uint8_t *minor_version_return, const char *machine_name);
+extern int snapshot_close(snapshot_t *s);
+
+extern void snapshot_set_error(int error);
+extern int snapshot_get_error(void);
+extern const char *snapshot_error_string(int error);
+
+#define SMW_B       snapshot_module_write_byte
+#define SMW_W       snapshot_module_write_word
+#define SMW_DW      snapshot_module_write_dword
+#define SMW_QW      snapshot_module_write_qword
+#define SMW_BA      snapshot_module_write_byte_array
+#define SMW_WA      snapshot_module_write_word_array
+#define SMW_DWA     snapshot_module_write_dword_array
+#define SMW_STR     snapshot_module_write_string
+#define SMR_B       snapshot_module_read_byte
+#define SMR_W       snapshot_module_read_word
+#define SMR_DW      snapshot_module_read_dword
+#define SMR_QW      snapshot_module_read_qword
+#define SMR_BA      snapshot_module_read_byte_array
+#define SMR_WA      snapshot_module_read_word_array
+#define SMR_DWA     snapshot_module_read_dword_array
+#define SMR_STR     snapshot_module_read_string
+#define SMR_B_INT   snapshot_module_read_byte_into_int
+#define SMR_W_INT   snapshot_module_read_word_into_int
+#define SMR_DW_INT  snapshot_module_read_dword_into_int
+
+#endif
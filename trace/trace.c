@@ -0,0 +1,409 @@
+/*
+ * trace.c - Binary instruction trace files.
+ *
+ * A trace file is TRACE_MAGIC followed by one record per instruction:
+ *
+ *   flags      byte, TRACE_F_*
+ *   regmask    word, registers that changed since the previous record
+ *   instr      qword, only if TRACE_F_INSTR (not previous + 1)
+ *   mmu        TRACE_MMU words, only if TRACE_F_MMU (MMU state changed)
+ *   pc         word
+ *   ppc        3 bytes
+ *   op         TRACE_OPBYTES bytes at ppc
+ *   regs       a word for each bit set in regmask
+ *
+ * All values are little endian. The first record has everything.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#ifndef _WIN32
+#include <pthread.h>
+#endif
+
+#include "trace.h"
+#include "../z280/z280.h"
+
+#define TRACE_F_INSTR	0x01
+#define TRACE_F_MMU	0x02
+
+#define TRACE_BLOCK	65536
+#define TRACE_MAXREC	(3 + 8 + 2 * TRACE_MMU + 5 + TRACE_OPBYTES + 2 * TRACE_REGS)
+
+static struct {
+	int fd;
+	uint8_t *ring;
+	int *len;
+	int nblocks;
+	int fill_block;		/* block being filled */
+	int fill;
+	int head;		/* oldest block waiting to be written */
+	int count;		/* blocks waiting to be written */
+	int stop;
+	int error;
+	struct trace_entry last;
+	int fresh;
+#ifndef _WIN32
+	pthread_t thread;
+	pthread_mutex_t lock;
+	pthread_cond_t more;	/* work for the writer */
+	pthread_cond_t room;	/* the writer freed a block */
+#endif
+} tr = { -1 };
+
+static void trace_write_block(int b)
+{
+	uint8_t *p = tr.ring + (size_t)b * TRACE_BLOCK;
+	int n = tr.len[b], r;
+
+	while (n > 0 && !tr.error) {
+		r = write(tr.fd, p, n);
+		if (r < 0 && errno == EINTR)
+			continue;
+		if (r <= 0) {
+			printf("Trace: write error, %s\n", strerror(errno));
+			tr.error = 1;
+			break;
+		}
+		p += r;
+		n -= r;
+	}
+}
+
+#ifndef _WIN32
+
+static void *trace_writer(void *arg)
+{
+	int b;
+
+	pthread_mutex_lock(&tr.lock);
+	for (;;) {
+		while (!tr.count && !tr.stop)
+			pthread_cond_wait(&tr.more, &tr.lock);
+		if (!tr.count)
+			break;
+		b = tr.head;
+		pthread_mutex_unlock(&tr.lock);
+		trace_write_block(b);
+		pthread_mutex_lock(&tr.lock);
+		tr.head = (b + 1) % tr.nblocks;
+		tr.count--;
+		pthread_cond_broadcast(&tr.room);
+	}
+	pthread_mutex_unlock(&tr.lock);
+	return NULL;
+}
+
+/* hand the current block to the writer and take the next free one */
+static void trace_submit(void)
+{
+	pthread_mutex_lock(&tr.lock);
+	tr.len[tr.fill_block] = tr.fill;
+	tr.count++;
+	pthread_cond_signal(&tr.more);
+	while (tr.count == tr.nblocks)
+		pthread_cond_wait(&tr.room, &tr.lock);
+	tr.fill_block = (tr.fill_block + 1) % tr.nblocks;
+	tr.fill = 0;
+	pthread_mutex_unlock(&tr.lock);
+}
+
+static int trace_start(void)
+{
+	tr.head = tr.count = tr.fill_block = tr.fill = 0;
+	tr.stop = 0;
+	pthread_mutex_init(&tr.lock, NULL);
+	pthread_cond_init(&tr.more, NULL);
+	pthread_cond_init(&tr.room, NULL);
+	if (pthread_create(&tr.thread, NULL, trace_writer, NULL)) {
+		printf("Trace: cannot start the writer\n");
+		return -1;
+	}
+	return 0;
+}
+
+#else
+
+static void trace_submit(void)
+{
+	tr.len[0] = tr.fill;
+	trace_write_block(0);
+	tr.fill = 0;
+}
+
+static int trace_start(void)
+{
+	tr.fill_block = tr.fill = 0;
+	return 0;
+}
+
+#endif
+
+static int trace_create(const char *path)
+{
+	tr.fd = open(path, O_WRONLY|O_CREAT|O_TRUNC, 0666);
+	if (tr.fd < 0) {
+		printf("Trace: cannot create %s\n", path);
+		return -1;
+	}
+	tr.error = 0;
+	tr.fresh = 1;
+	memcpy(tr.ring, TRACE_MAGIC, TRACE_MAGIC_LEN);
+	tr.fill = TRACE_MAGIC_LEN;
+	return 0;
+}
+
+int trace_open(const char *path, size_t ring)
+{
+	tr.nblocks = ring / TRACE_BLOCK;
+	if (tr.nblocks < 2)
+		tr.nblocks = 2;
+	tr.ring = malloc((size_t)tr.nblocks * TRACE_BLOCK);
+	tr.len = calloc(tr.nblocks, sizeof(int));
+	if (tr.ring == NULL || tr.len == NULL) {
+		printf("Trace: cannot allocate %d KB\n", tr.nblocks * (TRACE_BLOCK / 1024));
+		return -1;
+	}
+	if (trace_start() < 0)
+		return -1;
+	return trace_create(path);
+}
+
+static inline uint8_t *put16(uint8_t *p, uint16_t v)
+{
+	p[0] = v;
+	p[1] = v >> 8;
+	return p + 2;
+}
+
+void trace_write(const struct trace_entry *e)
+{
+	uint8_t *p, *start;
+	int flags = 0, i;
+	unsigned mask = 0;
+
+	if (tr.fill > TRACE_BLOCK - TRACE_MAXREC)
+		trace_submit();
+	p = start = tr.ring + (size_t)tr.fill_block * TRACE_BLOCK + tr.fill;
+
+	if (tr.fresh || e->instr != tr.last.instr + 1)
+		flags |= TRACE_F_INSTR;
+	if (tr.fresh || memcmp(e->mmu, tr.last.mmu, sizeof(e->mmu)))
+		flags |= TRACE_F_MMU;
+	for (i = 0; i < TRACE_REGS; i++)
+		if (tr.fresh || e->regs[i] != tr.last.regs[i])
+			mask |= 1 << i;
+
+	*p++ = flags;
+	p = put16(p, mask);
+	if (flags & TRACE_F_INSTR) {
+		for (i = 0; i < 8; i++)
+			*p++ = e->instr >> (8 * i);
+	}
+	if (flags & TRACE_F_MMU) {
+		for (i = 0; i < TRACE_MMU; i++)
+			p = put16(p, e->mmu[i]);
+	}
+	p = put16(p, e->pc);
+	*p++ = e->ppc;
+	*p++ = e->ppc >> 8;
+	*p++ = e->ppc >> 16;
+	memcpy(p, e->op, TRACE_OPBYTES);
+	p += TRACE_OPBYTES;
+	for (i = 0; i < TRACE_REGS; i++)
+		if (mask & (1 << i))
+			p = put16(p, e->regs[i]);
+
+	tr.fill += p - start;
+	tr.last = *e;
+	tr.fresh = 0;
+}
+
+/* get everything recorded so far to the file */
+void trace_flush(void)
+{
+	if (tr.fd < 0)
+		return;
+	if (tr.fill)
+		trace_submit();
+#ifndef _WIN32
+	pthread_mutex_lock(&tr.lock);
+	while (tr.count)
+		pthread_cond_wait(&tr.room, &tr.lock);
+	pthread_mutex_unlock(&tr.lock);
+#endif
+}
+
+void trace_close(void)
+{
+	if (tr.fd < 0)
+		return;
+	trace_flush();
+#ifndef _WIN32
+	pthread_mutex_lock(&tr.lock);
+	tr.stop = 1;
+	pthread_cond_signal(&tr.more);
+	pthread_mutex_unlock(&tr.lock);
+	pthread_join(tr.thread, NULL);
+#endif
+	close(tr.fd);
+	tr.fd = -1;
+}
+
+/* continue in a new file in a fork()ed child, which has no writer thread;
+   the parent must have flushed before forking */
+int trace_fork(const char *path)
+{
+	if (tr.fd < 0)
+		return 0;
+	close(tr.fd);
+	tr.fd = -1;
+	if (trace_start() < 0)
+		return -1;
+	return trace_create(path);
+}
+
+/* ---------------------------------------------------------------------- */
+
+int trace_read_header(FILE *f)
+{
+	char magic[TRACE_MAGIC_LEN];
+
+	if (fread(magic, 1, TRACE_MAGIC_LEN, f) != TRACE_MAGIC_LEN
+	    || memcmp(magic, TRACE_MAGIC, TRACE_MAGIC_LEN))
+		return -1;
+	return 0;
+}
+
+static uint16_t get16(FILE *f)
+{
+	int l = getc(f);
+	return l | (getc(f) << 8);
+}
+
+/* returns 0 at the end of the trace */
+int trace_read(FILE *f, struct trace_entry *e)
+{
+	int flags, mask, i;
+
+	if ((flags = getc(f)) == EOF)
+		return 0;
+	mask = get16(f);
+	if (flags & TRACE_F_INSTR) {
+		e->instr = 0;
+		for (i = 0; i < 8; i++)
+			e->instr |= (uint64_t)getc(f) << (8 * i);
+	} else
+		e->instr++;
+	if (flags & TRACE_F_MMU) {
+		for (i = 0; i < TRACE_MMU; i++)
+			e->mmu[i] = get16(f);
+	}
+	e->pc = get16(f);
+	e->ppc = get16(f);
+	e->ppc |= getc(f) << 16;
+	if (fread(e->op, 1, TRACE_OPBYTES, f) != TRACE_OPBYTES)
+		return 0;
+	for (i = 0; i < TRACE_REGS; i++)
+		if (mask & (1 << i))
+			e->regs[i] = get16(f);
+	return !feof(f);
+}
+
+/* data space translation as cpu_translate_z280() with the recorded MMU state */
+static offs_t trace_translate(const struct trace_entry *e, offs_t addr)
+{
+	uint16_t mcr = e->mmu[0];
+	const uint16_t *pdr = &e->mmu[1];
+	int user = e->regs[TRACE_R_MSR] & 0x4000;
+	int index;
+
+	if (!(mcr & (user ? 0x8000 : 0x0800)))		/* UTE, STE */
+		return addr & 0xffff;
+	if (mcr & (user ? 0x4000 : 0x0400)) {		/* UPD, SPD */
+		index = (addr >> 13) & 7;
+		if (!user)
+			index += 16;
+		return ((offs_t)(pdr[index] & 0xffe0) << 8) | (addr & 0x1fff);
+	}
+	index = (addr >> 12) & 0xf;
+	if (!user)
+		index += 16;
+	return ((offs_t)(pdr[index] & 0xfff0) << 8) | (addr & 0xfff);
+}
+
+/* the same text as the -d tracer */
+void trace_print(FILE *out, const struct trace_entry *e)
+{
+	char ibuf[20];
+	const uint16_t *r = e->regs;
+	const uint8_t *op = e->op;
+	offs_t dres, i, transea;
+	int ilen, nn, ea;
+	uint8_t f = r[TRACE_R_AF];
+	uint16_t sp = (r[TRACE_R_MSR] & 0x4000) ? r[TRACE_R_USP] : r[TRACE_R_SSP];
+
+	fprintf(out, "%c%c%c%c%c%c AF=%04X BC=%04X DE=%04X HL=%04X IX=%04X IY=%04X SSP=%04X USP=%04X MSR=%04X\n",
+		f & 0x80 ? 'S' : '.', f & 0x40 ? 'Z' : '.', f & 0x10 ? 'H' : '.',
+		f & 0x04 ? 'P' : '.', f & 0x02 ? 'N' : '.', f & 0x01 ? 'C' : '.',
+		r[TRACE_R_AF], r[TRACE_R_BC], r[TRACE_R_DE], r[TRACE_R_HL], r[TRACE_R_IX],
+		r[TRACE_R_IY], r[TRACE_R_SSP], r[TRACE_R_USP], r[TRACE_R_MSR]);
+	dres = cpu_disassemble_z280(NULL, ibuf, e->pc, op, 0);
+	fprintf(out, "%04X=%06X: ", e->pc, e->ppc);
+	ilen = dres & DASMFLAG_LENGTHMASK;
+	for (i = 0; i < ilen; i++)
+		fprintf(out, "%02X", op[i]);
+	for ( ; i < 7; i++)
+		fputs("  ", out);
+	nn = fprintf(out, " %s", ibuf);
+	if (strchr(ibuf, '(')) {
+		ea = 0;
+		if (ibuf[0] != 'j' && ibuf[0] != 'c' && !(ibuf[0] == 'l' && ibuf[2] == 'a')) {
+			ea = 1;
+			if (strstr(ibuf, "(hl)"))
+				transea = r[TRACE_R_HL];
+			else if (strstr(ibuf, "(de)"))
+				transea = r[TRACE_R_DE];
+			else if (strstr(ibuf, "(bc)"))
+				transea = r[TRACE_R_BC];
+			else if (strstr(ibuf, "(ix"))
+				transea = r[TRACE_R_IX] + (int8_t)op[2];
+			else if (strstr(ibuf, "(iy"))
+				transea = r[TRACE_R_IY] + (int8_t)op[2];
+			else if (strstr(ibuf, "(sp)"))
+				transea = sp;
+			else if (strstr(ibuf, "(sp"))
+				transea = sp + (int16_t)op[2];
+			else if (ibuf[0] != 'o' && ibuf[0] != 'i' && strstr(ibuf, "($"))
+				transea = (int16_t)op[ilen - 2];
+			else
+				ea = 0;
+		}
+		if (ea) {
+			for (i = nn; i < 28; i++)
+				putc(' ', out);
+			fprintf(out, "ea=%06X\n", trace_translate(e, transea));
+		} else
+			putc('\n', out);
+	} else if (ibuf[0] == 'l' && ibuf[1] == 'd' && (ibuf[2] == 'i' || ibuf[2] == 'd')) {
+		for (i = nn; i < 28; i++)
+			putc(' ', out);
+		fprintf(out, "eade=%06X ", trace_translate(e, r[TRACE_R_DE]));
+		fprintf(out, "eahl=%06X\n", trace_translate(e, r[TRACE_R_HL]));
+	} else
+		putc('\n', out);
+}
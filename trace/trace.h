@@ -0,0 +1,63 @@
+/*
+ * trace.h - Binary instruction trace files.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+
+#ifndef Z280EMU_TRACE_H
+#define Z280EMU_TRACE_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stddef.h>
+
+#define TRACE_MAGIC	"Z280TRC1"
+#define TRACE_MAGIC_LEN	8
+
+#define TRACE_REGS	9	/* AF BC DE HL IX IY SSP USP MSR, as cpu_get_regs_z280() */
+#define TRACE_MMU	33	/* MMUMCR and the 32 PDRs, as cpu_get_mmu_z280() */
+#define TRACE_OPBYTES	7	/* longest instruction */
+
+#define TRACE_R_AF	0
+#define TRACE_R_BC	1
+#define TRACE_R_DE	2
+#define TRACE_R_HL	3
+#define TRACE_R_IX	4
+#define TRACE_R_IY	5
+#define TRACE_R_SSP	6
+#define TRACE_R_USP	7
+#define TRACE_R_MSR	8
+
+#define TRACE_RING	(16 << 20)	/* default in-memory buffer */
+
+/* one executed instruction, with the state before it runs */
+struct trace_entry {
+	uint64_t instr;
+	uint16_t pc;
+	uint32_t ppc;			/* physical PC */
+	uint8_t op[TRACE_OPBYTES];
+	uint16_t regs[TRACE_REGS];
+	uint16_t mmu[TRACE_MMU];
+};
+
+/* writing: records go to a ring of blocks that a thread writes out */
+int trace_open(const char *path, size_t ring);
+void trace_write(const struct trace_entry *e);
+void trace_flush(void);
+void trace_close(void);
+int trace_fork(const char *path);
+
+/* reading: e carries the state of the previous record */
+int trace_read_header(FILE *f);
+int trace_read(FILE *f, struct trace_entry *e);
+void trace_print(FILE *out, const struct trace_entry *e);
+
+#endif
@@ -0,0 +1,62 @@
+/*
+ * trace280.c - print a binary Z280 trace as text
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA
+ *  02111-1307  USA.
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "trace/trace.h"
+
+int main(int argc, char** argv)
+{
+   FILE* f;
+   struct trace_entry e;
+   unsigned long long from = 0, to = -1LL;
+   int i;
+
+   if (argc<2) {
+      printf("Usage: trace280 filename [-from=instr] [-to=instr]\n");
+      exit(1);
+   }
+   for (i = 1; i < argc - 1; i++)
+   {
+      if (strncmp(argv[i],"-from=",6)==0) { /* first instruction to print */
+         from=strtoull(argv[i]+6,NULL,10);
+      } else if (strncmp(argv[i],"-to=",4)==0) { /* last one */
+         to=strtoull(argv[i]+4,NULL,10);
+      }
+   }
+   if (!(f=fopen(argv[argc-1],"rb"))) {
+      perror(argv[argc-1]);
+      exit(1);
+   }
+   if (trace_read_header(f) < 0) {
+      printf("%s: not a trace file\n",argv[argc-1]);
+      exit(1);
+   }
+   memset(&e,0,sizeof(e));
+   while (trace_read(f,&e) && e.instr <= to) {
+      if (e.instr >= from)
+         trace_print(stdout,&e);
+   }
+   fclose(f);
+   return 0;
+}
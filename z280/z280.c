@@ -54,6 +54,7 @@ Example:
 //#include "emu.h"
 //#include "debugger.h"
 #include "z280.h"
+#include "../hostprof/hostprof.h"
 
 /****************************************************************************/
 /* The Z280 registers. HALT is set to 1 when the CPU is halted              */
@@ -105,6 +106,7 @@ struct z280_state
 	UINT8 *cc[8];	/* cycle count tables */
 	jmp_buf abort_handler;
 	UINT8 abort_type;                       /* which abort will be taken upon ACCV */
+	struct z280_stats stats;                /* event counters */
 };
 
 INLINE struct z280_state *get_safe_token(device_t *device)
@@ -317,6 +319,15 @@ UINT8 interrupt_group[Z280_INT_MAX+1] = {-1, 0, 1, 1, 2, 3, 3, 3, 4, 5, 5, 6, 6}
 
 #define Z280_PREFIX_COUNT       (Z280_PREFIX_fded + 1)
 
+#ifdef Z280_OPSTATS
+/* executions and cycles per opcode, cycles including CC(ex,..) */
+struct z280_opstat {
+	unsigned long long count, cycles, extra;
+};
+struct z280_opstat z280_opstats[Z280_PREFIX_COUNT][0x100];
+unsigned long long z280_opstats_cycles;
+#endif
+
 
 
 UINT8 SZ[256];       /* zero and sign flags */
@@ -344,6 +355,9 @@ int check_interrupts(struct z280_state *cpustate);
 void set_irq_internal(device_t *device, int irq, int state);
 int take_trap(struct z280_state *cpustate, int trap);
 
+void (*z280_trap_hook)(device_t *device, int trap) = NULL;
+void (*z280_call_hook)(device_t *device, int kind, UINT16 sp) = NULL;
+
 #include "z280ops.h"
 #include "z280tbl.h"
 
@@ -1082,6 +1096,7 @@ int z280_check_dma(struct z280_state *cpustate)
     else if ((cpustate->dmatdr[channel] & (Z280_DMATDR_SAD &~0x4000)) == Z280_DMATDR_SAD_DECM) \
 	   cpustate->sar[channel] -= sz;  \
 	cpustate->dmacnt[channel]--; \
+	cpustate->stats.dma[channel] += sz; \
 }
 
 void check_dma_interrupt(struct z280_state *cpustate, int channel) {
@@ -1701,7 +1716,7 @@ int check_interrupts(struct z280_state *cpustate)
 /****************************************************************************
  * Execute 'cycles' T-states. Return number of T-states really executed
  ****************************************************************************/
-void cpu_execute_z280(device_t *device, int icount)
+int cpu_execute_z280(device_t *device, int icount)
 {
 	struct z280_state *cpustate = get_safe_token(device);
 	int curcycles;
@@ -1710,19 +1725,19 @@ void cpu_execute_z280(device_t *device, int icount)
 	while (cpustate->icount > 0)
 	{
 		// DMA
-		curcycles = z280_check_dma(cpustate);
+		HOSTPROF_TIME(HP_DMA, curcycles = z280_check_dma(cpustate));
 		//cpustate->icount -= curcycles;
 		//clock_timers(cpustate, curcycles);
 
 		// interrupts
-		curcycles += check_interrupts(cpustate);
+		HOSTPROF_TIME(HP_INTERRUPTS, curcycles += check_interrupts(cpustate));
 		//cpustate->icount -= curcycles;
 		//clock_timers(cpustate, curcycles);
 		cpustate->after_EI = 0;
 
 		// debugger hook
 		cpustate->_PPC = cpustate->_PCD;
-		debugger_instruction_hook(device, cpustate->_PCD);
+		HOSTPROF_TIME(HP_HOOK, debugger_instruction_hook(device, cpustate->_PCD));
 
 		// instructon fetch
 		if (!cpustate->HALT)
@@ -1740,15 +1755,17 @@ void cpu_execute_z280(device_t *device, int icount)
 				{
 					// try to execute the instruction
 					cpustate->extra_cycles = 0;
-					curcycles += exec_op(cpustate,ROP(cpustate));
+					HOSTPROF_TIME(HP_EXEC, curcycles += exec_op(cpustate,ROP(cpustate)));
 					curcycles += cpustate->extra_cycles;
 				}
 				else if (cpustate->abort_type == Z280_ABORT_ACCV)
 				{
+					HOSTPROF_SWITCH(HP_CORE); // the abort skipped HOSTPROF_LEAVE
 					curcycles += take_trap(cpustate, Z280_TRAP_ACCV);
 				}
 				else
 				{
+					HOSTPROF_SWITCH(HP_CORE);
 					curcycles += take_fatal(cpustate);
 				}
 			}
@@ -1757,10 +1774,20 @@ void cpu_execute_z280(device_t *device, int icount)
 			curcycles += 3;
 
 		cpustate->icount -= curcycles;
-		clock_timers(cpustate, curcycles);
+		HOSTPROF_TIME(HP_TIMERS, clock_timers(cpustate, curcycles));
 	}
 
 	//cpustate->old_icount -= cpustate->icount;
+	return icount - cpustate->icount; // includes the overshoot of the last instruction
+}
+
+/****************************************************************************
+ * T-states left in the slice given to cpu_execute_z280
+ ****************************************************************************/
+int cpu_get_icount_z280(device_t *device)
+{
+	struct z280_state *cpustate = get_safe_token(device);
+	return cpustate->icount;
 }
 
 /****************************************************************************
@@ -1946,6 +1973,312 @@ offs_t cpu_get_state_z280(device_t *device, int device_state_entry) {
 	}
 }
 
+/* registers for the tracer: AF BC DE HL IX IY SSP USP MSR */
+void cpu_get_regs_z280(device_t *device, UINT16 *regs)
+{
+	struct z280_state *cpustate = get_safe_token(device);
+	regs[0] = cpustate->AF.w.l;
+	regs[1] = cpustate->BC.w.l;
+	regs[2] = cpustate->DE.w.l;
+	regs[3] = cpustate->HL.w.l;
+	regs[4] = cpustate->IX.w.l;
+	regs[5] = cpustate->IY.w.l;
+	regs[6] = cpustate->SSP.w.l;
+	regs[7] = cpustate->USP.w.l;
+	regs[8] = MSR(cpustate);
+}
+
+UINT16 cpu_get_msr_z280(device_t *device)
+{
+	struct z280_state *cpustate = get_safe_token(device);
+	return MSR(cpustate);
+}
+
+/* MMU state for the tracer: MMUMCR followed by the 32 PDRs */
+void cpu_get_mmu_z280(device_t *device, UINT16 *mmu)
+{
+	struct z280_state *cpustate = get_safe_token(device);
+	mmu[0] = MMUMCR(cpustate);
+	memcpy(&mmu[1], cpustate->pdr, sizeof(cpustate->pdr));
+}
+
+void cpu_get_stats_z280(device_t *device, struct z280_stats *stats)
+{
+	struct z280_state *cpustate = get_safe_token(device);
+	*stats = cpustate->stats;
+}
+
+#ifdef Z280_OPSTATS
+/****************************************************************************
+ * Opcode statistics
+ ****************************************************************************/
+
+static const UINT8 opstat_bytes[Z280_PREFIX_COUNT][3] = {
+	{0}, {0xcb}, {0xdd}, {0xed}, {0xfd}, {0xdd,0xcb,0x00}, {0xdd,0xed}, {0xfd,0xed}
+};
+static const int opstat_nbytes[Z280_PREFIX_COUNT] = { 0, 1, 1, 1, 1, 3, 2, 2 };
+static const char *const opstat_tables[Z280_PREFIX_COUNT] = {
+	"base", "CB", "DD", "ED", "FD", "DD/FD CB", "DD ED", "FD ED"
+};
+
+struct opstat_row {
+	int prefix, opcode;
+	struct z280_opstat *s;
+};
+
+/* the CB DD ED FD entries only dispatch to the other tables */
+static int opstat_is_prefix(int prefix, int opcode)
+{
+	if (prefix == Z280_PREFIX_op)
+		return opcode == 0xcb || opcode == 0xdd || opcode == 0xed || opcode == 0xfd;
+	if (prefix == Z280_PREFIX_dd || prefix == Z280_PREFIX_fd)
+		return opcode == 0xcb || opcode == 0xed;
+	return 0;
+}
+
+static void opstat_name(int prefix, int opcode, char *buf)
+{
+	UINT8 op[8] = {0};
+	int i, n = opstat_nbytes[prefix];
+
+	memcpy(op, opstat_bytes[prefix], n);
+	op[n] = opcode;
+	for (i = 0; i <= n; i++)
+		buf += sprintf(buf, prefix == Z280_PREFIX_xycb && i == 2 ? "nn " : "%02X ", op[i]);
+	buf += sprintf(buf, "%*s", 3 * (4 - n - 1), "");
+	cpu_disassemble_z280(NULL, buf, 0, op, 0);
+}
+
+static int opstat_cmp_cycles(const void *a, const void *b)
+{
+	const struct opstat_row *x = a, *y = b;
+	return x->s->cycles < y->s->cycles ? 1 : x->s->cycles > y->s->cycles ? -1 : 0;
+}
+
+static int opstat_cmp_count(const void *a, const void *b)
+{
+	const struct opstat_row *x = a, *y = b;
+	return x->s->count < y->s->count ? 1 : x->s->count > y->s->count ? -1 : 0;
+}
+
+static void opstat_table(FILE *f, struct opstat_row *rows, int n,
+	unsigned long long count, unsigned long long cycles)
+{
+	char name[48];
+	int i;
+
+	fprintf(f, "         count      %%           cycles      %%      extra   avg  opcode\n");
+	for (i = 0; i < n; i++) {
+		struct z280_opstat *s = rows[i].s;
+		opstat_name(rows[i].prefix, rows[i].opcode, name);
+		fprintf(f, "%14llu %6.2f %16llu %6.2f %10llu %5.1f  %s\n", s->count,
+			100.0 * s->count / count, s->cycles, 100.0 * s->cycles / cycles,
+			s->extra, (double)s->cycles / s->count, name);
+	}
+}
+
+void z280_opstats_report(FILE *f)
+{
+	struct opstat_row rows[Z280_PREFIX_COUNT * 0x100];
+	unsigned long long count = 0, cycles = 0;
+	char name[48];
+	int p, o, n = 0, unused;
+
+	for (p = 0; p < Z280_PREFIX_COUNT; p++)
+		for (o = 0; o < 0x100; o++)
+			if (z280_opstats[p][o].count && !opstat_is_prefix(p, o)) {
+				rows[n].prefix = p;
+				rows[n].opcode = o;
+				rows[n].s = &z280_opstats[p][o];
+				count += rows[n].s->count;
+				cycles += rows[n].s->cycles;
+				n++;
+			}
+	if (!count)
+		count = cycles = 1;
+
+	fprintf(f, "Opcodes by cycles (%d opcodes, %llu instructions, %llu cycles)\n", n, count, cycles);
+	qsort(rows, n, sizeof(*rows), opstat_cmp_cycles);
+	opstat_table(f, rows, n, count, cycles);
+	fprintf(f, "\nOpcodes by count\n");
+	qsort(rows, n, sizeof(*rows), opstat_cmp_count);
+	opstat_table(f, rows, n, count, cycles);
+
+	fprintf(f, "\nOpcodes never executed\n");
+	for (p = 0; p < Z280_PREFIX_COUNT; p++) {
+		unused = 0;
+		for (o = 0; o < 0x100; o++) {
+			if (z280_opstats[p][o].count || opstat_is_prefix(p, o))
+				continue;
+			opstat_name(p, o, name);
+			if (strstr(name, "db ") == NULL) {	/* skip undefined opcodes */
+				fprintf(f, "  %s\n", name);
+				unused++;
+			}
+		}
+		fprintf(f, "  -- %d in the %s table\n", unused, opstat_tables[p]);
+	}
+}
+#endif
+
+/****************************************************************************
+ * Snapshot support
+ ****************************************************************************/
+
+/* Z280 snapshot module format: registers, control registers, MMU, counter/timers,
+   DMA and interrupt state, in z280_state order. The UART follows as its own module. */
+
+static char snap_module_name[] = "Z280";
+#define SNAP_MAJOR 0
+#define SNAP_MINOR 0
+
+int cpu_write_snapshot_z280(device_t *device, snapshot_t *s)
+{
+	struct z280_state *cpustate = get_safe_token(device);
+	struct z280_device *d = (struct z280_device *)device;
+	snapshot_module_t *m;
+
+	m = snapshot_module_create(s, snap_module_name, SNAP_MAJOR, SNAP_MINOR);
+	if (m == NULL)
+		return -1;
+
+	if (0
+		|| SMW_DW(m, cpustate->PREPC.d) < 0
+		|| SMW_DW(m, cpustate->PC.d) < 0
+		|| SMW_DW(m, cpustate->SSP.d) < 0
+		|| SMW_DW(m, cpustate->USP.d) < 0
+		|| SMW_DW(m, cpustate->AF.d) < 0
+		|| SMW_DW(m, cpustate->BC.d) < 0
+		|| SMW_DW(m, cpustate->DE.d) < 0
+		|| SMW_DW(m, cpustate->HL.d) < 0
+		|| SMW_DW(m, cpustate->IX.d) < 0
+		|| SMW_DW(m, cpustate->IY.d) < 0
+		|| SMW_DW(m, cpustate->AF2.d) < 0
+		|| SMW_DW(m, cpustate->BC2.d) < 0
+		|| SMW_DW(m, cpustate->DE2.d) < 0
+		|| SMW_DW(m, cpustate->HL2.d) < 0
+		|| SMW_B(m, cpustate->AF2inuse) < 0
+		|| SMW_B(m, cpustate->BC2inuse) < 0
+		|| SMW_B(m, cpustate->R) < 0
+		|| SMW_B(m, cpustate->IFF2) < 0
+		|| SMW_B(m, cpustate->HALT) < 0
+		|| SMW_B(m, cpustate->IM) < 0
+		|| SMW_B(m, cpustate->I) < 0
+		|| SMW_BA(m, cpustate->cr, Z280_CRSIZE) < 0
+		|| SMW_B(m, cpustate->rrr) < 0
+		|| SMW_BA(m, cpustate->mmur, 4) < 0
+		|| SMW_WA(m, cpustate->pdr, 32) < 0
+		|| SMW_BA(m, cpustate->ctcr, 3) < 0
+		|| SMW_BA(m, cpustate->ctcsr, 3) < 0
+		|| SMW_WA(m, cpustate->ctctr, 3) < 0
+		|| SMW_WA(m, cpustate->cttcr, 3) < 0
+		|| SMW_DWA(m, cpustate->sar, 4) < 0
+		|| SMW_DWA(m, cpustate->dar, 4) < 0
+		|| SMW_WA(m, cpustate->dmatdr, 4) < 0
+		|| SMW_WA(m, cpustate->dmacnt, 4) < 0
+		|| SMW_B(m, cpustate->dmamcr) < 0
+		|| SMW_BA(m, cpustate->dma_pending, 4) < 0
+		|| SMW_DW(m, cpustate->dma_active) < 0
+		|| SMW_BA(m, cpustate->rdy_state, 4) < 0
+		|| SMW_B(m, cpustate->nmi_state) < 0
+		|| SMW_B(m, cpustate->nmi_pending) < 0
+		|| SMW_BA(m, cpustate->irq_state, 3) < 0
+		|| SMW_BA(m, cpustate->int_pending, Z280_INT_MAX + 1) < 0
+		|| SMW_B(m, cpustate->after_EI) < 0
+		|| SMW_DW(m, cpustate->ea) < 0
+		|| SMW_DW(m, cpustate->eapdr) < 0
+		|| SMW_W(m, cpustate->timer_cnt) < 0
+		|| SMW_DW(m, cpustate->extra_cycles) < 0
+		|| SMW_B(m, cpustate->abort_type) < 0
+		|| SMW_W(m, d->ctin1_brg_const) < 0
+		|| SMW_W(m, d->ctin1_uart_timer) < 0) {
+		snapshot_module_close(m);
+		return -1;
+	}
+	if (snapshot_module_close(m) < 0)
+		return -1;
+
+	return z280uart_device_write_snapshot(d->z280uart, s);
+}
+
+int cpu_read_snapshot_z280(device_t *device, snapshot_t *s)
+{
+	struct z280_state *cpustate = get_safe_token(device);
+	struct z280_device *d = (struct z280_device *)device;
+	uint8_t vmajor, vminor;
+	snapshot_module_t *m;
+
+	m = snapshot_module_open(s, snap_module_name, &vmajor, &vminor);
+	if (m == NULL)
+		return -1;
+
+	/* Do not accept versions higher than current */
+	if (vmajor > SNAP_MAJOR || vminor > SNAP_MINOR) {
+		snapshot_set_error(SNAPSHOT_MODULE_HIGHER_VERSION);
+		goto fail;
+	}
+
+	if (0
+		|| SMR_DW(m, &cpustate->PREPC.d) < 0
+		|| SMR_DW(m, &cpustate->PC.d) < 0
+		|| SMR_DW(m, &cpustate->SSP.d) < 0
+		|| SMR_DW(m, &cpustate->USP.d) < 0
+		|| SMR_DW(m, &cpustate->AF.d) < 0
+		|| SMR_DW(m, &cpustate->BC.d) < 0
+		|| SMR_DW(m, &cpustate->DE.d) < 0
+		|| SMR_DW(m, &cpustate->HL.d) < 0
+		|| SMR_DW(m, &cpustate->IX.d) < 0
+		|| SMR_DW(m, &cpustate->IY.d) < 0
+		|| SMR_DW(m, &cpustate->AF2.d) < 0
+		|| SMR_DW(m, &cpustate->BC2.d) < 0
+		|| SMR_DW(m, &cpustate->DE2.d) < 0
+		|| SMR_DW(m, &cpustate->HL2.d) < 0
+		|| SMR_B(m, &cpustate->AF2inuse) < 0
+		|| SMR_B(m, &cpustate->BC2inuse) < 0
+		|| SMR_B(m, &cpustate->R) < 0
+		|| SMR_B(m, &cpustate->IFF2) < 0
+		|| SMR_B(m, &cpustate->HALT) < 0
+		|| SMR_B(m, &cpustate->IM) < 0
+		|| SMR_B(m, &cpustate->I) < 0
+		|| SMR_BA(m, cpustate->cr, Z280_CRSIZE) < 0
+		|| SMR_B(m, &cpustate->rrr) < 0
+		|| SMR_BA(m, cpustate->mmur, 4) < 0
+		|| SMR_WA(m, cpustate->pdr, 32) < 0
+		|| SMR_BA(m, cpustate->ctcr, 3) < 0
+		|| SMR_BA(m, cpustate->ctcsr, 3) < 0
+		|| SMR_WA(m, cpustate->ctctr, 3) < 0
+		|| SMR_WA(m, cpustate->cttcr, 3) < 0
+		|| SMR_DWA(m, cpustate->sar, 4) < 0
+		|| SMR_DWA(m, cpustate->dar, 4) < 0
+		|| SMR_WA(m, cpustate->dmatdr, 4) < 0
+		|| SMR_WA(m, cpustate->dmacnt, 4) < 0
+		|| SMR_B(m, &cpustate->dmamcr) < 0
+		|| SMR_BA(m, cpustate->dma_pending, 4) < 0
+		|| SMR_DW_INT(m, &cpustate->dma_active) < 0
+		|| SMR_BA(m, cpustate->rdy_state, 4) < 0
+		|| SMR_B(m, &cpustate->nmi_state) < 0
+		|| SMR_B(m, &cpustate->nmi_pending) < 0
+		|| SMR_BA(m, cpustate->irq_state, 3) < 0
+		|| SMR_BA(m, cpustate->int_pending, Z280_INT_MAX + 1) < 0
+		|| SMR_B(m, &cpustate->after_EI) < 0
+		|| SMR_DW(m, &cpustate->ea) < 0
+		|| SMR_DW_INT(m, &cpustate->eapdr) < 0
+		|| SMR_W(m, &cpustate->timer_cnt) < 0
+		|| SMR_DW_INT(m, &cpustate->extra_cycles) < 0
+		|| SMR_B(m, &cpustate->abort_type) < 0
+		|| SMR_W(m, &d->ctin1_brg_const) < 0
+		|| SMR_W(m, &d->ctin1_uart_timer) < 0) {
+		goto fail;
+	}
+	snapshot_module_close(m);
+
+	return z280uart_device_read_snapshot(d->z280uart, s);
+
+fail:
+	snapshot_module_close(m);
+	return -1;
+}
+
 /**************************************************************************
  * Generic set_info
  **************************************************************************/
@@ -76,6 +76,7 @@ enum
 #define Z280_TRAP_DIV   8           /* Division trap */
 #define Z280_TRAP_SS    9           /* Single step trap */
 #define Z280_TRAP_BP    10          /* Breakpoint trap */
+#define Z280_TRAP_FATAL 11          /* Fatal condition, CPU halts */
 
 #define Z280_TRAPSAVE_PREPC   1
 #define Z280_TRAPSAVE_ARG16   2
@@ -209,13 +210,47 @@ struct z280_device *cpu_create_z280(char *tag, UINT32 type, UINT32 clock,
 	UINT32 ctin0, UINT32 ctin1, UINT32 ctin2, /* CTINx clocks (optional) */
 	rx_callback_t z280uart_rx_cb,tx_callback_t z280uart_tx_cb);
 void cpu_reset_z280(device_t *device);
-void cpu_execute_z280(device_t *device, int icount);
+int cpu_execute_z280(device_t *device, int icount);
+int cpu_get_icount_z280(device_t *device);
 int cpu_translate_z280(device_t *device, enum address_spacenum space, int intention, offs_t *address);
 
 void z280_set_irq_line(device_t *device, int irqline, int state);
 void z280_set_rdy_line(device_t *device, int rdyline, int state);
                                                  
 offs_t cpu_get_state_z280(device_t *device,int device_state_entry);
+void cpu_get_regs_z280(device_t *device, UINT16 *regs);
+UINT16 cpu_get_msr_z280(device_t *device);
+void cpu_get_mmu_z280(device_t *device, UINT16 *mmu);
+
+/* event counters kept by the core */
+struct z280_stats {
+	unsigned long long mmu;			/* translated memory accesses */
+	unsigned long long traps[Z280_TRAP_FATAL + 1];
+	unsigned long long interrupts[Z280_INT_MAX + 1];
+	unsigned long long dma[4];		/* bytes moved per channel */
+};
+void cpu_get_stats_z280(device_t *device, struct z280_stats *stats);
 void cpu_string_export_z280(device_t *device, int device_state_entry, char *string);
 
+/* called as each trap is taken, before any state changes */
+extern void (*z280_trap_hook)(device_t *device, int trap);
+
+/* called after each call, return, interrupt and trap entry; sp is the
+   stack pointer the matching return leaves behind (the system stack
+   for RETIL, interrupts and traps) */
+#define Z280_CG_CALL	0
+#define Z280_CG_RET	1
+#define Z280_CG_RETIL	2
+#define Z280_CG_INT	3
+#define Z280_CG_TRAP	4
+extern void (*z280_call_hook)(device_t *device, int kind, UINT16 sp);
+
+#ifdef Z280_OPSTATS
+/* built with -DZ280_OPSTATS: executions and cycles of every opcode */
+void z280_opstats_report(FILE *f);
+#endif
+
+int cpu_write_snapshot_z280(device_t *device, snapshot_t *s);
+int cpu_read_snapshot_z280(device_t *device, snapshot_t *s);
+
 #endif /* __Z280_H__ */
@@ -239,7 +239,7 @@ OP(dd,c9) { illegal_1(cpustate, __func__); op_c9(cpustate);
 OP(dd,ca) { JP_HL_COND( cpustate->_F & ZF );                                        } /* JP Z, (HL)       */
 OP(dd,cb) { EAX(cpustate); cpustate->extra_cycles += exec_xycb(cpustate,ARG(cpustate));                          } /* **   DD CB xx    */
 OP(dd,cc) { CALL_HL_COND( cpustate->_F & ZF, 0xcc);                                 } /* CALL Z, (HL)     */
-OP(dd,cd) { PUSH_R(cpustate,  PC ); cpustate->_PCD = cpustate->_HL; if(is_system(cpustate)) CHECK_SSO(cpustate); } /* CALL (HL)        */
+OP(dd,cd) { PUSH_R(cpustate,  PC ); cpustate->_PCD = cpustate->_HL; if(is_system(cpustate)) CHECK_SSO(cpustate); CALL_HOOK(Z280_CG_CALL, _SPD(cpustate)+2); } /* CALL (HL)        */
 OP(dd,ce) { illegal_1(cpustate, __func__); op_ce(cpustate);                                   } /* DB   DD          */
 OP(dd,cf) { illegal_1(cpustate, __func__); op_cf(cpustate);                                   } /* DB   DD          */
 
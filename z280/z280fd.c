@@ -231,7 +231,7 @@ OP(fd,c9) { illegal_1(cpustate, __func__); op_c9(cpustate);
 OP(fd,ca) { JP_RA_COND( cpustate->_F & ZF );                                        } /* JP Z, (ra)       */
 OP(fd,cb) { EAY(cpustate); cpustate->extra_cycles += exec_xycb(cpustate,ARG(cpustate));                          } /* **   FD CB xx    */
 OP(fd,cc) { CALL_RA_COND( cpustate->_F & ZF, 0xcc);                                 } /* CALL Z, (ra)     */
-OP(fd,cd) { PUSH_R(cpustate, PC); EARA(cpustate); cpustate->_PCD = cpustate->ea; if(is_system(cpustate)) CHECK_SSO(cpustate); } /* CALL (ra)        */
+OP(fd,cd) { PUSH_R(cpustate, PC); EARA(cpustate); cpustate->_PCD = cpustate->ea; if(is_system(cpustate)) CHECK_SSO(cpustate); CALL_HOOK(Z280_CG_CALL, _SPD(cpustate)+2); } /* CALL (ra)        */
 OP(fd,ce) { illegal_1(cpustate, __func__); op_ce(cpustate);                                   } /* DB   FD          */
 OP(fd,cf) { illegal_1(cpustate, __func__); op_cf(cpustate);                                   } /* DB   FD          */
 
@@ -229,7 +229,7 @@ OP(op,c6) { ADD(ARG(cpustate));                                             } /*
 OP(op,c7) { RST(0x00);                                              } /* RST  0           */
 
 OP(op,c8) { RET_COND( cpustate->_F & ZF, 0xc8 );                                } /* RET  Z           */
-OP(op,c9) { POP(cpustate, PC);                                              } /* RET              */
+OP(op,c9) { POP(cpustate, PC); CALL_HOOK(Z280_CG_RET, _SPD(cpustate));      } /* RET              */
 OP(op,ca) { JP_COND( cpustate->_F & ZF );                                   } /* JP   Z,a         */
 OP(op,cb) { cpustate->extra_cycles += exec_cb(cpustate,ROP(cpustate));                                   } /* **** CB xx       */
 OP(op,cc) { CALL_COND( cpustate->_F & ZF, 0xcc );                           } /* CALL Z,a         */
@@ -327,6 +327,9 @@ int take_interrupt(struct z280_state *cpustate, int irq)
 {
 	int cycles = 0;
 	UINT32 irq_vector;
+	UINT16 ssp = cpustate->_SSP;
+
+	cpustate->stats.interrupts[irq]++;
 
 	/* there isn't a valid previous program counter */
 	cpustate->_PPC = -1;
@@ -526,6 +529,7 @@ int take_interrupt(struct z280_state *cpustate, int irq)
 		cycles += cpustate->cc[Z280_TABLE_op][0xcd];
 	}
 	CHECK_SSO(cpustate);
+	CALL_HOOK(Z280_CG_INT, ssp);
 	return cycles;
 }
 
@@ -581,6 +585,10 @@ int take_trap(struct z280_state *cpustate, int trap)
 {
 	int cycles;
 	union PAIR tmp;
+	UINT16 ssp = cpustate->_SSP;
+	cpustate->stats.traps[trap]++;
+	if (z280_trap_hook)
+		z280_trap_hook(cpustate->device, trap);
 	switch (trap)
 	{
 		case Z280_TRAP_SS:
@@ -630,11 +638,15 @@ int take_trap(struct z280_state *cpustate, int trap)
 			cycles = 31;
 			break;
 	}
+	CALL_HOOK(Z280_CG_TRAP, ssp);
 	return cycles;
 }
 
 int take_fatal(struct z280_state *cpustate)
 {
+	cpustate->stats.traps[Z280_TRAP_FATAL]++;
+	if (z280_trap_hook)
+		z280_trap_hook(cpustate->device, Z280_TRAP_FATAL);
 	cpustate->_HL = cpustate->_PPC;
 	cpustate->_DE = MSR(cpustate);
 	cpustate->cr[Z280_MSR] &= ~Z280_MSR_IREMASK;
@@ -135,6 +135,7 @@ INLINE offs_t MMU_REMAP_ADDR(struct z280_state *cpustate, offs_t addr, int progr
 	if (is_user(cpustate)) // User mode
 	{
 		if (MMUMCR(cpustate) & Z280_MMUMCR_UTE) {
+			cpustate->stats.mmu++;
 			if (MMUMCR(cpustate) & Z280_MMUMCR_UPD)
 				res = mmu_translate_separate(cpustate, addr, Z280_MSR_US_USER, program);
 			else
@@ -170,6 +171,7 @@ INLINE offs_t MMU_REMAP_ADDR(struct z280_state *cpustate, offs_t addr, int progr
 	else // System mode
 	{
 		if (MMUMCR(cpustate) & Z280_MMUMCR_STE) {
+			cpustate->stats.mmu++;
 			if (MMUMCR(cpustate) & Z280_MMUMCR_SPD)
 				res = mmu_translate_separate(cpustate, addr, Z280_MSR_US_SYSTEM, program);
 			else
@@ -211,6 +213,7 @@ INLINE offs_t MMU_REMAP_ADDR_LDU(struct z280_state *cpustate, offs_t addr, int p
 	offs_t res;
 	// assume system mode
 	if (MMUMCR(cpustate) & Z280_MMUMCR_UTE) {
+		cpustate->stats.mmu++;
 		if (MMUMCR(cpustate) & Z280_MMUMCR_UPD)
 			res = mmu_translate_separate(cpustate, addr, Z280_MSR_US_USER, program);
 		else
@@ -422,6 +425,11 @@ INLINE UINT32 ARG16(struct z280_state *cpustate)
 #define PUSH_R(cs,SR) { WM16(cs, _SPD(cs)-2, &(cs)->SR); DEC2_SP(cs); }
 #define PUSH(cs,SR) { PUSH_R(cs,SR); if(is_system(cs)) CHECK_SSO(cs); }
 
+/***************************************************************
+ * CALL_HOOK  report control flow to the call graph profiler
+ ***************************************************************/
+#define CALL_HOOK(kind,sp) if (z280_call_hook) z280_call_hook(cpustate->device, kind, sp)
+
 /***************************************************************
  * JP
  ***************************************************************/
@@ -494,7 +502,8 @@ INLINE UINT32 ARG16(struct z280_state *cpustate)
 	cpustate->ea = ARG16(cpustate);                                             \
 	PUSH_R(cpustate,  PC );                                               \
 	cpustate->_PCD = cpustate->ea;								\
-	if(is_system(cpustate)) CHECK_SSO(cpustate);
+	if(is_system(cpustate)) CHECK_SSO(cpustate);                \
+	CALL_HOOK(Z280_CG_CALL, _SPD(cpustate)+2);
 
 /***************************************************************
  * CALL_COND
@@ -516,6 +525,7 @@ INLINE UINT32 ARG16(struct z280_state *cpustate)
 		PUSH_R(cpustate,  PC );                                               \
 		cpustate->_PCD = cpustate->_HL;                                              \
 		if(is_system(cpustate)) CHECK_SSO(cpustate);            \
+		CALL_HOOK(Z280_CG_CALL, _SPD(cpustate)+2);              \
 		CC(ex,opcode);                                          \
 	}                                                           \
 	else                                                        \
@@ -529,6 +539,7 @@ INLINE UINT32 ARG16(struct z280_state *cpustate)
 		PUSH_R(cpustate,  PC );                                               \
 		EARA(cpustate); cpustate->_PCD = cpustate->ea;            \
 		if(is_system(cpustate)) CHECK_SSO(cpustate);            \
+		CALL_HOOK(Z280_CG_CALL, _SPD(cpustate)+2);              \
 		CC(ex,opcode);                                          \
 	}                                                           \
 	else                                                        \
@@ -543,6 +554,7 @@ INLINE UINT32 ARG16(struct z280_state *cpustate)
 	if( cond )                                                  \
 	{                                                           \
 		POP(cpustate, PC);                                              \
+		CALL_HOOK(Z280_CG_RET, _SPD(cpustate));                 \
 		CC(ex,opcode);                                          \
 	}
 
@@ -557,6 +569,7 @@ INLINE UINT32 ARG16(struct z280_state *cpustate)
 		POP(cpustate, PC);                                                  \
 		cpustate->cr[Z280_MSR] = (cpustate->cr[Z280_MSR] & ~Z280_MSR_IREMASK) | \
 			cpustate->IFF2;                                                \
+		CALL_HOOK(Z280_CG_RET, _SPD(cpustate));                 \
 	}															\
 }
 
@@ -571,6 +584,7 @@ INLINE UINT32 ARG16(struct z280_state *cpustate)
 /*  	cpustate->IFF1 = cpustate->IFF2;  */                                            \
 		if (cpustate->daisy != NULL)						\
 			z80_daisy_chain_call_reti_device(cpustate->daisy);                 \
+		CALL_HOOK(Z280_CG_RET, _SPD(cpustate));                 \
 	}															\
 }
 
@@ -584,6 +598,7 @@ INLINE UINT32 ARG16(struct z280_state *cpustate)
 		if(is_system(cpustate)) (cpustate)->_SSP += 4; else (cpustate)->_USP += 4;   \
 		MSR(cpustate) = tmp.w.l;                   \
 		cpustate->_PC = tmp2.w.l;                   \
+		CALL_HOOK(Z280_CG_RETIL, (cpustate)->_SSP);             \
 	}															\
 }
 
@@ -691,7 +706,8 @@ INLINE UINT32 ARG16(struct z280_state *cpustate)
 #define RST(addr)                                               \
 	PUSH_R(cpustate,  PC );                                            \
 	cpustate->_PCD = addr;										 \
-	if(is_system(cpustate)) CHECK_SSO(cpustate);
+	if(is_system(cpustate)) CHECK_SSO(cpustate);                \
+	CALL_HOOK(Z280_CG_CALL, _SPD(cpustate)+2);
 
 
 /***************************************************************
@@ -1096,7 +1112,7 @@ INLINE UINT8 DEC(struct z280_state *cpustate, UINT8 value)
  ***************************************************************/
 #define DIV(value)                                              \
 {                                                               \
-    int16_t ivalue = (int16_t)value;                             \
+    int16_t ivalue = (int16_t)(INT8)value;                       \
     if (ivalue == 0)												\
 	{															\
 	   cpustate->_F = (cpustate->_F & (HF | NF)) |        \
@@ -1139,7 +1155,7 @@ INLINE UINT8 DEC(struct z280_state *cpustate, UINT8 value)
 	else                                                        \
 	{                                                           \
 	   UINT16 quot = cpustate->_HL / uvalue;         \
-	   if (quot<128)							\
+	   if (quot<256)							\
 	   {													\
 	      UINT16 rem = cpustate->_HL % uvalue;      \
 	      cpustate->_F = (cpustate->_F & (HF | NF)) |        \
@@ -1161,7 +1177,7 @@ INLINE UINT8 DEC(struct z280_state *cpustate, UINT8 value)
  ***************************************************************/
 #define DIVW(value)                                              \
 {                                                               \
-    INT32 ivalue = (INT32)value;                                 \
+    INT32 ivalue = (INT32)(int16_t)value;                        \
 	if (ivalue == 0)												\
 	{															\
 	   cpustate->_F = (cpustate->_F & (HF | NF)) |        \
@@ -1171,7 +1187,7 @@ INLINE UINT8 DEC(struct z280_state *cpustate, UINT8 value)
 	else                                                        \
 	{                                                           \
 	   UINT32 src = (cpustate->_DE << 16) | cpustate->_HL;   \
-	   INT32 quot = (INT32)src / ivalue;                      \
+	   int64_t quot = (int64_t)(INT32)src / ivalue;           \
 	   if (quot>=-32768&&quot<32768)							\
 	   {													\
 	      /* remainder has same sign as dividend, this is compliant to C99  */ 		  \
@@ -1206,7 +1222,7 @@ INLINE UINT8 DEC(struct z280_state *cpustate, UINT8 value)
 	{                                                           \
 	   UINT32 src = (cpustate->_DE << 16) | cpustate->_HL;   \
 	   UINT32 quot = src / uvalue;                           \
-	   if (quot<32768)							\
+	   if (quot<65536)							\
 	   {													\
 	      UINT32 rem = src % uvalue;                          \
 	      cpustate->_F = (cpustate->_F & (HF | NF)) |        \
@@ -333,12 +333,32 @@ void (*const Z280ops[Z280_PREFIX_COUNT][0x100])(struct z280_state *cpustate) =
  * execute an opcode
  ***************************************************************/
 
+#ifdef Z280_OPSTATS
+/* the extra cycles of a prefix opcode include the whole instruction it
+   dispatches to, so what nested exec_* calls counted is taken off */
+#define EXEC_PROTOTYPE(prefix) \
+INLINE int exec##_##prefix(struct z280_state *cpustate, const UINT8 opcode)    \
+{                                                                       \
+	struct z280_opstat *s = &z280_opstats[Z280_PREFIX_##prefix][opcode];  \
+	int cycles = cpustate->cc[Z280_TABLE_##prefix][opcode];             \
+	int extra = cpustate->extra_cycles;                                 \
+	unsigned long long nested = z280_opstats_cycles;                    \
+	(*Z280ops[Z280_PREFIX_##prefix][opcode])(cpustate);                                     \
+	extra = cpustate->extra_cycles - extra - (int)(z280_opstats_cycles - nested); \
+	s->count++;                                                         \
+	s->cycles += cycles + extra;                                        \
+	s->extra += extra;                                                  \
+	z280_opstats_cycles += cycles + extra;                              \
+	return cycles;                                                      \
+}
+#else
 #define EXEC_PROTOTYPE(prefix) \
 INLINE int exec##_##prefix(struct z280_state *cpustate, const UINT8 opcode)    \
 {                                                                       \
 	(*Z280ops[Z280_PREFIX_##prefix][opcode])(cpustate);                                     \
 	return cpustate->cc[Z280_TABLE_##prefix][opcode];                   \
 }
+#endif
 
 EXEC_PROTOTYPE(op)
 EXEC_PROTOTYPE(cb)
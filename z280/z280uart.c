@@ -597,3 +597,71 @@ void z280uart_device_update_serial(struct z280uart_device *d)
 	LOG("   - BRG rate %d\n", d->m_brg_rate);
 	set_rcv_rate(d,d->m_brg_rate);
 }
+
+
+//-------------------------------------------------
+//  snapshot support
+//-------------------------------------------------
+static char snap_module_name[] = "Z280UART";
+#define SNAP_MAJOR 0
+#define SNAP_MINOR 0
+
+int z280uart_device_write_snapshot(struct z280uart_device *d, snapshot_t *s)
+{
+	snapshot_module_t *m = snapshot_module_create(s, snap_module_name, SNAP_MAJOR, SNAP_MINOR);
+
+	if (m == NULL)
+		return -1;
+	if (0
+		|| SMW_B(m, d->m_uartcr) < 0
+		|| SMW_B(m, d->m_tcsr) < 0
+		|| SMW_B(m, d->m_rcsr) < 0
+		|| SMW_W(m, d->m_clock_divisor) < 0
+		|| SMW_W(m, d->m_timer) < 0
+		|| SMW_DW(m, d->m_brg_rate) < 0
+		|| SMW_B(m, d->rx_bits_rem) < 0
+		|| SMW_B(m, d->rx_data) < 0
+		|| SMW_B(m, d->m_rdr) < 0
+		|| SMW_B(m, d->tx_bits_rem) < 0
+		|| SMW_B(m, d->tx_data) < 0
+		|| SMW_B(m, d->m_tdr) < 0
+		|| SMW_B(m, d->m_bit_count) < 0) {
+		snapshot_module_close(m);
+		return -1;
+	}
+	return snapshot_module_close(m);
+}
+
+int z280uart_device_read_snapshot(struct z280uart_device *d, snapshot_t *s)
+{
+	uint8_t vmajor, vminor;
+	snapshot_module_t *m = snapshot_module_open(s, snap_module_name, &vmajor, &vminor);
+
+	if (m == NULL)
+		return -1;
+	if (vmajor > SNAP_MAJOR || vminor > SNAP_MINOR) {
+		snapshot_set_error(SNAPSHOT_MODULE_HIGHER_VERSION);
+		goto fail;
+	}
+	if (0
+		|| SMR_B(m, &d->m_uartcr) < 0
+		|| SMR_B(m, &d->m_tcsr) < 0
+		|| SMR_B(m, &d->m_rcsr) < 0
+		|| SMR_W(m, &d->m_clock_divisor) < 0
+		|| SMR_W(m, &d->m_timer) < 0
+		|| SMR_DW(m, &d->m_brg_rate) < 0
+		|| SMR_B(m, &d->rx_bits_rem) < 0
+		|| SMR_B(m, &d->rx_data) < 0
+		|| SMR_B(m, &d->m_rdr) < 0
+		|| SMR_B(m, &d->tx_bits_rem) < 0
+		|| SMR_B(m, &d->tx_data) < 0
+		|| SMR_B(m, &d->m_tdr) < 0
+		|| SMR_B(m, &d->m_bit_count) < 0) {
+		goto fail;
+	}
+	return snapshot_module_close(m);
+
+fail:
+	snapshot_module_close(m);
+	return -1;
+}
@@ -15,6 +15,8 @@
 
 #pragma once
 
+#include "../snapshot/snapshot.h"
+
 // ======================> z280uart_device
 
 typedef void (*tx_callback_t)(device_t *device, int channel, UINT8 data);
@@ -72,5 +74,7 @@ void z280uart_device_reset(struct z280uart_device *device);
 void z280uart_device_timer(struct z280uart_device *device /*, emu_timer *timer, device_timer_id id, int param, void *ptr*/);
 uint8_t z280uart_device_register_read(struct z280uart_device *device, uint8_t reg);
 void z280uart_device_register_write(struct z280uart_device *device, uint8_t reg, uint8_t data);
+int z280uart_device_write_snapshot(struct z280uart_device *device, snapshot_t *s);
+int z280uart_device_read_snapshot(struct z280uart_device *device, snapshot_t *s);
 
 #endif // __Z280ASCI_H
@@ -0,0 +1,1303 @@
+/*
+ * z280bench.c - deterministic Z280 core benchmarks
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA
+ *  02111-1307  USA.
+ *
+ */
+
+/*
+   Every benchmark is a small self-checking guest program loaded at 0 into
+   an otherwise empty machine: no ROM, no disk, no sockets. It repeats its
+   work the number of passes stored at 0003h, then reports to BENCH_RESULT
+   and halts. Only the CPU core with its on-chip peripherals runs, so the
+   numbers follow the core alone.
+
+   With -serial, an echo loop runs on the on-chip UART or one QuadSer
+   channel instead, and the host side of the line is a generator in the
+   uart_rx/uart_tx and quadser_rx/quadser_tx callbacks: first it sends
+   SER_ECHOES bytes one at a time for the echo latency, then streams
+   SER_BYTES with SER_WINDOW in flight for the throughput.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <sys/time.h>
+
+#include "z280/z280.h"
+#include "ins8250/ins8250.h"
+
+#define RAM_SIZE 1048576
+UINT8 _ram[RAM_SIZE + 1]; /* + a word read at the very top */
+
+#define BENCH_CLOCK 14745600  /* as on the Z280RC board */
+#define BENCH_SLICE 10000     /* cycles per cpu_execute_z280 call */
+#define BENCH_LIMIT 2000000000ULL /* cycles without a result make a hang */
+#define BENCH_THRESHOLD 10    /* % below the baseline MIPS that fails */
+#define BENCH_REPEAT 3        /* runs of each test, the fastest counts */
+
+/* guest ports */
+#define BENCH_RESULT 0x80 /* byte out: 0 passed, else failed; ends the test */
+#define BENCH_STUB   0x82 /* word in: next word of a sequence, word out: checked
+                             against it, byte out: restart the sequence there */
+#define BENCH_ERRORS 0x83 /* byte in: words out of sequence on BENCH_STUB */
+
+#define SER_BAUDS "9600,38400,115200,max" /* line speeds, max is the fastest divisor */
+#define SER_ECHOES 256        /* bytes echoed one at a time */
+#define SER_BYTES 4096        /* bytes streamed */
+#define SER_WINDOW 16         /* streamed bytes in flight, as in a windowed file transfer */
+#define SER_STALL 20000000ULL /* cycles without an echo that lose the bytes in flight */
+#define SER_QUADBASE 0xd0     /* QuadSer channel n at SER_QUADBASE + 8*n */
+#define INS8250_DIVISOR 4     /* instructions per QuadSer clock, as in z280rc */
+
+/* alu8: 8-bit add/adc/xor/rrca/sbc chain, 256 rounds a pass */
+static const UINT8 prog_alu8[] = {
+	0xC3,0x05,0x00,             /* 0000          jp start           */
+	0x01,0x00,                  /* 0003          dw passes          */
+	0x31,0x00,0x0E,             /* 0005 start:   ld sp,0E00h        */
+	0x06,0x00,                  /* 0008 loop:    ld b,0             */
+	0xAF,                       /* 000A          xor a              */
+	0x4F,                       /* 000B          ld c,a             */
+	0x80,                       /* 000C inner:   add a,b            */
+	0x89,                       /* 000D          adc a,c            */
+	0xEE,0x5A,                  /* 000E          xor 5Ah            */
+	0x0F,                       /* 0010          rrca               */
+	0x98,                       /* 0011          sbc a,b            */
+	0x4F,                       /* 0012          ld c,a             */
+	0x10,0xF7,                  /* 0013          djnz inner         */
+	0xFE,0x9D,                  /* 0015          cp 9Dh             */
+	0xC2,0x29,0x00,             /* 0017          jp nz,fail         */
+	0x2A,0x03,0x00,             /* 001A next:    ld hl,(0003h)      */
+	0x2B,                       /* 001D          dec hl             */
+	0x22,0x03,0x00,             /* 001E          ld (0003h),hl      */
+	0x7C,                       /* 0021          ld a,h             */
+	0xB5,                       /* 0022          or l               */
+	0xC2,0x08,0x00,             /* 0023          jp nz,loop         */
+	0xAF,                       /* 0026 pass:    xor a              */
+	0x18,0x02,                  /* 0027          jr stop            */
+	0x3E,0x01,                  /* 0029 fail:    ld a,1             */
+	0xED,0x77,0x7F,             /* 002B stop:    di 7Fh             */
+	0x0E,0x08,                  /* 002E          ld c,08h           */
+	0x21,0x00,0x00,             /* 0030          ld hl,0            */
+	0xED,0x6E,                  /* 0033          ldctl (c),hl       */
+	0xD3,0x80,                  /* 0035          out (80h),a        */
+	0x76,                       /* 0037          halt               */
+};
+
+/* alu16: 16-bit add/adc/sbc chain, 256 rounds a pass */
+static const UINT8 prog_alu16[] = {
+	0xC3,0x05,0x00,             /* 0000          jp start           */
+	0x01,0x00,                  /* 0003          dw passes          */
+	0x31,0x00,0x0E,             /* 0005 start:   ld sp,0E00h        */
+	0x21,0x00,0x00,             /* 0008 loop:    ld hl,0            */
+	0x11,0x34,0x12,             /* 000B          ld de,1234h        */
+	0x01,0x00,0x00,             /* 000E          ld bc,0            */
+	0xB7,                       /* 0011          or a               */
+	0x19,                       /* 0012 inner:   add hl,de          */
+	0xEB,                       /* 0013          ex de,hl           */
+	0xED,0x5A,                  /* 0014          adc hl,de          */
+	0x23,                       /* 0016          inc hl             */
+	0xED,0x42,                  /* 0017          sbc hl,bc          */
+	0x10,0xF7,                  /* 0019          djnz inner         */
+	0x11,0x4E,0x17,             /* 001B          ld de,174Eh        */
+	0xB7,                       /* 001E          or a               */
+	0xED,0x52,                  /* 001F          sbc hl,de          */
+	0xC2,0x33,0x00,             /* 0021          jp nz,fail         */
+	0x2A,0x03,0x00,             /* 0024 next:    ld hl,(0003h)      */
+	0x2B,                       /* 0027          dec hl             */
+	0x22,0x03,0x00,             /* 0028          ld (0003h),hl      */
+	0x7C,                       /* 002B          ld a,h             */
+	0xB5,                       /* 002C          or l               */
+	0xC2,0x08,0x00,             /* 002D          jp nz,loop         */
+	0xAF,                       /* 0030 pass:    xor a              */
+	0x18,0x02,                  /* 0031          jr stop            */
+	0x3E,0x01,                  /* 0033 fail:    ld a,1             */
+	0xED,0x77,0x7F,             /* 0035 stop:    di 7Fh             */
+	0x0E,0x08,                  /* 0038          ld c,08h           */
+	0x21,0x00,0x00,             /* 003A          ld hl,0            */
+	0xED,0x6E,                  /* 003D          ldctl (c),hl       */
+	0xD3,0x80,                  /* 003F          out (80h),a        */
+	0x76,                       /* 0041          halt               */
+};
+
+/* multdiv: MULTUW/DIVUW and MULTW/DIVW round trips, 256 a pass */
+static const UINT8 prog_multdiv[] = {
+	0xC3,0x05,0x00,             /* 0000          jp start           */
+	0x01,0x00,                  /* 0003          dw passes          */
+	0x31,0x00,0x0E,             /* 0005 start:   ld sp,0E00h        */
+	0xAF,                       /* 0008 loop:    xor a              */
+	0x67,                       /* 0009 inner:   ld h,a             */
+	0x6F,                       /* 000A          ld l,a             */
+	0x23,                       /* 000B          inc hl             */
+	0xE5,                       /* 000C          push hl            */
+	0xE5,                       /* 000D          push hl            */
+	0xE5,                       /* 000E          push hl            */
+	0x01,0x39,0x30,             /* 000F          ld bc,12345        */
+	0xED,0xC3,                  /* 0012          multuw hl,bc       */
+	0xED,0xCB,                  /* 0014          divuw dehl,bc      */
+	0xC1,                       /* 0016          pop bc             */
+	0xA7,                       /* 0017          and a              */
+	0xED,0x42,                  /* 0018          sbc hl,bc          */
+	0xC2,0x4D,0x00,             /* 001A          jp nz,fail         */
+	0x08,                       /* 001D          ex af,af'          */
+	0x7A,                       /* 001E          ld a,d             */
+	0xB3,                       /* 001F          or e               */
+	0xC2,0x4D,0x00,             /* 0020          jp nz,fail         */
+	0x08,                       /* 0023          ex af,af'          */
+	0xE1,                       /* 0024          pop hl             */
+	0x01,0x2E,0xFB,             /* 0025          ld bc,-1234        */
+	0xED,0xC2,                  /* 0028          multw hl,bc        */
+	0xED,0xCA,                  /* 002A          divw dehl,bc       */
+	0xC1,                       /* 002C          pop bc             */
+	0xA7,                       /* 002D          and a              */
+	0xED,0x42,                  /* 002E          sbc hl,bc          */
+	0xC2,0x4D,0x00,             /* 0030          jp nz,fail         */
+	0x08,                       /* 0033          ex af,af'          */
+	0x7A,                       /* 0034          ld a,d             */
+	0xB3,                       /* 0035          or e               */
+	0xC2,0x4D,0x00,             /* 0036          jp nz,fail         */
+	0x08,                       /* 0039          ex af,af'          */
+	0x3D,                       /* 003A          dec a              */
+	0xC2,0x09,0x00,             /* 003B          jp nz,inner        */
+	0x2A,0x03,0x00,             /* 003E next:    ld hl,(0003h)      */
+	0x2B,                       /* 0041          dec hl             */
+	0x22,0x03,0x00,             /* 0042          ld (0003h),hl      */
+	0x7C,                       /* 0045          ld a,h             */
+	0xB5,                       /* 0046          or l               */
+	0xC2,0x08,0x00,             /* 0047          jp nz,loop         */
+	0xAF,                       /* 004A pass:    xor a              */
+	0x18,0x02,                  /* 004B          jr stop            */
+	0x3E,0x01,                  /* 004D fail:    ld a,1             */
+	0xED,0x77,0x7F,             /* 004F stop:    di 7Fh             */
+	0x0E,0x08,                  /* 0052          ld c,08h           */
+	0x21,0x00,0x00,             /* 0054          ld hl,0            */
+	0xED,0x6E,                  /* 0057          ldctl (c),hl       */
+	0xD3,0x80,                  /* 0059          out (80h),a        */
+	0x76,                       /* 005B          halt               */
+};
+
+/* index: (IX+d)/(IY+d) table transform of 256 bytes a pass */
+static const UINT8 prog_index[] = {
+	0xC3,0x05,0x00,             /* 0000          jp start           */
+	0x01,0x00,                  /* 0003          dw passes          */
+	0x31,0x00,0x0E,             /* 0005 start:   ld sp,0E00h        */
+	0x21,0x00,0x20,             /* 0008          ld hl,2000h        */
+	0x75,                       /* 000B fill:    ld (hl),l          */
+	0x2C,                       /* 000C          inc l              */
+	0x20,0xFC,                  /* 000D          jr nz,fill         */
+	0xDD,0x21,0x00,0x20,        /* 000F loop:    ld ix,2000h        */
+	0xFD,0x21,0x00,0x30,        /* 0013          ld iy,3000h        */
+	0x01,0x00,0x00,             /* 0017          ld bc,0            */
+	0xDD,0x7E,0x00,             /* 001A inner:   ld a,(ix+0)        */
+	0xDD,0x86,0x01,             /* 001D          add a,(ix+1)       */
+	0xFD,0x77,0x00,             /* 0020          ld (iy+0),a        */
+	0xFD,0xAE,0xFF,             /* 0023          xor (iy-1)         */
+	0x81,                       /* 0026          add a,c            */
+	0x4F,                       /* 0027          ld c,a             */
+	0xDD,0x23,                  /* 0028          inc ix             */
+	0xFD,0x23,                  /* 002A          inc iy             */
+	0x10,0xEC,                  /* 002C          djnz inner         */
+	0x79,                       /* 002E          ld a,c             */
+	0xFE,0x03,                  /* 002F          cp 03h             */
+	0xC2,0x43,0x00,             /* 0031          jp nz,fail         */
+	0x2A,0x03,0x00,             /* 0034 next:    ld hl,(0003h)      */
+	0x2B,                       /* 0037          dec hl             */
+	0x22,0x03,0x00,             /* 0038          ld (0003h),hl      */
+	0x7C,                       /* 003B          ld a,h             */
+	0xB5,                       /* 003C          or l               */
+	0xC2,0x0F,0x00,             /* 003D          jp nz,loop         */
+	0xAF,                       /* 0040 pass:    xor a              */
+	0x18,0x02,                  /* 0041          jr stop            */
+	0x3E,0x01,                  /* 0043 fail:    ld a,1             */
+	0xED,0x77,0x7F,             /* 0045 stop:    di 7Fh             */
+	0x0E,0x08,                  /* 0048          ld c,08h           */
+	0x21,0x00,0x00,             /* 004A          ld hl,0            */
+	0xED,0x6E,                  /* 004D          ldctl (c),hl       */
+	0xD3,0x80,                  /* 004F          out (80h),a        */
+	0x76,                       /* 0051          halt               */
+};
+
+/* block: LDIR of 4K, then CPIR counting the 16 $FF bytes in the copy */
+static const UINT8 prog_block[] = {
+	0xC3,0x05,0x00,             /* 0000          jp start           */
+	0x01,0x00,                  /* 0003          dw passes          */
+	0x31,0x00,0x0E,             /* 0005 start:   ld sp,0E00h        */
+	0x21,0x00,0x20,             /* 0008          ld hl,2000h        */
+	0x75,                       /* 000B fill:    ld (hl),l          */
+	0x23,                       /* 000C          inc hl             */
+	0x7C,                       /* 000D          ld a,h             */
+	0xFE,0x30,                  /* 000E          cp 30h             */
+	0x20,0xF9,                  /* 0010          jr nz,fill         */
+	0xAF,                       /* 0012 loop:    xor a              */
+	0x32,0xFF,0x40,             /* 0013          ld (40FFh),a       */
+	0x21,0x00,0x20,             /* 0016          ld hl,2000h        */
+	0x11,0x00,0x40,             /* 0019          ld de,4000h        */
+	0x01,0x00,0x10,             /* 001C          ld bc,1000h        */
+	0xED,0xB0,                  /* 001F          ldir               */
+	0x21,0x00,0x40,             /* 0021          ld hl,4000h        */
+	0x01,0x00,0x10,             /* 0024          ld bc,1000h        */
+	0x16,0x00,                  /* 0027          ld d,0             */
+	0x3E,0xFF,                  /* 0029 scan:    ld a,0FFh          */
+	0xED,0xB1,                  /* 002B          cpir               */
+	0x20,0x05,                  /* 002D          jr nz,done         */
+	0x14,                       /* 002F          inc d              */
+	0x78,                       /* 0030          ld a,b             */
+	0xB1,                       /* 0031          or c               */
+	0x20,0xF5,                  /* 0032          jr nz,scan         */
+	0x7A,                       /* 0034 done:    ld a,d             */
+	0xFE,0x10,                  /* 0035          cp 16              */
+	0xC2,0x49,0x00,             /* 0037          jp nz,fail         */
+	0x2A,0x03,0x00,             /* 003A next:    ld hl,(0003h)      */
+	0x2B,                       /* 003D          dec hl             */
+	0x22,0x03,0x00,             /* 003E          ld (0003h),hl      */
+	0x7C,                       /* 0041          ld a,h             */
+	0xB5,                       /* 0042          or l               */
+	0xC2,0x12,0x00,             /* 0043          jp nz,loop         */
+	0xAF,                       /* 0046 pass:    xor a              */
+	0x18,0x02,                  /* 0047          jr stop            */
+	0x3E,0x01,                  /* 0049 fail:    ld a,1             */
+	0xED,0x77,0x7F,             /* 004B stop:    di 7Fh             */
+	0x0E,0x08,                  /* 004E          ld c,08h           */
+	0x21,0x00,0x00,             /* 0050          ld hl,0            */
+	0xED,0x6E,                  /* 0053          ldctl (c),hl       */
+	0xD3,0x80,                  /* 0055          out (80h),a        */
+	0x76,                       /* 0057          halt               */
+};
+
+/* iowords: INIRW of 256 words from the stub port, OTIRW back */
+static const UINT8 prog_iowords[] = {
+	0xC3,0x05,0x00,             /* 0000          jp start           */
+	0x01,0x00,                  /* 0003          dw passes          */
+	0x31,0x00,0x0E,             /* 0005 start:   ld sp,0E00h        */
+	0xAF,                       /* 0008 loop:    xor a              */
+	0xD3,0x82,                  /* 0009          out (82h),a        */
+	0x21,0x00,0x50,             /* 000B          ld hl,5000h        */
+	0x01,0x82,0x00,             /* 000E          ld bc,0082h        */
+	0xED,0x92,                  /* 0011          inirw              */
+	0x2A,0xFE,0x51,             /* 0013          ld hl,(51FEh)      */
+	0x11,0xFF,0x00,             /* 0016          ld de,00FFh        */
+	0xB7,                       /* 0019          or a               */
+	0xED,0x52,                  /* 001A          sbc hl,de          */
+	0xC2,0x3C,0x00,             /* 001C          jp nz,fail         */
+	0x21,0x00,0x50,             /* 001F          ld hl,5000h        */
+	0x01,0x82,0x00,             /* 0022          ld bc,0082h        */
+	0xED,0x93,                  /* 0025          otirw              */
+	0xDB,0x83,                  /* 0027          in a,(83h)         */
+	0xB7,                       /* 0029          or a               */
+	0xC2,0x3C,0x00,             /* 002A          jp nz,fail         */
+	0x2A,0x03,0x00,             /* 002D next:    ld hl,(0003h)      */
+	0x2B,                       /* 0030          dec hl             */
+	0x22,0x03,0x00,             /* 0031          ld (0003h),hl      */
+	0x7C,                       /* 0034          ld a,h             */
+	0xB5,                       /* 0035          or l               */
+	0xC2,0x08,0x00,             /* 0036          jp nz,loop         */
+	0xAF,                       /* 0039 pass:    xor a              */
+	0x18,0x02,                  /* 003A          jr stop            */
+	0x3E,0x01,                  /* 003C fail:    ld a,1             */
+	0xED,0x77,0x7F,             /* 003E stop:    di 7Fh             */
+	0x0E,0x08,                  /* 0041          ld c,08h           */
+	0x21,0x00,0x00,             /* 0043          ld hl,0            */
+	0xED,0x6E,                  /* 0046          ldctl (c),hl       */
+	0xD3,0x80,                  /* 0048          out (80h),a        */
+	0x76,                       /* 004A          halt               */
+};
+
+/* mmu: two user tasks in 4K pages, switched by SC, 256 switches a pass */
+static const UINT8 prog_mmu[] = {
+	0xC3,0x05,0x00,             /* 0000          jp start           */
+	0x01,0x00,                  /* 0003          dw passes          */
+	0x31,0x00,0x0E,             /* 0005 start:   ld sp,0E00h        */
+	0x0E,0x06,                  /* 0008          ld c,06h           */
+	0x21,0x10,0x00,             /* 000A          ld hl,0010h        */
+	0xED,0x6E,                  /* 000D          ldctl (c),hl       */
+	0x21,0x00,0x00,             /* 000F          ld hl,0            */
+	0x22,0x50,0x10,             /* 0012          ld (1050h),hl      */
+	0x21,0xA7,0x00,             /* 0015          ld hl,sc_trap      */
+	0x22,0x52,0x10,             /* 0018          ld (1052h),hl      */
+	0x21,0xCD,0x00,             /* 001B          ld hl,task         */
+	0x11,0x00,0x80,             /* 001E          ld de,8000h        */
+	0x01,0x11,0x00,             /* 0021          ld bc,17           */
+	0xED,0xB0,                  /* 0024          ldir               */
+	0x21,0xCD,0x00,             /* 0026          ld hl,task         */
+	0x11,0x00,0x90,             /* 0029          ld de,9000h        */
+	0x01,0x11,0x00,             /* 002C          ld bc,17           */
+	0xED,0xB0,                  /* 002F          ldir               */
+	0x0E,0x08,                  /* 0031          ld c,08h           */
+	0x21,0xFF,0x00,             /* 0033          ld hl,00FFh        */
+	0xED,0x6E,                  /* 0036          ldctl (c),hl       */
+	0x0E,0xF0,                  /* 0038          ld c,0F0h          */
+	0x21,0x00,0x80,             /* 003A          ld hl,8000h        */
+	0xED,0xBF,                  /* 003D          outw (c),hl        */
+	0x21,0x00,0x00,             /* 003F loop:    ld hl,0            */
+	0x22,0x00,0x81,             /* 0042          ld (8100h),hl      */
+	0x22,0x00,0x91,             /* 0045          ld (9100h),hl      */
+	0x22,0x00,0x0F,             /* 0048          ld (0F00h),hl      */
+	0x21,0x00,0x01,             /* 004B          ld hl,256          */
+	0x22,0x04,0x0F,             /* 004E          ld (0F04h),hl      */
+	0x21,0x88,0x00,             /* 0051          ld hl,0088h        */
+	0x22,0x02,0x0F,             /* 0054          ld (0F02h),hl      */
+	0xCD,0x9A,0x00,             /* 0057          call setpdr        */
+	0x21,0x00,0x00,             /* 005A          ld hl,0            */
+	0xE5,                       /* 005D          push hl            */
+	0x21,0x00,0x40,             /* 005E          ld hl,4000h        */
+	0xE5,                       /* 0061          push hl            */
+	0xED,0x55,                  /* 0062          retil              */
+	0x31,0x00,0x0E,             /* 0064 back:    ld sp,0E00h        */
+	0x2A,0x00,0x81,             /* 0067          ld hl,(8100h)      */
+	0x11,0x80,0x00,             /* 006A          ld de,128          */
+	0xB7,                       /* 006D          or a               */
+	0xED,0x52,                  /* 006E          sbc hl,de          */
+	0xC2,0x8B,0x00,             /* 0070          jp nz,fail         */
+	0x2A,0x00,0x91,             /* 0073          ld hl,(9100h)      */
+	0xB7,                       /* 0076          or a               */
+	0xED,0x52,                  /* 0077          sbc hl,de          */
+	0xC2,0x8B,0x00,             /* 0079          jp nz,fail         */
+	0x2A,0x03,0x00,             /* 007C next:    ld hl,(0003h)      */
+	0x2B,                       /* 007F          dec hl             */
+	0x22,0x03,0x00,             /* 0080          ld (0003h),hl      */
+	0x7C,                       /* 0083          ld a,h             */
+	0xB5,                       /* 0084          or l               */
+	0xC2,0x3F,0x00,             /* 0085          jp nz,loop         */
+	0xAF,                       /* 0088 pass:    xor a              */
+	0x18,0x02,                  /* 0089          jr stop            */
+	0x3E,0x01,                  /* 008B fail:    ld a,1             */
+	0xED,0x77,0x7F,             /* 008D stop:    di 7Fh             */
+	0x0E,0x08,                  /* 0090          ld c,08h           */
+	0x21,0x00,0x00,             /* 0092          ld hl,0            */
+	0xED,0x6E,                  /* 0095          ldctl (c),hl       */
+	0xD3,0x80,                  /* 0097          out (80h),a        */
+	0x76,                       /* 0099          halt               */
+	0xAF,                       /* 009A setpdr:  xor a              */
+	0x0E,0xF1,                  /* 009B          ld c,0F1h          */
+	0xED,0x79,                  /* 009D          out (c),a          */
+	0x2A,0x02,0x0F,             /* 009F          ld hl,(0F02h)      */
+	0x0E,0xF5,                  /* 00A2          ld c,0F5h          */
+	0xED,0xBF,                  /* 00A4          outw (c),hl        */
+	0xC9,                       /* 00A6          ret                */
+	0x33,                       /* 00A7 sc_trap: inc sp             */
+	0x33,                       /* 00A8          inc sp             */
+	0xD1,                       /* 00A9          pop de             */
+	0xE1,                       /* 00AA          pop hl             */
+	0xED,0x4B,0x00,0x0F,        /* 00AB          ld bc,(0F00h)      */
+	0x22,0x00,0x0F,             /* 00AF          ld (0F00h),hl      */
+	0xC5,                       /* 00B2          push bc            */
+	0xD5,                       /* 00B3          push de            */
+	0x3A,0x02,0x0F,             /* 00B4          ld a,(0F02h)       */
+	0xEE,0x10,                  /* 00B7          xor 10h            */
+	0x32,0x02,0x0F,             /* 00B9          ld (0F02h),a       */
+	0xCD,0x9A,0x00,             /* 00BC          call setpdr        */
+	0x2A,0x04,0x0F,             /* 00BF          ld hl,(0F04h)      */
+	0x2B,                       /* 00C2          dec hl             */
+	0x22,0x04,0x0F,             /* 00C3          ld (0F04h),hl      */
+	0x7C,                       /* 00C6          ld a,h             */
+	0xB5,                       /* 00C7          or l               */
+	0xCA,0x64,0x00,             /* 00C8          jp z,back          */
+	0xED,0x55,                  /* 00CB          retil              */
+	0x2A,0x00,0x01,             /* 00CD task:    ld hl,(0100h)      */
+	0x23,                       /* 00D0          inc hl             */
+	0x22,0x00,0x01,             /* 00D1          ld (0100h),hl      */
+	0x06,0x20,                  /* 00D4          ld b,20h           */
+	0x10,0xFE,                  /* 00D6 delay:   djnz delay         */
+	0xED,0x71,0x00,0x00,        /* 00D8          sc 0               */
+	0x18,0xEF,                  /* 00DC          jr task            */
+};
+
+/* im3: CT0 interrupts every 1024 cycles in mode 3 over alu8 work, 64 a pass */
+static const UINT8 prog_im3[] = {
+	0xC3,0x05,0x00,             /* 0000          jp start           */
+	0x01,0x00,                  /* 0003          dw passes          */
+	0x31,0x00,0x0E,             /* 0005 start:   ld sp,0E00h        */
+	0x0E,0x06,                  /* 0008          ld c,06h           */
+	0x21,0x10,0x00,             /* 000A          ld hl,0010h        */
+	0xED,0x6E,                  /* 000D          ldctl (c),hl       */
+	0x21,0x00,0x00,             /* 000F          ld hl,0            */
+	0x22,0x14,0x10,             /* 0012          ld (1014h),hl      */
+	0x21,0x7B,0x00,             /* 0015          ld hl,isr          */
+	0x22,0x16,0x10,             /* 0018          ld (1016h),hl      */
+	0xED,0x4E,                  /* 001B          im 3               */
+	0x0E,0x08,                  /* 001D          ld c,08h           */
+	0x21,0xFE,0x00,             /* 001F          ld hl,00FEh        */
+	0xED,0x6E,                  /* 0022          ldctl (c),hl       */
+	0x0E,0xE0,                  /* 0024          ld c,0E0h          */
+	0x3E,0xA0,                  /* 0026          ld a,0A0h          */
+	0xED,0x79,                  /* 0028          out (c),a          */
+	0x0E,0xE2,                  /* 002A          ld c,0E2h          */
+	0x21,0x00,0x01,             /* 002C          ld hl,0100h        */
+	0xED,0xBF,                  /* 002F          outw (c),hl        */
+	0x0E,0xE1,                  /* 0031          ld c,0E1h          */
+	0x3E,0xE0,                  /* 0033          ld a,0E0h          */
+	0xED,0x79,                  /* 0035          out (c),a          */
+	0xED,0x7F,0x02,             /* 0037          ei 02h             */
+	0x21,0x00,0x00,             /* 003A loop:    ld hl,0            */
+	0x22,0x00,0x0F,             /* 003D          ld (0F00h),hl      */
+	0x06,0x00,                  /* 0040 work:    ld b,0             */
+	0xAF,                       /* 0042          xor a              */
+	0x4F,                       /* 0043          ld c,a             */
+	0x80,                       /* 0044 inner:   add a,b            */
+	0x89,                       /* 0045          adc a,c            */
+	0xEE,0x5A,                  /* 0046          xor 5Ah            */
+	0x0F,                       /* 0048          rrca               */
+	0x98,                       /* 0049          sbc a,b            */
+	0x4F,                       /* 004A          ld c,a             */
+	0x10,0xF7,                  /* 004B          djnz inner         */
+	0xFE,0x9D,                  /* 004D          cp 9Dh             */
+	0xC2,0x6C,0x00,             /* 004F          jp nz,fail         */
+	0x2A,0x00,0x0F,             /* 0052          ld hl,(0F00h)      */
+	0x11,0x40,0x00,             /* 0055          ld de,64           */
+	0xB7,                       /* 0058          or a               */
+	0xED,0x52,                  /* 0059          sbc hl,de          */
+	0x38,0xE3,                  /* 005B          jr c,work          */
+	0x2A,0x03,0x00,             /* 005D next:    ld hl,(0003h)      */
+	0x2B,                       /* 0060          dec hl             */
+	0x22,0x03,0x00,             /* 0061          ld (0003h),hl      */
+	0x7C,                       /* 0064          ld a,h             */
+	0xB5,                       /* 0065          or l               */
+	0xC2,0x3A,0x00,             /* 0066          jp nz,loop         */
+	0xAF,                       /* 0069 pass:    xor a              */
+	0x18,0x02,                  /* 006A          jr stop            */
+	0x3E,0x01,                  /* 006C fail:    ld a,1             */
+	0xED,0x77,0x7F,             /* 006E stop:    di 7Fh             */
+	0x0E,0x08,                  /* 0071          ld c,08h           */
+	0x21,0x00,0x00,             /* 0073          ld hl,0            */
+	0xED,0x6E,                  /* 0076          ldctl (c),hl       */
+	0xD3,0x80,                  /* 0078          out (80h),a        */
+	0x76,                       /* 007A          halt               */
+	0x33,                       /* 007B isr:     inc sp             */
+	0x33,                       /* 007C          inc sp             */
+	0xF5,                       /* 007D          push af            */
+	0xE5,                       /* 007E          push hl            */
+	0xC5,                       /* 007F          push bc            */
+	0x2A,0x00,0x0F,             /* 0080          ld hl,(0F00h)      */
+	0x23,                       /* 0083          inc hl             */
+	0x22,0x00,0x0F,             /* 0084          ld (0F00h),hl      */
+	0x0E,0xE1,                  /* 0087          ld c,0E1h          */
+	0x3E,0xC0,                  /* 0089          ld a,0C0h          */
+	0xED,0x79,                  /* 008B          out (c),a          */
+	0xC1,                       /* 008D          pop bc             */
+	0xE1,                       /* 008E          pop hl             */
+	0xF1,                       /* 008F          pop af             */
+	0xED,0x55,                  /* 0090          retil              */
+};
+
+/* dma: DMA0 copies 4K, DMA1 copies the copy, memory to memory */
+static const UINT8 prog_dma[] = {
+	0xC3,0x05,0x00,             /* 0000          jp start           */
+	0x01,0x00,                  /* 0003          dw passes          */
+	0x31,0x00,0x0E,             /* 0005 start:   ld sp,0E00h        */
+	0x21,0x00,0x20,             /* 0008          ld hl,2000h        */
+	0x75,                       /* 000B fill:    ld (hl),l          */
+	0x23,                       /* 000C          inc hl             */
+	0x7C,                       /* 000D          ld a,h             */
+	0xFE,0x30,                  /* 000E          cp 30h             */
+	0x20,0xF9,                  /* 0010          jr nz,fill         */
+	0x0E,0x08,                  /* 0012          ld c,08h           */
+	0x21,0xFF,0x00,             /* 0014          ld hl,00FFh        */
+	0xED,0x6E,                  /* 0017          ldctl (c),hl       */
+	0x3E,0x55,                  /* 0019 loop:    ld a,55h           */
+	0x32,0xFF,0x4F,             /* 001B          ld (4FFFh),a       */
+	0x32,0x00,0x60,             /* 001E          ld (6000h),a       */
+	0x32,0xFF,0x6F,             /* 0021          ld (6FFFh),a       */
+	0x0E,0x00,                  /* 0024          ld c,00h           */
+	0x21,0x00,0x00,             /* 0026          ld hl,0000h        */
+	0xED,0xBF,                  /* 0029          outw (c),hl        */
+	0x0E,0x01,                  /* 002B          ld c,01h           */
+	0x21,0x40,0x00,             /* 002D          ld hl,0040h        */
+	0xED,0xBF,                  /* 0030          outw (c),hl        */
+	0x0E,0x02,                  /* 0032          ld c,02h           */
+	0x21,0x00,0x00,             /* 0034          ld hl,0000h        */
+	0xED,0xBF,                  /* 0037          outw (c),hl        */
+	0x0E,0x03,                  /* 0039          ld c,03h           */
+	0x21,0x20,0x00,             /* 003B          ld hl,0020h        */
+	0xED,0xBF,                  /* 003E          outw (c),hl        */
+	0x0E,0x04,                  /* 0040          ld c,04h           */
+	0x21,0x00,0x08,             /* 0042          ld hl,0800h        */
+	0xED,0xBF,                  /* 0045          outw (c),hl        */
+	0x0E,0x05,                  /* 0047          ld c,05h           */
+	0x21,0x00,0x83,             /* 0049          ld hl,8300h        */
+	0xED,0xBF,                  /* 004C          outw (c),hl        */
+	0x0E,0x08,                  /* 004E          ld c,08h           */
+	0x21,0x00,0x00,             /* 0050          ld hl,0000h        */
+	0xED,0xBF,                  /* 0053          outw (c),hl        */
+	0x0E,0x09,                  /* 0055          ld c,09h           */
+	0x21,0x60,0x00,             /* 0057          ld hl,0060h        */
+	0xED,0xBF,                  /* 005A          outw (c),hl        */
+	0x0E,0x0A,                  /* 005C          ld c,0Ah           */
+	0x21,0x00,0x00,             /* 005E          ld hl,0000h        */
+	0xED,0xBF,                  /* 0061          outw (c),hl        */
+	0x0E,0x0B,                  /* 0063          ld c,0Bh           */
+	0x21,0x40,0x00,             /* 0065          ld hl,0040h        */
+	0xED,0xBF,                  /* 0068          outw (c),hl        */
+	0x0E,0x0C,                  /* 006A          ld c,0Ch           */
+	0x21,0x00,0x08,             /* 006C          ld hl,0800h        */
+	0xED,0xBF,                  /* 006F          outw (c),hl        */
+	0x0E,0x0D,                  /* 0071          ld c,0Dh           */
+	0x21,0x00,0x83,             /* 0073          ld hl,8300h        */
+	0xED,0xBF,                  /* 0076          outw (c),hl        */
+	0x0E,0x1F,                  /* 0078          ld c,1Fh           */
+	0x21,0x60,0x00,             /* 007A          ld hl,0060h        */
+	0xED,0xBF,                  /* 007D          outw (c),hl        */
+	0x0E,0x0D,                  /* 007F wait:    ld c,0Dh           */
+	0xED,0xB7,                  /* 0081          inw hl,(c)         */
+	0xCB,0x7C,                  /* 0083          bit 7,h            */
+	0x20,0xF8,                  /* 0085          jr nz,wait         */
+	0x0E,0x1F,                  /* 0087          ld c,1Fh           */
+	0x21,0x00,0x00,             /* 0089          ld hl,0            */
+	0xED,0xBF,                  /* 008C          outw (c),hl        */
+	0x3A,0xFF,0x4F,             /* 008E          ld a,(4FFFh)       */
+	0xFE,0xFF,                  /* 0091          cp 0FFh            */
+	0xC2,0xB4,0x00,             /* 0093          jp nz,fail         */
+	0x3A,0xFF,0x6F,             /* 0096          ld a,(6FFFh)       */
+	0xFE,0xFF,                  /* 0099          cp 0FFh            */
+	0xC2,0xB4,0x00,             /* 009B          jp nz,fail         */
+	0x3A,0x00,0x60,             /* 009E          ld a,(6000h)       */
+	0xB7,                       /* 00A1          or a               */
+	0xC2,0xB4,0x00,             /* 00A2          jp nz,fail         */
+	0x2A,0x03,0x00,             /* 00A5 next:    ld hl,(0003h)      */
+	0x2B,                       /* 00A8          dec hl             */
+	0x22,0x03,0x00,             /* 00A9          ld (0003h),hl      */
+	0x7C,                       /* 00AC          ld a,h             */
+	0xB5,                       /* 00AD          or l               */
+	0xC2,0x19,0x00,             /* 00AE          jp nz,loop         */
+	0xAF,                       /* 00B1 pass:    xor a              */
+	0x18,0x02,                  /* 00B2          jr stop            */
+	0x3E,0x01,                  /* 00B4 fail:    ld a,1             */
+	0xED,0x77,0x7F,             /* 00B6 stop:    di 7Fh             */
+	0x0E,0x08,                  /* 00B9          ld c,08h           */
+	0x21,0x00,0x00,             /* 00BB          ld hl,0            */
+	0xED,0x6E,                  /* 00BE          ldctl (c),hl       */
+	0xD3,0x80,                  /* 00C0          out (80h),a        */
+	0x76,                       /* 00C2          halt               */
+};
+
+/* divide: DIV, DIVU, DIVW and DIVUW known answers. A case is db op (0 div hl,c,
+   1 divu hl,c, 2 divw dehl,bc, 3 divuw dehl,bc), dw hl, de, bc, the expected
+   dw hl, de and db S/Z/V flags, +01h if it traps; a failed case reports its number */
+static const UINT8 prog_divide[] = {
+	0xC3,0x05,0x00,             /* 0000          jp start           */
+	0x01,0x00,                  /* 0003          dw passes          */
+	0x31,0x00,0x0E,             /* 0005 start:   ld sp,0E00h        */
+	0x0E,0x06,                  /* 0008          ld c,06h           */
+	0x21,0x10,0x00,             /* 000A          ld hl,0010h        */
+	0xED,0x6E,                  /* 000D          ldctl (c),hl       */
+	0x21,0x00,0x00,             /* 000F          ld hl,0            */
+	0x22,0x44,0x10,             /* 0012          ld (1044h),hl      */
+	0x21,0x82,0x00,             /* 0015          ld hl,trap         */
+	0x22,0x46,0x10,             /* 0018          ld (1046h),hl      */
+	0xDD,0x21,0xB4,0x00,        /* 001B loop:    ld ix,cases        */
+	0xAF,                       /* 001F          xor a              */
+	0x32,0x04,0x0F,             /* 0020          ld (0F04h),a       */
+	0xDD,0x7E,0x00,             /* 0023 case:    ld a,(ix+0)        */
+	0xFE,0xFF,                  /* 0026          cp 0FFh            */
+	0xCA,0x96,0x00,             /* 0028          jp z,next          */
+	0x21,0x04,0x0F,             /* 002B          ld hl,0F04h        */
+	0x34,                       /* 002E          inc (hl)           */
+	0xDD,0x6E,0x01,             /* 002F          ld l,(ix+1)        */
+	0xDD,0x66,0x02,             /* 0032          ld h,(ix+2)        */
+	0xDD,0x5E,0x03,             /* 0035          ld e,(ix+3)        */
+	0xDD,0x56,0x04,             /* 0038          ld d,(ix+4)        */
+	0xDD,0x4E,0x05,             /* 003B          ld c,(ix+5)        */
+	0xDD,0x46,0x06,             /* 003E          ld b,(ix+6)        */
+	0xB7,                       /* 0041          or a               */
+	0x28,0x0E,                  /* 0042          jr z,sdiv8         */
+	0x3D,                       /* 0044          dec a              */
+	0x28,0x0F,                  /* 0045          jr z,udiv8         */
+	0x3D,                       /* 0047          dec a              */
+	0x28,0x04,                  /* 0048          jr z,sdiv16        */
+	0xED,0xCB,                  /* 004A          divuw dehl,bc      */
+	0x18,0x0B,                  /* 004C          jr flags           */
+	0xED,0xCA,                  /* 004E sdiv16:  divw dehl,bc       */
+	0x18,0x07,                  /* 0050          jr flags           */
+	0xED,0xCC,                  /* 0052 sdiv8:   div hl,c           */
+	0x18,0x02,                  /* 0054          jr flags8          */
+	0xED,0xCD,                  /* 0056 udiv8:   divu hl,c          */
+	0x67,                       /* 0058 flags8:  ld h,a             */
+	0xF5,                       /* 0059 flags:   push af            */
+	0xC1,                       /* 005A          pop bc             */
+	0x79,                       /* 005B          ld a,c             */
+	0xE6,0xC4,                  /* 005C          and 0C4h           */
+	0xDD,0xBE,0x0B,             /* 005E          cp (ix+11)         */
+	0x20,0x2E,                  /* 0061          jr nz,bad          */
+	0x7D,                       /* 0063          ld a,l             */
+	0xDD,0xBE,0x07,             /* 0064          cp (ix+7)          */
+	0x20,0x28,                  /* 0067          jr nz,bad          */
+	0x7C,                       /* 0069          ld a,h             */
+	0xDD,0xBE,0x08,             /* 006A          cp (ix+8)          */
+	0x20,0x22,                  /* 006D          jr nz,bad          */
+	0x7B,                       /* 006F          ld a,e             */
+	0xDD,0xBE,0x09,             /* 0070          cp (ix+9)          */
+	0x20,0x1C,                  /* 0073          jr nz,bad          */
+	0x7A,                       /* 0075          ld a,d             */
+	0xDD,0xBE,0x0A,             /* 0076          cp (ix+10)         */
+	0x20,0x16,                  /* 0079          jr nz,bad          */
+	0x01,0x0C,0x00,             /* 007B skip:    ld bc,12           */
+	0xDD,0x09,                  /* 007E          add ix,bc          */
+	0x18,0xA1,                  /* 0080          jr case            */
+	0xF5,                       /* 0082 trap:    push af            */
+	0xC1,                       /* 0083          pop bc             */
+	0x31,0x00,0x0E,             /* 0084          ld sp,0E00h        */
+	0x79,                       /* 0087          ld a,c             */
+	0xE6,0xC4,                  /* 0088          and 0C4h           */
+	0xF6,0x01,                  /* 008A          or 01h             */
+	0xDD,0xBE,0x0B,             /* 008C          cp (ix+11)         */
+	0x28,0xEA,                  /* 008F          jr z,skip          */
+	0x3A,0x04,0x0F,             /* 0091 bad:     ld a,(0F04h)       */
+	0x18,0x11,                  /* 0094          jr stop            */
+	0x2A,0x03,0x00,             /* 0096 next:    ld hl,(0003h)      */
+	0x2B,                       /* 0099          dec hl             */
+	0x22,0x03,0x00,             /* 009A          ld (0003h),hl      */
+	0x7C,                       /* 009D          ld a,h             */
+	0xB5,                       /* 009E          or l               */
+	0xC2,0x1B,0x00,             /* 009F          jp nz,loop         */
+	0xAF,                       /* 00A2 pass:    xor a              */
+	0x18,0x02,                  /* 00A3          jr stop            */
+	0x3E,0x01,                  /* 00A5 fail:    ld a,1             */
+	0xED,0x77,0x7F,             /* 00A7 stop:    di 7Fh             */
+	0x0E,0x08,                  /* 00AA          ld c,08h           */
+	0x21,0x00,0x00,             /* 00AC          ld hl,0            */
+	0xED,0x6E,                  /* 00AF          ldctl (c),hl       */
+	0xD3,0x80,                  /* 00B1          out (80h),a        */
+	0x76,                       /* 00B3          halt               */
+	0x00,0x64,0x00,0x00,0x00,0x07,0x00,0x02,0x0E,0x00,0x00,0x00,/* 00B4 cases:   case 1: div 100/7  */
+	0x00,0x9C,0xFF,0x00,0x00,0x07,0x00,0xFE,0xF2,0x00,0x00,0x80,/* 00C0          case 2: div -100/7 */
+	0x00,0x64,0x00,0x00,0x00,0xF9,0x00,0x02,0xF2,0x00,0x00,0x80,/* 00CC          case 3: div 100/-7 */
+	0x00,0x9C,0xFF,0x00,0x00,0xF9,0x00,0xFE,0x0E,0x00,0x00,0x00,/* 00D8          case 4: div -100/-7 */
+	0x00,0x00,0x00,0x00,0x00,0x05,0x00,0x00,0x00,0x00,0x00,0x40,/* 00E4          case 5: div 0/5    */
+	0x00,0x00,0xFF,0x00,0x00,0x02,0x00,0x00,0x80,0x00,0x00,0x80,/* 00F0          case 6: div -256/2 = -128 */
+	0x00,0xFE,0x00,0x00,0x00,0x02,0x00,0x00,0x7F,0x00,0x00,0x00,/* 00FC          case 7: div 254/2 = 127 */
+	0x00,0x00,0x01,0x00,0x00,0x02,0x00,0x00,0x01,0x00,0x00,0x05,/* 0108          case 8: div 256/2 overflows */
+	0x00,0xFE,0xFE,0x00,0x00,0x02,0x00,0xFE,0xFE,0x00,0x00,0x05,/* 0114          case 9: div -258/2 overflows */
+	0x00,0xE8,0x03,0x00,0x00,0x00,0x00,0xE8,0x03,0x00,0x00,0xC1,/* 0120          case 10: div by 0  */
+	0x01,0xE8,0x03,0x00,0x00,0x07,0x00,0x06,0x8E,0x00,0x00,0x00,/* 012C          case 11: divu 1000/7 = 142 */
+	0x01,0xFF,0xFE,0x00,0x00,0xFF,0x00,0xFE,0xFF,0x00,0x00,0x00,/* 0138          case 12: divu FEFFh/255 = 255 */
+	0x01,0x00,0xFF,0x00,0x00,0xFF,0x00,0x00,0xFF,0x00,0x00,0x05,/* 0144          case 13: divu FF00h/255 overflows */
+	0x01,0xE8,0x03,0x00,0x00,0x00,0x00,0xE8,0x03,0x00,0x00,0xC1,/* 0150          case 14: divu by 0 */
+	0x02,0xA0,0x86,0x01,0x00,0x07,0x00,0xCD,0x37,0x05,0x00,0x00,/* 015C          case 15: divw 100000/7 */
+	0x02,0x60,0x79,0xFE,0xFF,0x07,0x00,0x33,0xC8,0xFB,0xFF,0x80,/* 0168          case 16: divw -100000/7 */
+	0x02,0xA0,0x86,0x01,0x00,0xF9,0xFF,0x33,0xC8,0x05,0x00,0x80,/* 0174          case 17: divw 100000/-7 */
+	0x02,0x60,0x79,0xFE,0xFF,0xF9,0xFF,0xCD,0x37,0xFB,0xFF,0x00,/* 0180          case 18: divw -100000/-7 */
+	0x02,0x00,0x00,0x00,0x00,0x03,0x00,0x00,0x00,0x00,0x00,0x40,/* 018C          case 19: divw 0/3  */
+	0x02,0x00,0x00,0xFF,0xFF,0x02,0x00,0x00,0x80,0x00,0x00,0x80,/* 0198          case 20: divw -65536/2 = -32768 */
+	0x02,0xFE,0xFF,0x00,0x00,0x02,0x00,0xFF,0x7F,0x00,0x00,0x00,/* 01A4          case 21: divw 65534/2 = 32767 */
+	0x02,0x00,0x00,0x01,0x00,0x02,0x00,0x00,0x00,0x01,0x00,0x05,/* 01B0          case 22: divw 65536/2 overflows */
+	0x02,0x00,0x00,0x00,0x80,0xFF,0xFF,0x00,0x00,0x00,0x80,0x05,/* 01BC          case 23: divw 80000000h/-1 overflows */
+	0x02,0xA0,0x86,0x01,0x00,0x00,0x00,0xA0,0x86,0x01,0x00,0xC1,/* 01C8          case 24: divw by 0 */
+	0x03,0xA0,0x86,0x01,0x00,0x07,0x00,0xCD,0x37,0x05,0x00,0x00,/* 01D4          case 25: divuw 100000/7 */
+	0x03,0xFF,0xFF,0xFE,0xFF,0xFF,0xFF,0xFF,0xFF,0xFE,0xFF,0x00,/* 01E0          case 26: divuw FFFEFFFFh/FFFFh = FFFFh */
+	0x03,0x00,0x00,0xFF,0xFF,0xFF,0xFF,0x00,0x00,0xFF,0xFF,0x05,/* 01EC          case 27: divuw FFFF0000h/FFFFh overflows */
+	0x03,0xA0,0x86,0x01,0x00,0x00,0x00,0xA0,0x86,0x01,0x00,0xC1,/* 01F8          case 28: divuw by 0 */
+	0xFF,                       /* 0204          end                */
+};
+
+/* uart: echo loop on the on-chip UART clocked by CT1 or CTIN1 as UARTCR says */
+static const UINT8 ser_uart[] = {
+	0xC3,0x06,0x00,             /* 0000          jp start           */
+	0x00,0x00,                  /* 0003          dw tc              */
+	0x00,                       /* 0005          db uartcr          */
+	0x31,0x00,0x0E,             /* 0006 start:   ld sp,0E00h        */
+	0x0E,0x08,                  /* 0009          ld c,08h           */
+	0x21,0xFE,0x00,             /* 000B          ld hl,00FEh        */
+	0xED,0x6E,                  /* 000E          ldctl (c),hl       */
+	0x0E,0xE8,                  /* 0010          ld c,0E8h          */
+	0x3E,0x80,                  /* 0012          ld a,80h           */
+	0xED,0x79,                  /* 0014          out (c),a          */
+	0x0E,0xEA,                  /* 0016          ld c,0EAh          */
+	0x2A,0x03,0x00,             /* 0018          ld hl,(0003h)      */
+	0xED,0xBF,                  /* 001B          outw (c),hl        */
+	0x0E,0xE9,                  /* 001D          ld c,0E9h          */
+	0x3E,0xE0,                  /* 001F          ld a,0E0h          */
+	0xED,0x79,                  /* 0021          out (c),a          */
+	0x3A,0x05,0x00,             /* 0023          ld a,(0005h)       */
+	0xD3,0x10,                  /* 0026          out (10h),a        */
+	0x3E,0x80,                  /* 0028          ld a,80h           */
+	0xD3,0x12,                  /* 002A          out (12h),a        */
+	0xD3,0x14,                  /* 002C          out (14h),a        */
+	0xDB,0x14,                  /* 002E loop:    in a,(14h)         */
+	0xE6,0x10,                  /* 0030          and 10h            */
+	0x28,0xFA,                  /* 0032          jr z,loop          */
+	0xDB,0x16,                  /* 0034          in a,(16h)         */
+	0x47,                       /* 0036          ld b,a             */
+	0xDB,0x12,                  /* 0037 wtx:     in a,(12h)         */
+	0x1F,                       /* 0039          rra                */
+	0x30,0xFB,                  /* 003A          jr nc,wtx          */
+	0x78,                       /* 003C          ld a,b             */
+	0xD3,0x18,                  /* 003D          out (18h),a        */
+	0x18,0xED,                  /* 003F          jr loop            */
+};
+
+/* quad: echo loop on a QuadSer channel, 8N1 with FIFOs */
+static const UINT8 ser_quad[] = {
+	0xC3,0x06,0x00,             /* 0000          jp start           */
+	0x00,0x00,                  /* 0003          dw divisor         */
+	0x00,                       /* 0005          db port            */
+	0x31,0x00,0x0E,             /* 0006 start:   ld sp,0E00h        */
+	0x3A,0x05,0x00,             /* 0009          ld a,(0005h)       */
+	0x57,                       /* 000C          ld d,a             */
+	0xC6,0x03,                  /* 000D          add a,3            */
+	0x4F,                       /* 000F          ld c,a             */
+	0x3E,0x80,                  /* 0010          ld a,80h           */
+	0xED,0x79,                  /* 0012          out (c),a          */
+	0x2A,0x03,0x00,             /* 0014          ld hl,(0003h)      */
+	0x4A,                       /* 0017          ld c,d             */
+	0xED,0x69,                  /* 0018          out (c),l          */
+	0x0C,                       /* 001A          inc c              */
+	0xED,0x61,                  /* 001B          out (c),h          */
+	0x0C,                       /* 001D          inc c              */
+	0x3E,0x07,                  /* 001E          ld a,07h           */
+	0xED,0x79,                  /* 0020          out (c),a          */
+	0x0C,                       /* 0022          inc c              */
+	0x3E,0x03,                  /* 0023          ld a,03h           */
+	0xED,0x79,                  /* 0025          out (c),a          */
+	0x0C,                       /* 0027          inc c              */
+	0x0C,                       /* 0028          inc c              */
+	0x59,                       /* 0029          ld e,c             */
+	0x4B,                       /* 002A loop:    ld c,e             */
+	0xED,0x78,                  /* 002B          in a,(c)           */
+	0x1F,                       /* 002D          rra                */
+	0x30,0xFA,                  /* 002E          jr nc,loop         */
+	0x4A,                       /* 0030          ld c,d             */
+	0xED,0x40,                  /* 0031          in b,(c)           */
+	0x4B,                       /* 0033          ld c,e             */
+	0xED,0x78,                  /* 0034 wtx:     in a,(c)           */
+	0xE6,0x20,                  /* 0036          and 20h            */
+	0x28,0xFA,                  /* 0038          jr z,wtx           */
+	0x4A,                       /* 003A          ld c,d             */
+	0xED,0x41,                  /* 003B          out (c),b          */
+	0x18,0xEB,                  /* 003D          jr loop            */
+};
+
+struct bench {
+	char *name;
+	const UINT8 *prog;
+	size_t size;
+	UINT16 passes;
+};
+
+struct bench benches[] = {
+	{"alu8", prog_alu8, sizeof(prog_alu8), 4000},
+	{"alu16", prog_alu16, sizeof(prog_alu16), 4000},
+	{"multdiv", prog_multdiv, sizeof(prog_multdiv), 1000},
+	{"index", prog_index, sizeof(prog_index), 3000},
+	{"block", prog_block, sizeof(prog_block), 1000},
+	{"iowords", prog_iowords, sizeof(prog_iowords), 10000},
+	{"mmu", prog_mmu, sizeof(prog_mmu), 500},
+	{"im3", prog_im3, sizeof(prog_im3), 500},
+	{"dma", prog_dma, sizeof(prog_dma), 10000},
+	{"divide", prog_divide, sizeof(prog_divide), 1000},
+};
+#define NBENCH (sizeof(benches) / sizeof(benches[0]))
+
+struct z280_device *cpu;
+unsigned long long instrcnt = 0;
+unsigned long long cyclecnt = 0;
+unsigned long long done_cycles;
+int done;
+int result;
+UINT16 stub_in, stub_out;
+unsigned int stub_errors;
+
+struct pc16554_device *quadser;
+unsigned int ins8250_clock = INS8250_DIVISOR;
+
+/* the serial generator: bytes are numbered, each echo must bring back the
+   next one; skipped numbers were lost on the way */
+int ser_port = -1;  /* 0 UART, 1-4 QuadSer channel 0-3, -1 none */
+unsigned int ser_total, ser_window, ser_sent, ser_echoed;
+unsigned int ser_lost, ser_errors;
+unsigned long long ser_sent_at[SER_WINDOW];
+unsigned long long *ser_latency; /* per echo, while measuring it */
+unsigned long long ser_progress; /* cycle of the last echo */
+
+unsigned long long cycle_now() {
+	return cyclecnt + BENCH_SLICE - cpu_get_icount_z280(cpu);
+}
+
+UINT8 ram_read_byte(offs_t A) {
+	return _ram[A & (RAM_SIZE - 1)];
+}
+
+void ram_write_byte(offs_t A,UINT8 V) {
+	_ram[A & (RAM_SIZE - 1)]=V;
+}
+
+UINT16 ram_read_word(offs_t A) {
+	return *(UINT16*)&_ram[A & (RAM_SIZE - 1)];
+}
+
+void ram_write_word(offs_t A,UINT16 V) {
+	*(UINT16*)&_ram[A & (RAM_SIZE - 1)]=V;
+}
+
+UINT8 io_read_byte (offs_t Port) {
+	offs_t lPort = Port & 0xff;
+
+	if (lPort == BENCH_ERRORS)
+		return stub_errors > 0xff ? 0xff : stub_errors;
+	if (lPort >= SER_QUADBASE && lPort < SER_QUADBASE + 0x20)
+		return pc16554_device_r(quadser,lPort - SER_QUADBASE);
+	printf("IO: Bogus read b,%x\n",Port);
+	return 0;
+}
+
+void io_write_byte (offs_t Port,UINT8 Value) {
+	offs_t lPort = Port & 0xff;
+
+	if (lPort == BENCH_RESULT) {
+		if (!done) {
+			done_cycles = cycle_now();
+			result = Value;
+			done = 1;
+		}
+	}
+	else if (lPort == BENCH_STUB) {
+		stub_in = stub_out = Value;
+		stub_errors = 0;
+	}
+	else if (lPort >= SER_QUADBASE && lPort < SER_QUADBASE + 0x20)
+		pc16554_device_w(quadser,lPort - SER_QUADBASE,Value);
+	else
+		printf("IO: Bogus write b,%x:%x\n",Port,Value);
+}
+
+UINT16 io_read_word (offs_t Port) {
+	if ((Port & 0xff) == BENCH_STUB)
+		return stub_in++;
+	printf("IO: Bogus read w,%x\n",Port);
+	return 0;
+}
+
+void io_write_word (offs_t Port,UINT16 Value) {
+	if ((Port & 0xff) == BENCH_STUB) {
+		if (Value != stub_out++)
+			stub_errors++;
+	}
+	else
+		printf("IO: Bogus write w,%x:%x\n",Port,Value);
+}
+
+int irq0ackcallback(device_t *device,int irqnum) {
+	return 0;
+}
+
+UINT8 init_bti(device_t *device) {
+	return 0;
+}
+
+int ser_rx(int port) {
+	if (port != ser_port || ser_sent == ser_total || ser_sent - ser_echoed >= ser_window)
+		return -1;
+	ser_sent_at[ser_sent % SER_WINDOW] = cycle_now();
+	return ser_sent++ & 0xff;
+}
+
+void ser_tx(int port, UINT8 Value) {
+	unsigned int n = ser_echoed;
+
+	if (port != ser_port)
+		return;
+	while (n < ser_sent && (n & 0xff) != Value)
+		n++;
+	if (n == ser_sent) { /* nothing sent like it */
+		ser_errors++;
+		return;
+	}
+	ser_lost += n - ser_echoed;
+	ser_progress = cycle_now();
+	if (ser_latency)
+		ser_latency[n] = ser_progress - ser_sent_at[n % SER_WINDOW];
+	ser_echoed = n + 1;
+}
+
+int uart_rx(device_t *device, int channel) {
+	return ser_rx(0);
+}
+
+void uart_tx(device_t *device, int channel, UINT8 Value) {
+	ser_tx(0, Value);
+}
+
+int quadser_rx(device_t *device, int channel) {
+	return ser_rx(channel + 1);
+}
+
+void quadser_tx(device_t *device, int channel, UINT8 Value) {
+	ser_tx(channel + 1, Value);
+}
+
+void quadser_int_state_cb(device_t *device, int state) {
+}
+
+void debugger_instruction_hook(device_t *device, offs_t curpc) {
+	if (!done)
+		instrcnt++;
+	if (ser_port > 0 && !--ins8250_clock) { /* as do_timers() in z280rc */
+		ins8250_device_timer(quadser->channel[ser_port - 1]);
+		ins8250_clock = INS8250_DIVISOR;
+	}
+}
+
+struct address_space ram = {ram_read_byte,ram_read_word,ram_write_byte,ram_write_word,ram_read_byte,ram_read_word};
+struct address_space iospace = {io_read_byte,io_read_word,io_write_byte,io_write_word,NULL,NULL};
+
+struct bench_result {
+	unsigned long long instrs;
+	unsigned long long cycles;
+	double secs;
+	int status; /* -1 hung, else the guest's result */
+};
+
+double now_secs() {
+	struct timeval t;
+	gettimeofday(&t, 0);
+	return t.tv_sec + t.tv_usec / 1e6;
+}
+
+void run_bench(struct bench *b, struct bench_result *r) {
+	double t0;
+
+	memset(_ram,0,sizeof(_ram));
+	memcpy(_ram,b->prog,b->size);
+	_ram[3] = b->passes & 0xff; /* dw passes */
+	_ram[4] = b->passes >> 8;
+	instrcnt = cyclecnt = 0;
+	done = 0;
+	stub_in = stub_out = 0;
+	stub_errors = 0;
+	cpu_reset_z280(cpu);
+
+	t0 = now_secs();
+	while (!done && cyclecnt < BENCH_LIMIT)
+		cyclecnt += cpu_execute_z280(cpu,BENCH_SLICE);
+	r->secs = now_secs() - t0;
+	r->instrs = instrcnt;
+	r->cycles = done ? done_cycles : cyclecnt;
+	r->status = done ? result : -1;
+}
+
+/* baseline: one "name MIPS" line per test */
+double baseline[NBENCH];
+
+int load_baseline(const char *path) {
+	FILE *f = fopen(path,"r");
+	char name[32];
+	double mips;
+	int i;
+
+	if (!f) {
+		perror(path);
+		return -1;
+	}
+	while (fscanf(f,"%31s %lf",name,&mips) == 2)
+		for (i = 0; i < NBENCH; i++)
+			if (!strcmp(name,benches[i].name))
+				baseline[i] = mips;
+	fclose(f);
+	return 0;
+}
+
+/* serial: a line speed of a port, as the guest programs it */
+#define NSERPORT 5
+const char *ser_names[NSERPORT] = {"uart","quad0","quad1","quad2","quad3"};
+
+struct ser_line {
+	unsigned int divisor; /* CT1 time constant or QuadSer divisor latch */
+	UINT8 mode;           /* UARTCR or QuadSer base port */
+	double baud;          /* nominal */
+};
+
+int ser_setup(int port, const char *baud, struct ser_line *l) {
+	long b = 0;
+
+	if (strcmp(baud,"max") && (b = atol(baud)) <= 0)
+		return -1;
+	if (port == 0) {
+		if (!b) { /* CTIN1, x1 */
+			l->divisor = 0;
+			l->mode = 0xc0;
+			l->baud = BENCH_CLOCK / 8;
+			return 0;
+		}
+		/* CT1 counts every 4 cycles, x16 */
+		l->divisor = (BENCH_CLOCK / 64 + b / 2) / b;
+		l->mode = 0xca;
+	} else {
+		/* the 16C954 runs at half the CPU clock, x16 */
+		l->divisor = b ? (BENCH_CLOCK / 32 + b / 2) / b : 1;
+		l->mode = SER_QUADBASE + 8 * (port - 1);
+	}
+	if (l->divisor < 1 || l->divisor > 0xffff)
+		return -1;
+	l->baud = BENCH_CLOCK / 64.0 * (port ? 2 : 1) / l->divisor;
+	if (port == 0)
+		l->divisor--; /* count end after tc + 1 */
+	return 0;
+}
+
+struct ser_result {
+	unsigned long long latency[SER_ECHOES]; /* cycles from sending to the echo */
+	unsigned long long cycles; /* streaming SER_BYTES */
+	double secs;
+	unsigned int lost, errors;
+	int hung;
+};
+
+/* sends bytes with at most window of them unechoed, until all came back;
+   a guest that takes none for BENCH_LIMIT cycles hangs */
+int ser_phase(unsigned int bytes, unsigned int window, unsigned long long *latency) {
+	ser_total = bytes;
+	ser_window = window;
+	ser_sent = ser_echoed = 0;
+	ser_latency = latency;
+	ser_progress = cyclecnt;
+	while (ser_echoed < ser_total && cyclecnt - ser_progress < BENCH_LIMIT) {
+		cyclecnt += cpu_execute_z280(cpu,BENCH_SLICE);
+		if (ser_sent > ser_echoed && cyclecnt - ser_progress > SER_STALL) {
+			ser_lost += ser_sent - ser_echoed;
+			ser_echoed = ser_sent;
+			ser_progress = cyclecnt;
+		}
+	}
+	ser_total = ser_sent;
+	return ser_echoed < bytes ? -1 : 0;
+}
+
+void run_serial(int port, struct ser_line *l, struct ser_result *r) {
+	unsigned long long start;
+	double t0;
+
+	memset(_ram,0,sizeof(_ram));
+	if (port)
+		memcpy(_ram,ser_quad,sizeof(ser_quad));
+	else
+		memcpy(_ram,ser_uart,sizeof(ser_uart));
+	_ram[3] = l->divisor & 0xff; /* dw tc/divisor */
+	_ram[4] = l->divisor >> 8;
+	_ram[5] = l->mode;           /* db uartcr/port */
+	instrcnt = cyclecnt = 0;
+	done = 0;
+	ser_port = port;
+	ser_lost = ser_errors = 0;
+	ins8250_clock = INS8250_DIVISOR;
+	cpu_reset_z280(cpu);
+	pc16554_device_reset(quadser);
+	memset(r,0,sizeof(*r));
+
+	r->hung = ser_phase(SER_ECHOES,1,r->latency) < 0;
+	if (!r->hung) {
+		start = cyclecnt;
+		t0 = now_secs();
+		r->hung = ser_phase(SER_BYTES,SER_WINDOW,NULL) < 0;
+		r->secs = now_secs() - t0;
+		r->cycles = ser_progress - start;
+	}
+	r->lost = ser_lost;
+	r->errors = ser_errors;
+	ser_port = -1;
+}
+
+int cmp_ull(const void *a, const void *b) {
+	unsigned long long x = *(const unsigned long long *)a, y = *(const unsigned long long *)b;
+	return x < y ? -1 : x > y;
+}
+
+double ser_us(unsigned long long *sorted, int pct) {
+	return sorted[(SER_ECHOES - 1) * pct / 100] * 1e6 / BENCH_CLOCK;
+}
+
+int run_serial_table(int *ports, const char *bauds) {
+	struct ser_line l;
+	struct ser_result r;
+	char *list, *baud;
+	double rate;
+	int failures = 0;
+	int port;
+
+	printf("%-6s %8s %6s %9s %9s %8s %8s %8s %8s  %s\n","port","baud","line%","emu B/s","host B/s",
+		"p50 us","p90 us","p99 us","max us","result");
+	for (port = 0; port < NSERPORT; port++) {
+		if (!ports[port])
+			continue;
+		list = strdup(bauds);
+		for (baud = strtok(list,","); baud; baud = strtok(NULL,",")) {
+			if (ser_setup(port,baud,&l) < 0) {
+				printf("%-6s %8s  unusable line speed\n",ser_names[port],baud);
+				failures++;
+				continue;
+			}
+			run_serial(port,&l,&r);
+			qsort(r.latency,SER_ECHOES,sizeof(r.latency[0]),cmp_ull);
+			rate = r.cycles ? SER_BYTES / (r.cycles / (double)BENCH_CLOCK) : 0;
+			printf("%-6s %8.0f %6.1f %9.0f %9.0f %8.1f %8.1f %8.1f %8.1f  ",ser_names[port],l.baud,
+				100 * rate / (l.baud / 10),rate,r.secs > 0 ? SER_BYTES / r.secs : 0,
+				ser_us(r.latency,50),ser_us(r.latency,90),ser_us(r.latency,99),ser_us(r.latency,100));
+			if (r.hung) {
+				printf("FAILED: no echo after %llu cycles\n",BENCH_LIMIT);
+				failures++;
+			} else if (r.lost || r.errors) {
+				printf("FAILED: %u lost, %u wrong\n",r.lost,r.errors);
+				failures++;
+			} else
+				printf("ok\n");
+		}
+		free(list);
+	}
+	return failures;
+}
+
+int main(int argc, char** argv)
+{
+	struct bench_result res[NBENCH], r;
+	int selected[NBENCH];
+	int nselected = 0;
+	int repeat = BENCH_REPEAT;
+	int threshold = BENCH_THRESHOLD;
+	char *save_name = NULL;
+	int serial = 0, ser_ports[NSERPORT];
+	const char *bauds = SER_BAUDS;
+	int failures = 0;
+	double mips, total_secs = 0;
+	unsigned long long total_instrs = 0;
+	int i, j;
+
+	memset(selected,0,sizeof(selected));
+	memset(ser_ports,0,sizeof(ser_ports));
+	for (i = 1; i < argc; i++) {
+		if (!strcmp(argv[i],"-list")) { /* names and passes */
+			for (j = 0; j < NBENCH; j++)
+				printf("%-8s %5d passes\n",benches[j].name,benches[j].passes);
+			exit(0);
+		} else if (!strcmp(argv[i],"-dump")) { /* write the programs as name.bin for dis280 */
+			for (j = 0; j < NBENCH; j++) {
+				char fn[32];
+				FILE *f;
+				sprintf(fn,"%s.bin",benches[j].name);
+				if (!(f = fopen(fn,"wb")) || fwrite(benches[j].prog,1,benches[j].size,f) != benches[j].size) {
+					perror(fn);
+					exit(1);
+				}
+				fclose(f);
+			}
+			exit(0);
+		} else if (strncmp(argv[i],"-repeat=",8)==0) { /* runs of each test, best counts */
+			repeat = atoi(argv[i]+8);
+			if (repeat < 1) repeat = 1;
+		} else if (strncmp(argv[i],"-baseline=",10)==0) { /* fail below its MIPS */
+			if (load_baseline(argv[i]+10) < 0)
+				exit(1);
+		} else if (strncmp(argv[i],"-threshold=",11)==0) { /* % slower that fails */
+			threshold = atoi(argv[i]+11);
+		} else if (strncmp(argv[i],"-save=",6)==0) { /* write the MIPS as a baseline */
+			save_name = argv[i]+6;
+		} else if (strncmp(argv[i],"-serial",7)==0) { /* serial ports instead, all or as listed */
+			char *p = argv[i]+7;
+			serial = 1;
+			if (*p == '=') {
+				for (p = strtok(p+1,","); p; p = strtok(NULL,",")) {
+					for (j = 0; j < NSERPORT; j++)
+						if (!strcmp(p,ser_names[j]))
+							break;
+					if (j == NSERPORT) {
+						printf("Unknown port: %s\n",p);
+						exit(1);
+					}
+					ser_ports[j] = 1;
+				}
+			} else
+				for (j = 0; j < NSERPORT; j++)
+					ser_ports[j] = 1;
+		} else if (strncmp(argv[i],"-baud=",6)==0) { /* line speeds for -serial */
+			bauds = argv[i]+6;
+		} else if (argv[i][0] != '-') { /* run only the named tests */
+			for (j = 0; j < NBENCH; j++)
+				if (!strcmp(argv[i],benches[j].name))
+					break;
+			if (j == NBENCH) {
+				printf("Unknown test: %s\n",argv[i]);
+				exit(1);
+			}
+			selected[j] = 1;
+			nselected++;
+		} else {
+			printf("Usage: z280bench [-list] [-dump] [-repeat=n] [-baseline=file] [-threshold=pct] [-save=file] [test...]\n");
+			printf("       z280bench -serial[=port,...] [-baud=rate,...|max]\n");
+			exit(1);
+		}
+	}
+
+	cpu = cpu_create_z280("Z280",Z280_TYPE_Z280,BENCH_CLOCK,&ram,&iospace,irq0ackcallback,NULL/*daisychain*/,
+		init_bti,1/*Z-BUS*/,0,BENCH_CLOCK/8,0,uart_rx,uart_tx);
+	quadser = pc16554_device_create("QUADSER",cpu,BENCH_CLOCK/2,OX16950,
+		quadser_int_state_cb,quadser_rx,quadser_tx,0/*CLKSEL=GND*/);
+
+	if (serial) {
+		if ((failures = run_serial_table(ser_ports,bauds))) {
+			printf("z280bench: %d serial test%s FAILED\n",failures,failures > 1 ? "s" : "");
+			exit(1);
+		}
+		return 0;
+	}
+
+	printf("%-8s %12s %12s %8s %8s %8s  %s\n","test","instrs","cycles","host s","MIPS","emu MHz","result");
+	for (i = 0; i < NBENCH; i++) {
+		if (nselected && !selected[i])
+			continue;
+		for (j = 0; j < repeat; j++) {
+			run_bench(&benches[i],&r);
+			if (j == 0 || r.status != res[i].status || r.secs < res[i].secs)
+				res[i] = r;
+			if (r.status)
+				break;
+		}
+		r = res[i];
+		mips = r.instrs / r.secs / 1e6;
+		printf("%-8s %12llu %12llu %8.3f %8.2f %8.2f  ",benches[i].name,r.instrs,r.cycles,r.secs,
+			mips,r.cycles / r.secs / 1e6);
+		if (r.status == -1) {
+			printf("FAILED: no result after %llu cycles\n",r.cycles);
+			failures++;
+		} else if (r.status) {
+			printf("FAILED: self-check code %d\n",r.status);
+			failures++;
+		} else if (baseline[i] && mips < baseline[i] * (100 - threshold) / 100) {
+			printf("FAILED: %.1f%% below baseline %.2f MIPS\n",100 * (1 - mips / baseline[i]),baseline[i]);
+			failures++;
+		} else if (baseline[i]) {
+			printf("ok (%+.1f%%)\n",100 * (mips / baseline[i] - 1));
+		} else
+			printf("ok\n");
+		total_instrs += r.instrs;
+		total_secs += r.secs;
+	}
+	if (total_secs > 0)
+		printf("%-8s %12llu %12s %8.3f %8.2f\n","total",total_instrs,"",total_secs,total_instrs / total_secs / 1e6);
+
+	if (save_name) {
+		FILE *f = fopen(save_name,"w");
+		if (!f) {
+			perror(save_name);
+			exit(1);
+		}
+		for (i = 0; i < NBENCH; i++)
+			if ((!nselected || selected[i]) && res[i].status == 0)
+				fprintf(f,"%s %.2f\n",benches[i].name,res[i].instrs / res[i].secs / 1e6);
+		fclose(f);
+	}
+	if (failures) {
+		printf("z280bench: %d test%s FAILED\n",failures,failures > 1 ? "s" : "");
+		exit(1);
+	}
+	return 0;
+}
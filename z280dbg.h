@@ -23,14 +23,285 @@
 unsigned int volatile g_quit = 0;
 unsigned long long instrcnt = 0;
 unsigned long long starttrace = -1LL;
+char *trace_file = NULL; // -d goes to a binary trace instead of stdout
+size_t trace_ring = TRACE_RING;
+int tracing = 0; // past starttrace, VERBOSE then follows the filter
+
+/* trace filter: terms of one kind are ORed, different kinds ANDed */
+#define MAX_TRACE_RANGES 8
+struct trace_filter {
+	int on;
+	int npc, nppc;
+	offs_t pc[MAX_TRACE_RANGES][2];   // logical PC ranges
+	offs_t ppc[MAX_TRACE_RANGES][2];  // physical PC ranges
+	int mode;                         // MSR US bit required, -1 any
+	int pdr;                          // PDR that must map frame, -1 any
+	UINT16 frame;
+	unsigned long long from, to;      // instruction window
+	int after;                        // 1 logical, 2 physical, 0 when hit
+	offs_t after_pc;
+} tf = { 0, 0, 0, {{0}}, {{0}}, -1, -1, 0, 0, -1LL, 0, 0 };
+
+int trace_range(char *s, offs_t *r) {
+	char *e;
+	r[0] = r[1] = strtoul(s, &e, 16);
+	if (*e == '-')
+		r[1] = strtoul(e + 1, &e, 16);
+	return *e ? -1 : 0;
+}
+
+/* pc=LO-HI ppc=LO-HI user system pdrN=FRAME from=N to=N after=PC afterp=PC */
+int trace_filter_parse(char *expr) {
+	char *t, *e;
+	for (t = strtok(expr, ","); t; t = strtok(NULL, ",")) {
+		if (strncmp(t, "pc=", 3) == 0 && tf.npc < MAX_TRACE_RANGES) {
+			if (trace_range(t + 3, tf.pc[tf.npc++]) < 0) return -1;
+		}
+		else if (strncmp(t, "ppc=", 4) == 0 && tf.nppc < MAX_TRACE_RANGES) {
+			if (trace_range(t + 4, tf.ppc[tf.nppc++]) < 0) return -1;
+		}
+		else if (strcmp(t, "user") == 0)
+			tf.mode = 0x4000;
+		else if (strcmp(t, "system") == 0)
+			tf.mode = 0;
+		else if (strncmp(t, "pdr", 3) == 0 && (e = strchr(t, '='))) {
+			tf.pdr = atoi(t + 3);
+			tf.frame = strtoul(e + 1, NULL, 16) & 0xfff0;
+			if (tf.pdr < 0 || tf.pdr > 31) return -1;
+		}
+		else if (strncmp(t, "from=", 5) == 0)
+			tf.from = strtoull(t + 5, NULL, 10);
+		else if (strncmp(t, "to=", 3) == 0)
+			tf.to = strtoull(t + 3, NULL, 10);
+		else if (strncmp(t, "after=", 6) == 0) {
+			tf.after = 1;
+			tf.after_pc = strtoul(t + 6, NULL, 16);
+		}
+		else if (strncmp(t, "afterp=", 7) == 0) {
+			tf.after = 2;
+			tf.after_pc = strtoul(t + 7, NULL, 16);
+		}
+		else
+			return -1;
+	}
+	tf.on = 1;
+	return 0;
+}
+
+int trace_match(device_t *device, offs_t curpc) {
+	offs_t transpc = curpc;
+	UINT16 mmu[TRACE_MMU];
+	int i;
+
+	if (instrcnt < tf.from || instrcnt > tf.to)
+		return 0;
+	if (tf.nppc || tf.after == 2)
+		cpu_translate_z280(device,AS_PROGRAM,0,&transpc);
+	if (tf.after) {
+		if ((tf.after == 1 ? curpc : transpc) != tf.after_pc)
+			return 0;
+		tf.after = 0;
+	}
+	if (tf.mode != -1 && (cpu_get_state_z280(device,Z280_CR_MSR) & 0x4000) != tf.mode)
+		return 0;
+	if (tf.npc) {
+		for (i = 0; i < tf.npc; i++)
+			if (curpc >= tf.pc[i][0] && curpc <= tf.pc[i][1]) break;
+		if (i == tf.npc) return 0;
+	}
+	if (tf.nppc) {
+		for (i = 0; i < tf.nppc; i++)
+			if (transpc >= tf.ppc[i][0] && transpc <= tf.ppc[i][1]) break;
+		if (i == tf.nppc) return 0;
+	}
+	if (tf.pdr != -1) {
+		cpu_get_mmu_z280(device, mmu);
+		if ((mmu[1 + tf.pdr] & 0xfff0) != tf.frame) return 0;
+	}
+	return 1;
+}
 
 void do_timers();
+unsigned long long cycle_stamp();
 
 UINT8 debugger_getmem(device_t *device, offs_t addr) {
 	UINT8 *mem = RAMARRAY;
 	return mem[addr];
 }
 
+/* flight recorder: the last flight_size instructions, kept cheaply all the
+   time and dumped when something goes wrong. Each entry holds the logical
+   and physical PC, the MSR and the opcode bytes as they were executed; the
+   registers are kept as well with -flightregs. The instruction count
+   follows from flight_count. */
+struct flight_entry {
+	UINT16 pc;
+	UINT16 msr;
+	UINT32 ppc;
+	UINT8 op[TRACE_OPBYTES];
+};
+struct flight_entry *flight = NULL;
+UINT16 (*flight_regs)[TRACE_REGS] = NULL; // with -flightregs
+int flight_want_regs = 0;
+unsigned int flight_size = 0;   // a power of 2
+unsigned long long flight_count = 0;  // recorded since the last dump
+unsigned int flight_traps = 1 << Z280_TRAP_FATAL;
+volatile int flight_request = 0;
+
+const char *trap_names[] = { "epum", "mepu", "epuf", "epui", "priv", "sc", "accv", "sso", "div", "ss", "bp", "fatal" };
+
+int flight_init(unsigned int n) {
+	for (flight_size = 1; flight_size < n; flight_size <<= 1)
+		;
+	if (!(flight = malloc(flight_size * sizeof(*flight))) ||
+	    (flight_want_regs && !(flight_regs = malloc(flight_size * sizeof(*flight_regs))))) {
+		printf("Cannot allocate flight recorder\n");
+		return -1;
+	}
+	return 0;
+}
+
+/* trap names to dump on, e.g. fatal,accv,priv */
+int flight_parse_traps(char *s) {
+	char *t;
+	int i;
+	flight_traps = 0;
+	for (t = strtok(s, ","); t; t = strtok(NULL, ",")) {
+		for (i = 0; i <= Z280_TRAP_FATAL; i++)
+			if (strcmp(t, trap_names[i]) == 0) break;
+		if (i > Z280_TRAP_FATAL)
+			return -1;
+		flight_traps |= 1 << i;
+	}
+	return 0;
+}
+
+void flight_record(device_t *device, offs_t curpc) {
+	unsigned int i = flight_count++ & (flight_size - 1);
+	struct flight_entry *f = &flight[i];
+	offs_t ppc = curpc;
+
+	cpu_translate_z280(device, AS_PROGRAM, 0, &ppc);
+	f->pc = curpc;
+	f->msr = cpu_get_msr_z280(device);
+	f->ppc = ppc;
+	memcpy(f->op, &RAMARRAY[ppc], TRACE_OPBYTES);
+	if (flight_regs)
+		cpu_get_regs_z280(device, flight_regs[i]);
+}
+
+void flight_print_regs(const UINT16 *r) {
+	printf("AF=%04X BC=%04X DE=%04X HL=%04X IX=%04X IY=%04X SSP=%04X USP=%04X MSR=%04X\n",
+		r[TRACE_R_AF], r[TRACE_R_BC], r[TRACE_R_DE], r[TRACE_R_HL], r[TRACE_R_IX],
+		r[TRACE_R_IY], r[TRACE_R_SSP], r[TRACE_R_USP], r[TRACE_R_MSR]);
+}
+
+/* one line per instruction like -d, from what was recorded; the registers
+   before each instruction with -flightregs, otherwise once at the end */
+void flight_dump(device_t *device, const char *why) {
+	struct flight_entry *f;
+	UINT16 r[TRACE_REGS];
+	char ibuf[20];
+	offs_t dres;
+	unsigned long long i, n = flight_count < flight_size ? flight_count : flight_size;
+	int j, ilen, nn;
+
+	if (!n)
+		return;
+	printf("Flight recorder, %s: last %llu instructions from %llu\n", why, n, instrcnt - n + 1);
+	for (i = flight_count - n; i != flight_count; i++) {
+		f = &flight[i & (flight_size - 1)];
+		if (flight_regs)
+			flight_print_regs(flight_regs[i & (flight_size - 1)]);
+		dres = cpu_disassemble_z280(device, ibuf, f->pc, f->op, 0);
+		printf("%04X=%06X: ", f->pc, f->ppc);
+		ilen = dres & DASMFLAG_LENGTHMASK;
+		for (j = 0; j < ilen; j++)
+			printf("%02X", f->op[j]);
+		for ( ; j < 7; j++)
+			printf("  ");
+		nn = printf(" %s", ibuf);
+		for ( ; nn < 28; nn++)
+			putchar(' ');
+		printf("msr=%04X\n", f->msr);
+	}
+	cpu_get_regs_z280(device, r);
+	printf("Now: ");
+	flight_print_regs(r);
+	printf("Flight recorder end at instruction %llu\n", instrcnt);
+	fflush(stdout);
+	flight_count = 0;
+}
+
+void flight_trap(device_t *device, int trap) {
+	char why[20];
+	if (flight_traps & (1 << trap)) {
+		sprintf(why, "%s trap", trap_names[trap]);
+		flight_dump(device, why);
+	}
+}
+
+/* PC sampling profiler, one sample every profile_period cycles */
+char *profile_file = NULL;
+unsigned long profile_period = PROFILE_PERIOD;
+unsigned long long profile_next = 0;
+UINT32 profile_jitter = 1;
+
+void profile_instruction(device_t *device, offs_t curpc, unsigned long long now) {
+	UINT16 mmu[TRACE_MMU];
+	offs_t transpc = curpc;
+	int user = (cpu_get_state_z280(device,Z280_CR_MSR) & 0x4000) != 0;
+
+	cpu_translate_z280(device,AS_PROGRAM,0,&transpc);
+	if (user)
+		cpu_get_mmu_z280(device, mmu);
+	// tasks are told apart by the frame of their first page
+	profile_sample(transpc, curpc, user, user ? mmu[1] & 0xfff0 : 0);
+	// vary the interval so that loops don't always get sampled at one spot
+	profile_jitter = profile_jitter * 1103515245 + 12345;
+	profile_next = now + profile_period / 2 + (profile_jitter >> 8) % profile_period;
+}
+
+/* call graph profiler, fed by the core on each call, return and trap */
+char *callgraph_file = NULL;
+
+void callgraph_hook(device_t *device, int kind, UINT16 sp) {
+	UINT16 mmu[TRACE_MMU], ctx = 0;
+	offs_t pc = cpu_get_state_z280(device,Z280_PC), ppc = pc;
+	int user = (cpu_get_state_z280(device,Z280_CR_MSR) & 0x4000) != 0;
+
+	if (user) {
+		cpu_get_mmu_z280(device, mmu);
+		ctx = mmu[1] & 0xfff0;
+	}
+	switch (kind) {
+		case Z280_CG_RET:
+			profile_cg_return(user, ctx, sp, user, ctx, cycle_stamp());
+			break;
+		case Z280_CG_RETIL:
+			profile_cg_return(0, 0, sp, user, ctx, cycle_stamp());
+			break;
+		default:
+			cpu_translate_z280(device,AS_PROGRAM,0,&ppc);
+			profile_cg_enter(kind, user, ctx, sp, ppc, pc, cycle_stamp());
+			break;
+	}
+}
+
+void trace_instruction(device_t *device, offs_t curpc) {
+	struct trace_entry e;
+	offs_t transpc = curpc;
+
+	cpu_translate_z280(device,AS_PROGRAM,0,&transpc);
+	e.instr = instrcnt;
+	e.pc = curpc;
+	e.ppc = transpc;
+	memcpy(e.op, &RAMARRAY[transpc], TRACE_OPBYTES);
+	cpu_get_regs_z280(device, e.regs);
+	cpu_get_mmu_z280(device, e.mmu);
+	trace_write(&e);
+}
+
 void debugger_instruction_hook(device_t *device, offs_t curpc) {
 	//printf(".");
 	char ibuf[20];
@@ -42,9 +313,24 @@ void debugger_instruction_hook(device_t *device, offs_t curpc) {
 	int ilen;
 
 	instrcnt++;
-	do_timers();
+	HOSTPROF_TIME(HP_DEVTIMERS, do_timers());
+
+	if(flight) {
+		flight_record(device, curpc);
+	}
+	if(profile_file) {
+		unsigned long long now = cycle_stamp();
+		if (now >= profile_next)
+			profile_instruction(device, curpc, now);
+	}
 
-	if(VERBOSE) {
+	if(tracing) {
+		VERBOSE = !tf.on || trace_match(device, curpc);
+	}
+	if(VERBOSE && trace_file) {
+		trace_instruction(device, curpc);
+	}
+	else if(VERBOSE) {
 		cpu_string_export_z280(device,STATE_GENFLAGS,fbuf);
 		printf("%s AF=%04X BC=%04X DE=%04X HL=%04X IX=%04X IY=%04X SSP=%04X USP=%04X MSR=%04X\n",fbuf,
 		    cpu_get_state_z280(device,Z280_AF),
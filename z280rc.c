@@ -25,12 +25,16 @@
 #include <stdlib.h>
 #include <stdint.h>
 #include <sys/time.h>
+#include <time.h>
+#include "hostprof/hostprof.h"
 
 #ifdef SOCKETCONSOLE
 #define BASE_PORT 10280
 #define MAX_SOCKET_PORTS 5
 #define XTALCLK 29491200
 int enable_quadser = 0;
+int detach = 0;
+#define TX_LATENCY_US 2000 /* default output coalescing bound, emulated us */
 #include "sconsole.h"
 #endif
 
@@ -55,12 +59,18 @@ int enable_quadser = 0;
 #define fileno _fileno
 #else
 #include <signal.h>
+#include <errno.h>
+#include <sys/wait.h>
 #endif
 
 #include "z280/z280.h"
 #include "ide/ide.h"
 #include "ds1202_1302/ds1202_1302.h"
+#include "ds1202_1302/rtc.h"
 #include "ins8250/ins8250.h"
+#include "snapshot/snapshot.h"
+#include "trace/trace.h"
+#include "profile/profile.h"
 
 UINT8 _ram[2*1048576];
 
@@ -70,6 +80,10 @@ UINT8 _ram[2*1048576];
 struct ide_controller *ic0;
 FILE* if00;
 int ifd00;
+int idemmap = 0;  /* map the disk image instead of reading it sector by sector */
+int idesync = 5;  /* seconds between writing back a mapped image */
+int idecache = IDE_CACHE_WRITETHROUGH;
+int idecache_interval = 0; /* ms, IDE_CACHE_PERIODIC */
 struct ide_drive *id00;
 
 uint8_t idemap[16] = {ide_data,0,ide_error_r,0,0,ide_sec_count,0,ide_sec_num,/*ide_altst_r*/
@@ -79,16 +93,26 @@ uint8_t idemap[16] = {ide_data,0,ide_error_r,0,0,ide_sec_count,0,ide_sec_num,/*i
 unsigned int ins8250_clock = INS8250_DIVISOR;
 struct pc16554_device *quadser;
 
+#define QUANTUM_MIN 1000   /* cpu cycles between device updates while serial i/o is active */
+#define QUANTUM_MAX 16384  /* ...and while it is idle: input waits at most ~1.1 ms of guest time */
+
 rtc_ds1202_1302_t *rtc;
 
 struct z280_device *cpu;
                        
+/* pages written since the last checkpoint */
+#define RAM_PAGE_SHIFT 12
+#define RAM_PAGE_SIZE (1 << RAM_PAGE_SHIFT)
+#define RAM_PAGES (sizeof(_ram) >> RAM_PAGE_SHIFT)
+UINT8 ram_dirty[RAM_PAGES + 1]; /* + a word write at the very top */
+
 UINT8 ram_read_byte(offs_t A) {
  	return _ram[A];
 }
 
 void ram_write_byte(offs_t A,UINT8 V) {
     _ram[A]=V;
+    ram_dirty[A >> RAM_PAGE_SHIFT] = 1;
 }
 
 UINT16 ram_read_word(offs_t A) {
@@ -97,6 +121,92 @@ UINT16 ram_read_word(offs_t A) {
 
 void ram_write_word(offs_t A,UINT16 V) {
     *(UINT16*)&_ram[A]=V;
+    ram_dirty[A >> RAM_PAGE_SHIFT] = 1;
+    ram_dirty[(A + 1) >> RAM_PAGE_SHIFT] = 1;
+}
+
+/* record/replay: every input from outside the machine is logged with the
+   instruction and cycle it was taken at, one event per line
+     <instr> <cycle> R<port> <byte>   serial byte received, port 0 = console
+     <instr> <cycle> I<line> <state>  interrupt line change
+     <instr> <cycle> T0 <time>        host time read by the RTC
+   a replay feeds the same bytes and times back at the same instants */
+char *record_name = NULL;
+FILE *record_file = NULL;
+FILE *replay_file = NULL;
+struct replay_event {
+	unsigned long long instr, cycle;
+	char type;
+	int unit;
+	long long value;
+} replay_next;
+
+unsigned long long cyclecnt = 0; // cycles before the current slice
+int slice_cycles = 0;
+
+unsigned long long cycle_stamp() {
+	return cyclecnt + slice_cycles - (cpu ? cpu_get_icount_z280(cpu) : 0);
+}
+
+void record_event(char type, int unit, long long value) {
+	fprintf(record_file, "%llu %llu %c%d %lld\n", instrcnt, cycle_stamp(), type, unit, value);
+}
+
+void replay_read() {
+	struct replay_event *e = &replay_next;
+	if (fscanf(replay_file, "%llu %llu %c%d %lld", &e->instr, &e->cycle, &e->type, &e->unit, &e->value) != 5) {
+		printf("Replay: end of log at instruction %llu\n", instrcnt);
+		fclose(replay_file);
+		replay_file = NULL;
+	}
+}
+
+void replay_diverged(char type, int unit) {
+	struct replay_event *e = &replay_next;
+	printf("Replay: diverged at instruction %llu cycle %llu (%c%d), log expects %c%d at %llu cycle %llu\n",
+		instrcnt, cycle_stamp(), type, unit, e->type, e->unit, e->instr, e->cycle);
+	fclose(replay_file);
+	replay_file = NULL;
+}
+
+/* returns 1 if the next logged event is this one and due now;
+   serial ports are polled, so a byte not yet due is no divergence */
+int replay_event(char type, int unit, long long *value) {
+	struct replay_event *e = &replay_next;
+	if (e->instr == instrcnt && e->type == type && e->unit == unit && e->cycle == cycle_stamp()) {
+		*value = e->value;
+		replay_read();
+		return 1;
+	}
+	if (type != 'R' || e->instr < instrcnt)
+		replay_diverged(type, unit);
+	return 0;
+}
+
+int replay_rx(int port) {
+	long long c;
+	if (!replay_event('R', port, &c))
+		return -1;
+	if (record_file)
+		record_event('R', port, c);
+	return (int)c;
+}
+
+void replay_irq(int line, int state) {
+	long long s;
+	if (replay_file && replay_event('I', line, &s) && s != state)
+		printf("Replay: line I%d is %d at instruction %llu, log has %lld\n", line, state, instrcnt, s);
+	if (record_file)
+		record_event('I', line, state);
+}
+
+time_t replay_time() {
+	long long t;
+	if (!replay_file || !replay_event('T', 0, &t))
+		t = time(NULL);
+	if (record_file)
+		record_event('T', 0, t);
+	return (time_t)t;
 }
 
 int console_char_available() {
@@ -107,8 +217,115 @@ int console_char_available() {
 #endif
 }
 
+/* clones: boot once, then fork() fork_count copies of the running machine
+   when the console prints fork_prompt or at instruction fork_at */
+int fork_count = 0;
+char *fork_prompt = NULL;
+unsigned long long fork_at = 0;
+int fork_match = 0;
+int fork_pending = 0;
+int fork_instance = 0; // clone number, 0 in the parent
+
+void fork_watch(UINT8 c) {
+	if (c == (UINT8)fork_prompt[fork_match]) {
+		if (!fork_prompt[++fork_match]) {
+			fork_pending = 1;
+			fork_match = 0;
+		}
+	}
+	else
+		fork_match = c == (UINT8)fork_prompt[0];
+}
+
+/* console script: -expect= waits for the console to print a string, -send=
+   types one; each match is reported with the cycles, instructions and host
+   time since the start, and the emulator quits after the last -expect */
+#define SCRIPT_STEPS 32
+struct script_step {
+	int send;
+	char *arg;   // as given, for the report
+	char *text;  // with the escapes resolved
+	int len;
+} script[SCRIPT_STEPS];
+int script_steps = 0;
+int script_pos = 0;
+int script_match = 0; // characters matched, or typed
+struct timeval script_t0;
+
+int script_add(int send, char *arg) {
+	struct script_step *s = &script[script_steps];
+	char *p = arg, *q;
+	if (script_steps == SCRIPT_STEPS || !*arg)
+		return -1;
+	s->send = send;
+	s->arg = arg;
+	s->text = q = malloc(strlen(arg) + 1);
+	while (*p) {
+		if (*p != '\\' || !p[1])
+			*q++ = *p++;
+		else {
+			p++;
+			switch (*p++) {
+				case 'r': *q++ = '\r'; break;
+				case 'n': *q++ = '\n'; break;
+				case 't': *q++ = '\t'; break;
+				case 'e': *q++ = 27; break;
+				case 'x': *q++ = (char)strtol(p, &p, 16); break;
+				default: *q++ = p[-1]; break;
+			}
+		}
+	}
+	s->len = q - s->text;
+	script_steps++;
+	return 0;
+}
+
+void script_next() {
+	script_match = 0;
+	if (++script_pos == script_steps && !script[script_pos-1].send)
+		g_quit = 1;
+}
+
+void script_watch(UINT8 c) {
+	struct script_step *s = &script[script_pos];
+	if (c == (UINT8)s->text[script_match]) {
+		if (++script_match == s->len) {
+			struct timeval now;
+			unsigned long long cycles = cycle_stamp();
+			gettimeofday(&now, 0);
+			printf("Script: \"%s\" after %llu cycles (%.3f s), %llu instrs, %.3f s host\n", s->arg,
+				cycles, cycles / (XTALCLK / 2.0), instrcnt,
+				(now.tv_sec - script_t0.tv_sec) + (now.tv_usec - script_t0.tv_usec) / 1e6);
+			fflush(stdout);
+			script_next();
+		}
+	}
+	else
+		script_match = c == (UINT8)s->text[0];
+}
+
+int script_rx() {
+	int c = (UINT8)script[script_pos].text[script_match];
+	if (++script_match == script[script_pos].len)
+		script_next();
+	return c;
+}
+
+/* serial bytes per port, port 0 = console */
+#define SERIAL_PORTS 5 /* UART and the four QuadSer ports */
+unsigned long long serial_in[SERIAL_PORTS], serial_out[SERIAL_PORTS];
+
+int serial_count_rx(int port, int c) {
+	if (c >= 0)
+		serial_in[port]++;
+	return c;
+}
+
 void uart_tx(device_t *device, int channel, UINT8 Value) {
 	  //printf("TX: %c", Value);
+	  serial_out[0]++;
+	  if (fork_prompt && fork_count) fork_watch(Value);
+	  if (script_pos < script_steps && !script[script_pos].send) script_watch(Value);
 #ifdef SOCKETCONSOLE
 	  tx_socket_port(0, Value);
 #else
@@ -120,6 +337,13 @@ void uart_tx(device_t *device, int channel, UINT8 Value) {
 int uart_rx(device_t *device, int channel) {
 	int ioData;
 	  //ioData = 0xFF;
+	  if (replay_file)
+		return serial_count_rx(0, replay_rx(0));
+	  if (script_pos < script_steps && script[script_pos].send) {
+		ioData = script_rx();
+		if (record_file) record_event('R', 0, ioData);
+		return serial_count_rx(0, ioData);
+	  }
 	  if(console_char_available()) {
 #ifdef SOCKETCONSOLE
 	    ioData = rx_socket_port(0);
@@ -127,7 +351,8 @@ int uart_rx(device_t *device, int channel) {
 	    //printf("RX\n");
         ioData = getch();
 #endif
-		return ioData;
+		if (record_file) record_event('R', 0, ioData);
+		return serial_count_rx(0, ioData);
 	  }
 	return -1;
 }
@@ -145,6 +370,7 @@ int quadser_char_available(int channel) {
 }
 
 void quadser_tx(device_t *device, int channel, UINT8 Value) {
+	  serial_out[channel+1]++;
 #ifdef SOCKETCONSOLE
 	  tx_socket_port(channel+1, Value);
 #endif
@@ -152,17 +378,21 @@ void quadser_tx(device_t *device, int channel, UINT8 Value) {
 
 int quadser_rx(device_t *device, int channel) {
 	int ioData;
+	  if (replay_file)
+		return serial_count_rx(channel+1, replay_rx(channel+1));
 	  if(quadser_char_available(channel)) {
 #ifdef SOCKETCONSOLE
 	    ioData = rx_socket_port(channel+1);
 #endif
-		return ioData;
+		if (record_file) record_event('R', channel+1, ioData);
+		return serial_count_rx(channel+1, ioData);
 	  }
 	return -1;
 }
 
 void quadser_int_state_cb(device_t *device, int state) {
 	/*if (VERBOSE) printf("QUADSER int: %d\n",state);*/
+	if (replay_file || record_file) replay_irq(1, state);
 	z280_set_irq_line(cpu,1,state); /* INTB line */
 }
 
@@ -303,22 +533,17 @@ void boot1dma () {
    }
 }
 
-void io_device_update() {
+// returns nonzero if there was serial activity
+int io_device_update(unsigned long cycles) {
+	int active = 0;
+	HOSTPROF_ENTER(HP_IOUPDATE);
 #ifdef SOCKETCONSOLE
-    // check socket open and optionally reopen it
-    if (!is_connected_socket_port(0)) open_socket_port(0);
-	if (enable_quadser) {
-		if (!is_connected_socket_port(1)) open_socket_port(1);
-		if (enable_quadser > 1)
-		{
-			if (!is_connected_socket_port(2)) open_socket_port(2);
-			if (enable_quadser == 4) {
-				if (!is_connected_socket_port(3)) open_socket_port(3);
-				if (!is_connected_socket_port(4)) open_socket_port(4);
-			}
-		}
-	}
+	// pick up input, new connections and disconnects without blocking
+	active = poll_socket_ports(0) > 0;
+	active |= update_tx_socket_ports(cycles);
 #endif
+	HOSTPROF_LEAVE();
+	return active;
 }
 
 void CloseIDE() {
@@ -333,12 +558,104 @@ void InitIDE() {
    printf("Attaching IDE00: %s\n",ifn00);
    if ((if00=fopen(ifn00,"r+b"))) {
      ifd00=fileno(if00);
-     ide_attach(ic0,0,ifd00);
+     if (idemmap)
+       ide_attach_mmap(ic0,0,ifd00,idesync);
+     else
+       ide_attach(ic0,0,ifd00);
+     if (ic0->drive[0].present)
+       ide_set_cache(&ic0->drive[0],idecache,idecache_interval);
    }
    ide_reset_begin(ic0);
    atexit(CloseIDE);
 }
 
+/* performance counters: shown on SIGUSR1 and every stats_interval seconds,
+   as text on stdout and as one JSON object per line on stats_fd */
+#define STATS_INTERVAL 10 /* default seconds between JSON lines */
+int stats_interval = 0;
+int stats_fd = -1;
+FILE *stats_out = NULL;
+volatile int stats_request = 0;
+struct timeval stats_t0, stats_last;
+unsigned long long stats_last_cycles;
+unsigned long long stats_t0_cycles, stats_t0_instrs; /* restored by -load-state, not run here */
+const char *irq_names[] = { "nmi", "irq0", "ctr0", "dma0", "irq1", "ctr1", "uartrx",
+	"dma1", "irq2", "uarttx", "dma2", "ctr2", "dma3" };
+
+void stats_dump(const char *event, int text) {
+	struct z280_stats s;
+	struct timeval now;
+	struct ide_drive *d = &ic0->drive[0];
+	unsigned long long cycles = cycle_stamp();
+	double uptime, dt, mhz, mhz_now, nominal = XTALCLK / 2 / 1e6;
+	int i;
+
+	cpu_get_stats_z280(cpu, &s);
+	gettimeofday(&now, 0);
+	uptime = (now.tv_sec - stats_t0.tv_sec) + (now.tv_usec - stats_t0.tv_usec) / 1e6;
+	dt = (now.tv_sec - stats_last.tv_sec) + (now.tv_usec - stats_last.tv_usec) / 1e6;
+	mhz = uptime > 0 ? (cycles - stats_t0_cycles) / uptime / 1e6 : 0;
+	mhz_now = dt > 0 ? (cycles - stats_last_cycles) / dt / 1e6 : mhz;
+
+	if (text) {
+		printf("Stats: %.1f s, %llu instrs (%.2f MIPS), %llu cycles, %.2f MHz of %.4f (%.1f%%), now %.2f MHz\n",
+			uptime, instrcnt, uptime > 0 ? (instrcnt - stats_t0_instrs) / uptime / 1e6 : 0, cycles,
+			mhz, nominal, 100 * mhz / nominal, mhz_now);
+		printf("  MMU translations %llu\n  traps:", s.mmu);
+		for (i = 0; i <= Z280_TRAP_FATAL; i++)
+			if (s.traps[i])
+				printf(" %s %llu", trap_names[i], s.traps[i]);
+		printf("\n  interrupts:");
+		for (i = 0; i <= Z280_INT_MAX; i++)
+			if (s.interrupts[i])
+				printf(" %s %llu", irq_names[i], s.interrupts[i]);
+		printf("\n  DMA bytes: %llu %llu %llu %llu\n", s.dma[0], s.dma[1], s.dma[2], s.dma[3]);
+		printf("  IDE sectors: %llu read, %llu written\n  serial in/out:",
+			(unsigned long long)d->sectors_read, (unsigned long long)d->sectors_written);
+		for (i = 0; i < SERIAL_PORTS; i++)
+			printf(" %d %llu/%llu", i, serial_in[i], serial_out[i]);
+#ifdef SOCKETCONSOLE
+		printf("\n  serial dropped stalled/replay:");
+		for (i = 0; i < SERIAL_PORTS; i++)
+			printf(" %d %llu/%llu", i, tx_dropped[i], replay_dropped[i]);
+#endif
+		printf("\n");
+		fflush(stdout);
+	}
+	if (stats_out) {
+		fprintf(stats_out, "{\"event\":\"%s\",\"instance\":%d,\"time\":%ld.%06ld,\"uptime\":%.3f,"
+			"\"instructions\":%llu,\"cycles\":%llu,\"mhz\":%.3f,\"mhz_interval\":%.3f,\"mhz_nominal\":%.4f,"
+			"\"mmu_translations\":%llu,\"traps\":{",
+			event, fork_instance, (long)now.tv_sec, (long)now.tv_usec, uptime,
+			instrcnt, cycles, mhz, mhz_now, nominal, s.mmu);
+		for (i = 0; i <= Z280_TRAP_FATAL; i++)
+			fprintf(stats_out, "%s\"%s\":%llu", i ? "," : "", trap_names[i], s.traps[i]);
+		fprintf(stats_out, "},\"interrupts\":{");
+		for (i = 0; i <= Z280_INT_MAX; i++)
+			fprintf(stats_out, "%s\"%s\":%llu", i ? "," : "", irq_names[i], s.interrupts[i]);
+		fprintf(stats_out, "},\"dma_bytes\":[%llu,%llu,%llu,%llu],\"ide_read\":%llu,\"ide_written\":%llu,"
+			"\"serial_in\":[", s.dma[0], s.dma[1], s.dma[2], s.dma[3],
+			(unsigned long long)d->sectors_read, (unsigned long long)d->sectors_written);
+		for (i = 0; i < SERIAL_PORTS; i++)
+			fprintf(stats_out, "%s%llu", i ? "," : "", serial_in[i]);
+		fprintf(stats_out, "],\"serial_out\":[");
+		for (i = 0; i < SERIAL_PORTS; i++)
+			fprintf(stats_out, "%s%llu", i ? "," : "", serial_out[i]);
+#ifdef SOCKETCONSOLE
+		fprintf(stats_out, "],\"serial_dropped\":[");
+		for (i = 0; i < SERIAL_PORTS; i++)
+			fprintf(stats_out, "%s%llu", i ? "," : "", tx_dropped[i]);
+		fprintf(stats_out, "],\"serial_replay_dropped\":[");
+		for (i = 0; i < SERIAL_PORTS; i++)
+			fprintf(stats_out, "%s%llu", i ? "," : "", replay_dropped[i]);
+#endif
+		fprintf(stats_out, "]}\n");
+		fflush(stats_out);
+	}
+	stats_last = now;
+	stats_last_cycles = cycles;
+}
+
 #ifndef _WIN32
 void sigint_handler(int s)	{
 	// POSIX SIGINT handler
@@ -348,8 +665,18 @@ void sigint_handler(int s)	{
 void sigquit_handler(int s)	{
 	// POSIX SIGQUIT handler
 	printf("\nExiting emulation.\n");
-	shutdown_socket_ports(); // close sockets to prevent waiting for a connection
 	g_quit = 1; // make sure atexit is called
+	flight_request = 2;
+}
+
+void sigusr2_handler(int s)	{
+	// dump the flight recorder and carry on
+	flight_request = 1;
+}
+
+void sigusr1_handler(int s)	{
+	// show the performance counters and carry on
+	stats_request = 1;
 }
 #endif
 
@@ -372,6 +699,282 @@ void destroy_rtc()
 	ds1202_1302_destroy(rtc,1);
 }
 
+#ifdef Z280_OPSTATS
+/* opcode statistics report, stdout unless -opstats= */
+char *opstats_file = NULL;
+#endif
+
+/* machine snapshots: RAM and board state, then each device as its own module */
+char *save_state_file = NULL;
+char *load_state_file = NULL;
+#define SNAP_MACHINE "Z280RC"
+#define SNAP_MAJOR 0
+#define SNAP_MINOR 3
+#define MAX_SNAP_CHAIN 256
+
+/* incremental checkpoints: prefix.000 is a full snapshot, the following ones
+   only hold the RAM pages and overlay sectors written since the previous one;
+   each new full one replaces the chain before it */
+char *checkpoint_prefix = NULL;
+int checkpoint_interval = 5; /* seconds */
+int checkpoint_seq = 0;
+#define CHECKPOINT_CHAIN 32  /* a full snapshot after this many */
+
+/* RAM pages in a snapshot: all of them, or only the dirty ones if parent is set */
+int write_board_snapshot(snapshot_t *s, char *parent) {
+	int i, n = 0;
+	snapshot_module_t *m = snapshot_module_create(s, "Z280RC", SNAP_MAJOR, SNAP_MINOR);
+	if (m == NULL)
+		return -1;
+	for (i = 0; i < RAM_PAGES; i++)
+		if (!parent || ram_dirty[i])
+			n++;
+	if (SMW_QW(m, instrcnt) < 0
+		|| SMW_QW(m, cyclecnt) < 0
+		|| SMW_DW(m, ins8250_clock) < 0
+		|| SMW_STR(m, parent ? parent : "") < 0
+		|| SMW_DW(m, n) < 0)
+		goto fail;
+	for (i = 0; i < RAM_PAGES; i++)
+		if (!parent || ram_dirty[i])
+			if (SMW_W(m, i) < 0 || SMW_BA(m, &_ram[i << RAM_PAGE_SHIFT], RAM_PAGE_SIZE) < 0)
+				goto fail;
+	return snapshot_module_close(m);
+fail:
+	snapshot_module_close(m);
+	return -1;
+}
+
+/* restores the RAM of the whole chain of parents first, then our pages;
+   since 0.2 a parent is named relative to the directory of the file fn */
+int read_board_snapshot(snapshot_t *s, const char *fn, int depth) {
+	uint8_t vmajor, vminor;
+	uint64_t icnt, ccnt = 0;
+	uint32_t clk, n;
+	uint16_t page;
+	char *parent = NULL, path[FILENAME_MAX];
+	const char *dir;
+	snapshot_t *ps;
+	snapshot_module_t *m = snapshot_module_open(s, "Z280RC", &vmajor, &vminor);
+	if (m == NULL)
+		return -1;
+	if (vmajor > SNAP_MAJOR || vminor > SNAP_MINOR) {
+		snapshot_set_error(SNAPSHOT_MODULE_HIGHER_VERSION);
+		goto fail;
+	}
+	if (SMR_QW(m, &icnt) < 0
+		|| (vminor >= 2 && SMR_QW(m, &ccnt) < 0)
+		|| SMR_DW(m, &clk) < 0)
+		goto fail;
+	if (vminor == 0) {
+		// 0.0: the whole RAM in one piece
+		if (SMR_BA(m, _ram, sizeof(_ram)) < 0)
+			goto fail;
+	} else {
+		if (SMR_STR(m, &parent) < 0 || SMR_DW(m, &n) < 0)
+			goto fail;
+		if (parent && *parent) {
+			if (depth >= MAX_SNAP_CHAIN) {
+				snapshot_set_error(SNAPSHOT_MODULE_INCOMPATIBLE);
+				goto fail;
+			}
+			if (vminor >= 2 && *parent != '/' && (dir = strrchr(fn, '/')))
+				snprintf(path, sizeof(path), "%.*s/%s", (int)(dir - fn), fn, parent);
+			else
+				snprintf(path, sizeof(path), "%s", parent);
+			if ((ps = snapshot_open(path, &vmajor, &vminor, SNAP_MACHINE)) == NULL)
+				goto fail;
+			if (read_board_snapshot(ps, path, depth + 1) < 0
+				|| ide_read_disk_snapshot(ic0, ps, 0) < 0) {
+				snapshot_close(ps);
+				goto fail;
+			}
+			snapshot_close(ps);
+		}
+		while (n--) {
+			if (SMR_W(m, &page) < 0)
+				goto fail;
+			if (page >= RAM_PAGES) {
+				snapshot_set_error(SNAPSHOT_MODULE_INCOMPATIBLE);
+				goto fail;
+			}
+			if (SMR_BA(m, &_ram[page << RAM_PAGE_SHIFT], RAM_PAGE_SIZE) < 0)
+				goto fail;
+		}
+		free(parent);
+	}
+	instrcnt = icnt;
+	cyclecnt = ccnt;
+	ins8250_clock = clk;
+	return snapshot_module_close(m);
+fail:
+	free(parent);
+	snapshot_module_close(m);
+	return -1;
+}
+
+/* a checkpoint also records the disk contents, see ide_write_disk_snapshot() */
+int save_state(char *fn, char *parent, int checkpoint) {
+	snapshot_t *s = snapshot_create(fn, SNAP_MAJOR, SNAP_MINOR, SNAP_MACHINE);
+	if (s == NULL
+		|| write_board_snapshot(s, parent) < 0
+		|| cpu_write_snapshot_z280(cpu, s) < 0
+		|| pc16554_device_write_snapshot(quadser, s) < 0
+		|| ide_write_snapshot(ic0, s) < 0
+		|| (checkpoint && ide_write_disk_snapshot(ic0, s, parent ? IDE_DISK_DELTA : IDE_DISK_FULL) < 0)
+		|| ds1202_1302_write_snapshot(rtc, s) < 0) {
+		printf("Cannot save state to %s: %s\n", fn, snapshot_error_string(snapshot_get_error()));
+		if (s) {
+			snapshot_close(s);
+			remove(fn);
+		}
+		return -1;
+	}
+	if (snapshot_close(s) < 0) {
+		printf("Cannot save state to %s: %s\n", fn, snapshot_error_string(snapshot_get_error()));
+		return -1;
+	}
+	printf("State saved to %s\n", fn);
+	return 0;
+}
+
+int load_state(char *fn) {
+	uint8_t vmajor, vminor;
+	snapshot_t *s = snapshot_open(fn, &vmajor, &vminor, SNAP_MACHINE);
+	if (s && (vmajor > SNAP_MAJOR || vminor > SNAP_MINOR))
+		snapshot_set_error(SNAPSHOT_MODULE_HIGHER_VERSION);
+	else if (s
+		&& read_board_snapshot(s, fn, 0) == 0
+		&& cpu_read_snapshot_z280(cpu, s) == 0
+		&& pc16554_device_read_snapshot(quadser, s) == 0
+		&& ide_read_snapshot(ic0, s) == 0
+		&& ide_read_disk_snapshot(ic0, s, 1) == 0
+		&& ds1202_1302_read_snapshot(rtc, s) == 0) {
+		snapshot_close(s);
+		printf("State loaded from %s\n", fn);
+		return 0;
+	}
+	printf("Cannot load state from %s: %s\n", fn, snapshot_error_string(snapshot_get_error()));
+	if (s)
+		snapshot_close(s);
+	return -1;
+}
+
+void checkpoint() {
+	char fn[FILENAME_MAX], parent[FILENAME_MAX];
+	char *base = strrchr(checkpoint_prefix, '/');
+	int i, full = checkpoint_seq % CHECKPOINT_CHAIN == 0;
+	snprintf(fn, sizeof(fn), "%s.%03d", checkpoint_prefix, checkpoint_seq);
+	// the parent sits next to us, so name it without the directory
+	snprintf(parent, sizeof(parent), "%s.%03d", base ? base + 1 : checkpoint_prefix, checkpoint_seq - 1);
+	if (save_state(fn, full ? NULL : parent, 1) == 0) {
+		memset(ram_dirty, 0, sizeof(ram_dirty));
+		ide_checkpoint_done(ic0);
+		// a new full snapshot: the previous chain is no longer needed
+		if (full)
+			for (i = checkpoint_seq - CHECKPOINT_CHAIN; i >= 0 && i < checkpoint_seq; i++) {
+				snprintf(fn, sizeof(fn), "%s.%03d", checkpoint_prefix, i);
+				remove(fn);
+			}
+		checkpoint_seq++;
+	}
+}
+
+void init_serial_ports() {
+#ifdef SOCKETCONSOLE
+	init_socket_port(0); // UART Console
+	if (enable_quadser)
+	{
+	    init_socket_port(1);
+	    if (enable_quadser > 1)
+		{
+			init_socket_port(2);
+			if (enable_quadser == 4) {
+				init_socket_port(3);
+				init_socket_port(4);
+			}
+		}
+	}
+#endif
+}
+
+#ifndef _WIN32
+char *clone_name(char *name) {
+	char *s = malloc(strlen(name) + 8);
+	sprintf(s, "%s.%d", name, fork_instance);
+	return s;
+}
+
+/* the parent only waits for the clones and exits with failure if any did;
+   each clone returns with its own serial ports and disk overlay */
+void fork_clones() {
+	struct ide_drive *d = &ic0->drive[0];
+	int i, status, failed = 0;
+	pid_t pid;
+
+	// settle what the clones would otherwise share
+#ifdef SOCKETCONSOLE
+	for (i = 0; i < MAX_SOCKET_PORTS; i++)
+		flush_socket_port(i);
+#endif
+	if (d->present)
+		ide_set_cache(d, IDE_CACHE_WRITETHROUGH, 0);
+	fflush(stdout);
+	if (record_file)
+		fflush(record_file);
+	trace_flush();
+
+	for (i = 1; i <= fork_count; i++) {
+		if ((pid = fork()) < 0) {
+			printf("Cannot fork clone %d\n", i);
+			break;
+		}
+		if (pid == 0) {
+			fork_instance = i;
+			fork_count = 0;
+#ifdef SOCKETCONSOLE
+			release_socket_ports();
+			port_instance = i;
+			init_serial_ports();
+#endif
+			if (ide_fork(d) < 0)
+				exit(1);
+			if (d->present)
+				ide_set_cache(d, idecache, idecache_interval);
+			if (save_state_file)
+				save_state_file = clone_name(save_state_file);
+			if (checkpoint_prefix) {
+				checkpoint_prefix = clone_name(checkpoint_prefix);
+				checkpoint_seq = 0;
+			}
+			if (profile_file)
+				profile_file = clone_name(profile_file);
+			if (callgraph_file)
+				callgraph_file = clone_name(callgraph_file);
+			if (trace_file && trace_fork(trace_file = clone_name(trace_file)) < 0)
+				exit(1);
+			if (record_file) {
+				fclose(record_file);
+				record_name = clone_name(record_name);
+				if (!(record_file = fopen(record_name, "w")))
+					printf("Cannot create %s\n", record_name);
+			}
+			printf("Clone %d running at instruction %llu\n", i, instrcnt);
+			return;
+		}
+		printf("Clone %d: pid %d\n", i, (int)pid);
+	}
+#ifdef SOCKETCONSOLE
+	shutdown_socket_ports();
+#endif
+	while ((pid = wait(&status)) > 0 || (pid < 0 && errno == EINTR))
+		if (pid > 0 && (!WIFEXITED(status) || WEXITSTATUS(status) != 0))
+			failed++;
+	printf("%d of %d clones failed\n", failed, i - 1);
+	exit(failed || i <= fork_count);
+}
+#endif
+
 int main(int argc, char** argv)
 {
 	printf("z280emu v1.0 Z280RC\n");
@@ -380,17 +983,28 @@ int main(int argc, char** argv)
 #ifndef _WIN32
 	// on POSIX, route SIGQUIT (CTRL+\) to graceful shutdown
 	signal(SIGQUIT, sigquit_handler);
+	signal(SIGUSR2, sigusr2_handler);
+	signal(SIGUSR1, sigusr1_handler);
 #endif
 	// on MINGW, keep CTRL+Break (and window close button) enabled
 	// MINGW always calls atexit in these cases
 
+#ifdef SOCKETCONSOLE
+	tx_latency = (unsigned long)((unsigned long long)TX_LATENCY_US * (XTALCLK/2) / 1000000);
+#endif
+
 	// parse arguments
 	int i;
 	for (i = 0; i < argc; i++)
 	{
 		if (argv[i][0]=='-')
 		{
-			if (argv[i][1]=='d')
+			if (strcmp(argv[i],"-detach")==0)
+			{
+				// boot right away, clients can attach later
+				detach = 1;
+			}
+			else if (argv[i][1]=='d')
 			{
 				starttrace = 0;
 				if (argv[i][2]=='=')
@@ -399,6 +1013,176 @@ int main(int argc, char** argv)
 				}
 				VERBOSE = starttrace==0?1:0;
 			} 
+			else if (strncmp(argv[i],"-save-state=",12)==0)
+			{
+				// write a snapshot of the machine on exit
+				save_state_file = &argv[i][12];
+			}
+			else if (strncmp(argv[i],"-load-state=",12)==0)
+			{
+				// resume from a snapshot instead of booting
+				load_state_file = &argv[i][12];
+			}
+#ifndef _WIN32
+			else if (strncmp(argv[i],"-fork=",6)==0)
+			{
+				// number of clones to fork from the booted machine
+				fork_count = atoi(&argv[i][6]);
+			}
+			else if (strncmp(argv[i],"-forkon=",8)==0)
+			{
+				// ...once the console has printed this
+				fork_prompt = &argv[i][8];
+			}
+			else if (strncmp(argv[i],"-forkat=",8)==0)
+			{
+				// ...or at this instruction count
+				fork_at = atoll(&argv[i][8]);
+			}
+#endif
+			else if (strncmp(argv[i],"-expect=",8)==0 || strncmp(argv[i],"-send=",6)==0)
+			{
+				// console script: wait for this output, type this input
+				int send = argv[i][1] == 's';
+				if (script_add(send, &argv[i][send ? 6 : 8]) < 0)
+				{
+					printf("Bad script step: %s\n", argv[i]);
+					exit(1);
+				}
+			}
+			else if (strncmp(argv[i],"-checkpoint=",12)==0)
+			{
+				// incremental snapshots prefix.000, prefix.001... every few seconds
+				char *c;
+				checkpoint_prefix = &argv[i][12];
+				if ((c = strrchr(checkpoint_prefix, ',')))
+				{
+					*c = 0;
+					checkpoint_interval = atoi(c+1);
+				}
+			}
+			else if (strncmp(argv[i],"-tracefile=",11)==0)
+			{
+				// binary -d trace, optionally with the buffer size in MB
+				char *c;
+				trace_file = &argv[i][11];
+				if ((c = strrchr(trace_file, ',')))
+				{
+					*c = 0;
+					trace_ring = (size_t)atoi(c+1) << 20;
+				}
+			}
+			else if (strncmp(argv[i],"-flight",7)==0 && (argv[i][7]==0 || argv[i][7]=='='))
+			{
+				// keep the last instructions (default 65536) for a dump
+				flight_size = argv[i][7] ? atoi(&argv[i][8]) : 65536;
+			}
+			else if (strcmp(argv[i],"-flightregs")==0)
+			{
+				// record the registers too, at some cost in speed
+				flight_want_regs = 1;
+				if (!flight_size)
+					flight_size = 65536;
+			}
+			else if (strncmp(argv[i],"-flighttraps=",13)==0)
+			{
+				// dump on these traps, default fatal
+				if (flight_parse_traps(strdup(&argv[i][13])) < 0)
+				{
+					printf("Bad trap list: %s\n", &argv[i][13]);
+					exit(1);
+				}
+			}
+			else if (strncmp(argv[i],"-profile=",9)==0)
+			{
+				// sample the PC, optionally every so many cycles
+				char *c;
+				profile_file = &argv[i][9];
+				if ((c = strrchr(profile_file, ',')))
+				{
+					*c = 0;
+					profile_period = atol(c+1);
+				}
+			}
+			else if (strncmp(argv[i],"-callgraph=",11)==0)
+			{
+				// follow calls and interrupts, write collapsed stacks
+				callgraph_file = &argv[i][11];
+			}
+#ifdef Z280_OPSTATS
+			else if (strncmp(argv[i],"-opstats=",9)==0)
+			{
+				// opcode statistics to a file instead of stdout
+				opstats_file = &argv[i][9];
+			}
+#endif
+			else if (strncmp(argv[i],"-stats=",7)==0)
+			{
+				// performance counters every so many seconds
+				stats_interval = atoi(&argv[i][7]);
+			}
+			else if (strncmp(argv[i],"-statsfd=",9)==0)
+			{
+				// performance counters as JSON lines to an open fd
+				stats_fd = atoi(&argv[i][9]);
+				if (!(stats_out = fdopen(stats_fd, "w")))
+				{
+					printf("Cannot write stats to fd %d\n", stats_fd);
+					exit(1);
+				}
+				if (!stats_interval)
+					stats_interval = STATS_INTERVAL;
+			}
+			else if (strncmp(argv[i],"-sym=",5)==0)
+			{
+				// symbols for the profile, file[,physical base]
+				if (profile_load_symbols(&argv[i][5]) < 0)
+					exit(1);
+			}
+			else if (strncmp(argv[i],"-tracefilter=",13)==0)
+			{
+				// trace only what matches, e.g. pc=0100-01FF,user
+				if (trace_filter_parse(strdup(&argv[i][13])) < 0)
+				{
+					printf("Bad trace filter: %s\n", &argv[i][13]);
+					exit(1);
+				}
+			}
+			else if (strncmp(argv[i],"-record=",8)==0)
+			{
+				// log serial input, interrupts and RTC time for replay
+				record_name = &argv[i][8];
+			}
+			else if (strncmp(argv[i],"-replay=",8)==0)
+			{
+				// feed a recorded log back instead of the live input
+				if (!(replay_file = fopen(&argv[i][8], "r")))
+				{
+					printf("Cannot open %s\n", &argv[i][8]);
+					exit(1);
+				}
+			}
+			else if (strncmp(argv[i],"-idecache=",10)==0)
+			{
+				// write-back cache: flush (on FLUSH CACHE/exit), wt, or flush interval in ms
+				if (strcmp(&argv[i][10],"flush")==0)
+					idecache = IDE_CACHE_FLUSH;
+				else if (strcmp(&argv[i][10],"wt")==0)
+					idecache = IDE_CACHE_WRITETHROUGH;
+				else
+				{
+					idecache = IDE_CACHE_PERIODIC;
+					idecache_interval = atoi(&argv[i][10]);
+				}
+			}
+			else if (strncmp(argv[i],"-idemmap",8)==0)
+			{
+				idemmap = 1;
+				if (argv[i][8]=='=')
+				{
+					idesync = atoi(&argv[i][9]);
+				}
+			}
 			else if (strncmp(argv[i],"-quadser",8)==0)
 			{
 				enable_quadser = 1;
@@ -410,32 +1194,66 @@ int main(int argc, char** argv)
 						enable_quadser = 4;
 				}
 			}
+#ifdef SOCKETCONSOLE
+			else if (strncmp(argv[i],"-txlatency=",11)==0)
+			{
+				// max. emulated time a transmitted byte may wait in the output buffer, in us
+				tx_latency = (unsigned long)(atof(&argv[i][11]) * (XTALCLK/2) / 1000000);
+			}
+			else if (strncmp(argv[i],"-port",5)==0 && argv[i][5]>='0' && argv[i][5]<'0'+MAX_SOCKET_PORTS && argv[i][6]=='=')
+			{
+				// serial port backend: tcp, unix:path, pty or fd:n
+				port_specs[argv[i][5]-'0'] = &argv[i][7];
+			}
+#endif
 		}
 	}
 
 #ifdef SOCKETCONSOLE
 	init_TCPIP();
-	init_socket_port(0); // UART Console
-	if (enable_quadser)
-	{
-	    init_socket_port(1);
-	    if (enable_quadser > 1)
-		{
-			init_socket_port(2);
-			if (enable_quadser == 4) {
-				init_socket_port(3);
-				init_socket_port(4);
-			}
-		}
-	}
+	init_serial_ports();
 	atexit(shutdown_socket_ports);
+	// wait for serial socket connections
+	while (!detach && !g_quit && !all_connected_socket_ports())
+		poll_socket_ports(100);
 #endif
-	io_device_update(); // wait for serial socket connections
 
 #ifdef _WIN32
 	setmode(fileno(stdout), O_BINARY);
 #endif
 
+	// a filter traces from the start unless -d says otherwise
+	if (tf.on)
+	{
+		if (starttrace == -1LL)
+			starttrace = 0;
+		VERBOSE = 0;
+	}
+
+	if (record_name && !(record_file = fopen(record_name, "w")))
+	{
+		printf("Cannot create %s\n", record_name);
+		exit(1);
+	}
+	if (replay_file)
+	{
+		if (fork_count)
+		{
+			printf("Clones cannot replay a log\n");
+			exit(1);
+		}
+		replay_read();
+	}
+	if (record_file || replay_file)
+		rtc_time_hook = replay_time;
+
+	if (trace_file)
+	{
+		if (trace_open(trace_file, trace_ring) < 0)
+			exit(1);
+		atexit(trace_close);
+	}
+
 	boot1dma();
 	InitIDE();
 
@@ -458,20 +1276,113 @@ int main(int argc, char** argv)
 	z280_set_rdy_line(cpu, 2, ASSERT_LINE);
 	z280_set_rdy_line(cpu, 3, ASSERT_LINE);
 
+	if (load_state_file && load_state(load_state_file) < 0)
+		exit(1);
+
+	if (flight_size)
+	{
+		if (flight_init(flight_size) < 0)
+			exit(1);
+		z280_trap_hook = flight_trap;
+	}
+	if (callgraph_file)
+		z280_call_hook = callgraph_hook;
+
 	struct timeval t0;
 	struct timeval t1;
 	gettimeofday(&t0, 0);
 	int runtime=50000;
 
+	/* run the cpu in slices between device updates: short ones while serial
+	   data is moving, growing ones while the guest just computes, and never
+	   past the next pending output flush */
+	int quantum = QUANTUM_MIN;
+	int executed;
+	unsigned long deadline;
+	time_t next_checkpoint = time(NULL);
+	time_t next_stats = time(NULL) + stats_interval;
+	stats_t0 = stats_last = t0;
+	stats_t0_cycles = stats_last_cycles = cyclecnt;
+	stats_t0_instrs = instrcnt;
+	script_t0 = t0;
+#ifdef HOSTPROF
+	hostprof_start();
+#endif
+
 	//g_quit = 0;
 	while(!g_quit) {
-		if(instrcnt>=starttrace) VERBOSE=1;
-		cpu_execute_z280(cpu,10000);
-		io_device_update();
+		if(instrcnt>=starttrace) tracing=1;
+		slice_cycles = quantum;
+		HOSTPROF_TIME(HP_CORE, executed = cpu_execute_z280(cpu,quantum));
+		cyclecnt += executed;
+		slice_cycles = quantum - executed; // cycle_stamp() == cyclecnt in between
+		if (replay_file && replay_next.instr < instrcnt)
+			replay_diverged('-', 0);
+		if (record_file)
+			fflush(record_file);
+		if (flight_request == 1) {
+			flight_request = 0;
+			flight_dump(cpu, "SIGUSR2");
+		}
+		if (io_device_update(executed))
+			quantum = QUANTUM_MIN;
+		else if (quantum < QUANTUM_MAX)
+			quantum = quantum < QUANTUM_MAX / 2 ? quantum * 2 : QUANTUM_MAX;
+#ifdef SOCKETCONSOLE
+		deadline = next_tx_deadline_socket_ports();
+		if (deadline < quantum)
+			quantum = deadline < QUANTUM_MIN ? QUANTUM_MIN : deadline;
+#endif
+#ifndef _WIN32
+		if (fork_count && (fork_pending || (fork_at ? instrcnt >= fork_at : !fork_prompt)))
+			fork_clones();
+#endif
+		ide_poll(ic0);
+		if (checkpoint_prefix && time(NULL) >= next_checkpoint) {
+			checkpoint();
+			next_checkpoint = time(NULL) + checkpoint_interval;
+		}
+		if (stats_request) {
+			stats_request = 0;
+			stats_dump("signal", 1);
+		}
+		if (stats_interval && time(NULL) >= next_stats) {
+			stats_dump("periodic", !stats_out);
+			next_stats = time(NULL) + stats_interval;
+		}
 		/*if (!(--runtime))
 			g_quit=1;*/
 	}
 	gettimeofday(&t1, 0);
+	if (flight && flight_request == 2)
+		flight_dump(cpu, "SIGQUIT");
+	if (profile_file)
+		profile_write(profile_file, profile_period, _ram, sizeof(_ram));
+	if (callgraph_file)
+		profile_cg_write(callgraph_file, cycle_stamp());
+	if (stats_interval)
+		stats_dump("exit", !stats_out);
+#ifdef HOSTPROF
+	hostprof_report(stdout);
+#endif
+#ifdef Z280_OPSTATS
+	{
+		FILE *f = opstats_file ? fopen(opstats_file, "w") : stdout;
+		if (f) {
+			z280_opstats_report(f);
+			if (f != stdout)
+				fclose(f);
+		}
+		else
+			printf("Cannot create %s\n", opstats_file);
+	}
+#endif
 	printf("instrs:%llu, time:%g\n",instrcnt, (t1.tv_sec - t0.tv_sec) * 1000.0f + (t1.tv_usec - t0.tv_usec) / 1000.0f);
 
+	if (save_state_file)
+		save_state(save_state_file, NULL, 0);
+	if (checkpoint_prefix)
+		checkpoint(); // the newest one matches the images as they are left
+
+	return 0;
 }